@@ -0,0 +1,196 @@
+/* Compare pools constructed by fp_pool_map() with different backing.
+ *
+ * For each mode a POOL_SIZE pool is mapped and filled with fragments
+ * of random length.  Each operation then replaces one fragment and
+ * writes ACCESSES_PER_OP octets at random offsets in random held
+ * fragments, so accesses are spread over the whole pool as a busy
+ * packet buffer's are.  The modes are:
+ *
+ * lazy: ordinary pages, faulted in on first use;
+ *
+ * prefault: ordinary pages, faulted in when the pool is mapped;
+ *
+ * thp: prefaulted transparent huge pages;
+ *
+ * hugetlb: prefaulted pages from the hugetlb pool, which is usually
+ * empty unless vm.nr_hugepages has been set.
+ *
+ * Output is one tab-separated line per mode: the time to map the
+ * pool, the page faults and data TLB misses taken by the operations,
+ * and the time per operation.  TLB misses are shown as "-" if
+ * performance counters are unavailable.  This requires a library
+ * built with SIZE_BITS=32. */
+
+#define _GNU_SOURCE
+#include <fragpool/fragpool.h>
+#include <fragpool/linux.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#if 32 > FRAGPOOL_SIZE_BITS
+#error bench-hugepage requires FRAGPOOL_SIZE_BITS=32
+#endif /* FRAGPOOL_SIZE_BITS */
+
+#define POOL_SIZE (256UL << 20)
+#define POOL_FRAGMENTS 255
+#define MAX_HELD 200
+#define MIN_FRAGMENT (64UL << 10)
+#define MAX_FRAGMENT (1UL << 20)
+#define ACCESSES_PER_OP 64
+#define OPERATIONS 200000UL
+
+static const struct {
+  const char* name;
+  unsigned int flags;
+} modes[] = {
+  { "lazy", 0 },
+  { "prefault", FP_MAP_PREFAULT },
+  { "thp", FP_MAP_THP | FP_MAP_PREFAULT },
+  { "hugetlb", FP_MAP_HUGETLB | FP_MAP_PREFAULT },
+};
+
+typedef struct fragment {
+  uint8_t* bp;
+  fp_size_t length;
+} fragment;
+
+static uint32_t rng_state = 2463534242UL;
+
+static uint32_t
+rng (void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+static long
+minor_faults (void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_minflt;
+}
+
+/* Open a counter of data TLB read misses in this process */
+static int
+open_dtlb_counter (void)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB
+    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void
+replace_fragment (fp_pool_t p,
+                  fragment* fp)
+{
+  uint8_t* be;
+
+  if (NULL != fp->bp) {
+    fp_release(p, fp->bp);
+  }
+  fp->length = MIN_FRAGMENT + rng() % (MAX_FRAGMENT - MIN_FRAGMENT);
+  fp->bp = fp_request(p, fp->length, fp->length, &be);
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  const int nmodes = sizeof(modes) / sizeof(*modes);
+  fragment held[MAX_HELD];
+  int counter = open_dtlb_counter();
+  int mi;
+
+  printf("# bench-hugepage: %lu MiB pool, %u accesses per operation\n",
+         POOL_SIZE >> 20, ACCESSES_PER_OP);
+  printf("# mode\tmap_ms\tfaults\tdtlb_misses_per_op\tns_per_op\n");
+  for (mi = 0; mi < nmodes; ++mi) {
+    fp_pool_t p;
+    double t0;
+    double map_ms;
+    long faults;
+    unsigned long op;
+    unsigned long sink = 0;
+    uint64_t misses = 0;
+    int i;
+
+    rng_state = 2463534242UL;
+    t0 = now_ns();
+    p = fp_pool_map(POOL_SIZE, POOL_FRAGMENTS, sizeof(int), modes[mi].flags, NULL);
+    map_ms = (now_ns() - t0) / 1e6;
+    if (NULL == p) {
+      printf("%s\tunavailable\n", modes[mi].name);
+      continue;
+    }
+    memset(held, 0, sizeof(held));
+    for (i = 0; i < MAX_HELD; ++i) {
+      replace_fragment(p, held + i);
+    }
+
+    faults = minor_faults();
+    if (0 <= counter) {
+      ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    t0 = now_ns();
+    for (op = 0; op < OPERATIONS; ++op) {
+      replace_fragment(p, held + rng() % MAX_HELD);
+      for (i = 0; i < ACCESSES_PER_OP; ++i) {
+        const fragment* fp = held + rng() % MAX_HELD;
+        if (NULL != fp->bp) {
+          fp->bp[rng() % fp->length] += 1;
+          ++sink;
+        }
+      }
+    }
+    t0 = now_ns() - t0;
+    if (0 <= counter) {
+      ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+      if (sizeof(misses) != read(counter, &misses, sizeof(misses))) {
+        misses = 0;
+      }
+    }
+    faults = minor_faults() - faults;
+
+    printf("%s\t%.1f\t%ld\t", modes[mi].name, map_ms, faults);
+    if (0 <= counter) {
+      printf("%.2f", (double)misses / OPERATIONS);
+    } else {
+      printf("-");
+    }
+    printf("\t%.1f\n", t0 / OPERATIONS);
+    if ((0 != fp_validate(p)) || (0 == sink)) {
+      fprintf(stderr, "pool invalid after %s\n", modes[mi].name);
+      return EXIT_FAILURE;
+    }
+    fp_pool_unmap(p);
+  }
+  return EXIT_SUCCESS;
+}
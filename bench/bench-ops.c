@@ -0,0 +1,293 @@
+/* Measure the cost of pool operations under representative workloads,
+ * compared with the C library allocator.
+ *
+ * Each workload keeps a bounded set of buffers in use, replacing one
+ * per step:
+ *
+ * stream: a buffer is requested with no upper bound as if to receive
+ * a packet of unknown length, then shrunk to the final packet length;
+ * buffers are released in the order they were received;
+ *
+ * churn-fifo: buffers of random size are requested, a quarter are
+ * then grown or shrunk with fp_reallocate(), and they are released in
+ * the order they were obtained;
+ *
+ * churn-random: as churn-fifo, but a random buffer is released at
+ * each step.
+ *
+ * The C library equivalents are malloc(), realloc() and free().
+ * Output is one tab-separated line per workload, allocator, and pool
+ * configuration, giving the average time per step (each step being
+ * one release and one allocation, plus any resize). */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STEPS 1000000UL
+#define MAX_HELD 128
+#define MIN_PACKET 64
+#define MAX_PACKET 1500
+#define RECEIVE_SIZE 1536
+
+typedef struct pool_config {
+  unsigned int size;
+  unsigned int slots;
+  unsigned int alignment;
+} pool_config;
+
+static const pool_config configs[] = {
+  { 4096, 16, 4 },
+  { 16384, 32, 4 },
+  { 32000, 64, 4 },
+  { 32000, 64, 16 },
+  { 32000, 255, 4 },
+};
+
+/* Operations of an allocator under test.  Sizes are in octets;
+ * request() stores the length obtained. */
+typedef struct allocator {
+  const char* name;
+  void* (* request) (size_t min_size, size_t max_size, size_t* lenp);
+  void* (* shrink) (void* bp, size_t new_size);
+  void* (* reallocate) (void* bp, size_t keep, size_t new_size);
+  void (* release) (void* bp);
+} allocator;
+
+static fp_pool_t pool;
+
+static void*
+fp_request_op (size_t min_size,
+               size_t max_size,
+               size_t* lenp)
+{
+  uint8_t* be;
+  uint8_t* bp = fp_request(pool, min_size, (FP_MAX_FRAGMENT_SIZE < max_size) ? FP_MAX_FRAGMENT_SIZE : max_size, &be);
+  if (NULL != bp) {
+    *lenp = be - bp;
+  }
+  return bp;
+}
+
+static void*
+fp_shrink_op (void* bp,
+              size_t new_size)
+{
+  uint8_t* be;
+  return fp_resize(pool, bp, new_size, &be);
+}
+
+static void*
+fp_reallocate_op (void* bp,
+                  size_t keep,
+                  size_t new_size)
+{
+  uint8_t* be;
+  return fp_reallocate(pool, bp, keep, new_size, &be);
+}
+
+static void
+fp_release_op (void* bp)
+{
+  fp_release(pool, bp);
+}
+
+static void*
+libc_request_op (size_t min_size,
+                 size_t max_size,
+                 size_t* lenp)
+{
+  /* Allocate what a stream receiver would have to assume */
+  size_t n = (RECEIVE_SIZE < max_size) ? RECEIVE_SIZE : max_size;
+  *lenp = n;
+  return malloc(n);
+}
+
+static void*
+libc_shrink_op (void* bp,
+                size_t new_size)
+{
+  return realloc(bp, new_size);
+}
+
+static void*
+libc_reallocate_op (void* bp,
+                    size_t keep,
+                    size_t new_size)
+{
+  return realloc(bp, new_size);
+}
+
+static const allocator allocators[] = {
+  { "fragpool", fp_request_op, fp_shrink_op, fp_reallocate_op, fp_release_op },
+  { "libc", libc_request_op, libc_shrink_op, libc_reallocate_op, free },
+};
+
+enum {
+  WL_STREAM,
+  WL_CHURN_FIFO,
+  WL_CHURN_RANDOM,
+};
+
+static const char* const workload_name[] = { "stream", "churn-fifo", "churn-random" };
+
+static uint32_t rng_state;
+
+static uint32_t
+rng (void)
+{
+  /* xorshift32: deterministic, so every allocator sees the same
+   * sequence of sizes */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static size_t
+packet_size (void)
+{
+  return MIN_PACKET + rng() % (MAX_PACKET - MIN_PACKET + 1);
+}
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+/* Run a workload, returning the average time per step and storing
+ * the number of failed allocations. */
+static double
+run_workload (int workload,
+              const allocator* ap,
+              unsigned int nheld,
+              unsigned long* failuresp)
+{
+  void* held[MAX_HELD];
+  unsigned long failures = 0;
+  unsigned long step;
+  unsigned int next = 0;
+  unsigned int i;
+  double t0;
+
+  memset(held, 0, sizeof(held));
+  rng_state = 2463534242UL;
+  t0 = now_ns();
+  for (step = 0; step < STEPS; ++step) {
+    size_t len;
+    void* bp;
+
+    if (WL_CHURN_RANDOM == workload) {
+      i = rng() % nheld;
+    } else {
+      i = next;
+      next = (next + 1) % nheld;
+    }
+    if (NULL != held[i]) {
+      ap->release(held[i]);
+      held[i] = NULL;
+    }
+    if (WL_STREAM == workload) {
+      bp = ap->request(MIN_PACKET, FP_MAX_FRAGMENT_SIZE, &len);
+      if (NULL != bp) {
+        size_t final = packet_size();
+        if (final < len) {
+          bp = ap->shrink(bp, final);
+        }
+      }
+    } else {
+      size_t n = packet_size();
+      bp = ap->request(n, n, &len);
+      if ((NULL != bp) && (0 == (rng() % 4))) {
+        void* nbp = ap->reallocate(bp, MIN_PACKET, packet_size());
+        if (NULL != nbp) {
+          bp = nbp;
+        }
+      }
+    }
+    if (NULL == bp) {
+      ++failures;
+    }
+    held[i] = bp;
+  }
+  for (i = 0; i < nheld; ++i) {
+    if (NULL != held[i]) {
+      ap->release(held[i]);
+    }
+  }
+  *failuresp = failures;
+  return (now_ns() - t0) / STEPS;
+}
+
+static fp_pool_t
+create_pool (const pool_config* cp)
+{
+  fp_pool_t p = calloc(1, sizeof(*p) + cp->slots * sizeof(*p->fragment));
+  uint8_t* data = malloc(cp->size);
+
+  if ((NULL == p) || (NULL == data)) {
+    return NULL;
+  }
+  p->pool_start = data;
+  p->pool_end = data + cp->size;
+  p->pool_alignment = cp->alignment;
+  p->fragment_count = cp->slots;
+  fp_reset(p);
+  return p;
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  const int nconfigs = sizeof(configs) / sizeof(*configs);
+  int workload;
+
+  printf("# bench-ops: ns per step (release + allocate + any resize)\n");
+  printf("# workload\tallocator\tpool_size\tslots\talignment\tns_per_step\tfailures\n");
+  for (workload = WL_STREAM; workload <= WL_CHURN_RANDOM; ++workload) {
+    unsigned long failures;
+    double ns;
+    int ci;
+
+    for (ci = 0; ci < nconfigs; ++ci) {
+      const pool_config* cp = configs + ci;
+      /* Packets average (MIN_PACKET + MAX_PACKET) / 2 octets, so
+       * this holds about half the pool, within the slots
+       * available. */
+      unsigned int nheld = cp->size / (MIN_PACKET + MAX_PACKET);
+
+      if (nheld > cp->slots / 2) {
+        nheld = cp->slots / 2;
+      }
+      if (nheld > MAX_HELD) {
+        nheld = MAX_HELD;
+      }
+      pool = create_pool(cp);
+      if (NULL == pool) {
+        fprintf(stderr, "unable to create pool\n");
+        return EXIT_FAILURE;
+      }
+      ns = run_workload(workload, allocators + 0, nheld, &failures);
+      printf("%s\t%s\t%u\t%u\t%u\t%.1f\t%lu\n", workload_name[workload],
+             allocators[0].name, cp->size, cp->slots, cp->alignment, ns, failures);
+      if (0 != fp_validate(pool)) {
+        fprintf(stderr, "pool invalid after %s\n", workload_name[workload]);
+        return EXIT_FAILURE;
+      }
+      free(pool->pool_start);
+      free(pool);
+
+      ns = run_workload(workload, allocators + 1, nheld, &failures);
+      printf("%s\t%s\t%u\t%u\t%u\t%.1f\t%lu\n", workload_name[workload],
+             allocators[1].name, cp->size, cp->slots, cp->alignment, ns, failures);
+    }
+  }
+  return EXIT_SUCCESS;
+}
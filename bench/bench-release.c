@@ -0,0 +1,196 @@
+/* Measure the cost of locating and releasing fragments as the number
+ * of fragment slots in a pool grows.
+ *
+ * For each slot count a pool is filled with equal-sized allocated
+ * fragments.  The fragment lookup used by fp_release() is timed
+ * against the linear scan it replaced, then fp_release() itself is
+ * timed on every other fragment (so no merging occurs).  Finally a
+ * burst releasing every fragment is timed using fp_release() and
+ * fp_release_many().
+ *
+ * Output is one tab-separated line per slot count. */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <fragpool/fragpool_.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FRAGMENT_SIZE 64
+#define OPS_PER_SIZE 2000000UL
+#define BURST_OPS_PER_SIZE 200000UL
+
+/* The fragment lookup as implemented before it used binary search */
+static fp_fragment_t
+linear_get_fragment (fp_pool_t p,
+                     const uint8_t* bp)
+{
+  fp_fragment_t f = p->fragment;
+  fp_fragment_t fe = f + p->fragment_count;
+  do {
+    if (FP_FRAGMENT_START(p, f) == bp) {
+      return f;
+    }
+  } while ((++f < fe) && (0 != f->length));
+  return NULL;
+}
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+/* Reallocate every fragment of a pool released as a burst, in order */
+static int
+refill_pool (fp_pool_t p,
+             unsigned int nslots,
+             uint8_t** starts)
+{
+  unsigned int i;
+
+  for (i = 0; i < nslots; ++i) {
+    uint8_t* be;
+    if (starts[i] != fp_request(p, FRAGMENT_SIZE, FRAGMENT_SIZE, &be)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static fp_pool_t
+create_full_pool (unsigned int nslots,
+                  uint8_t** starts)
+{
+  fp_pool_t p = calloc(1, sizeof(*p) + nslots * sizeof(*p->fragment));
+  uint8_t* data = malloc(nslots * FRAGMENT_SIZE);
+  unsigned int i;
+
+  if ((NULL == p) || (NULL == data)) {
+    return NULL;
+  }
+  p->pool_start = data;
+  p->pool_end = data + nslots * FRAGMENT_SIZE;
+  p->pool_alignment = sizeof(int);
+  p->fragment_count = nslots;
+  fp_reset(p);
+  for (i = 0; i < nslots; ++i) {
+    uint8_t* be;
+    starts[i] = fp_request(p, FRAGMENT_SIZE, FRAGMENT_SIZE, &be);
+    if (NULL == starts[i]) {
+      return NULL;
+    }
+  }
+  return p;
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  static const unsigned int slot_counts[] = { 4, 8, 16, 32, 64, 128, 255 };
+  const int nsizes = sizeof(slot_counts) / sizeof(*slot_counts);
+  uint8_t* starts[255];
+  double clock_ns;
+  unsigned long r;
+  int si;
+
+  /* Calibrate the cost of reading the clock, which is charged to
+   * each batch of releases. */
+  clock_ns = now_ns();
+  for (r = 0; r < OPS_PER_SIZE; ++r) {
+    (void)now_ns();
+  }
+  clock_ns = (now_ns() - clock_ns) / OPS_PER_SIZE;
+
+  printf("# bench-release: ns per operation\n");
+  printf("# slots\tlinear_lookup\tlookup\trelease\tburst_release\tburst_release_many\n");
+  for (si = 0; si < nsizes; ++si) {
+    unsigned int nslots = slot_counts[si];
+    fp_pool_t p = create_full_pool(nslots, starts);
+    unsigned long rounds = OPS_PER_SIZE / nslots;
+    unsigned int i;
+    uintptr_t sink = 0;
+    double t0;
+    double linear_ns;
+    double lookup_ns;
+    double release_ns = 0;
+    double burst_ns = 0;
+    double burst_many_ns = 0;
+    unsigned long nreleased = 0;
+
+    if (NULL == p) {
+      fprintf(stderr, "unable to create pool with %u slots\n", nslots);
+      return EXIT_FAILURE;
+    }
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+      for (i = 0; i < nslots; ++i) {
+        sink += (uintptr_t)linear_get_fragment(p, starts[i]);
+      }
+    }
+    linear_ns = (now_ns() - t0) / (rounds * nslots);
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+      for (i = 0; i < nslots; ++i) {
+        sink += (uintptr_t)fp_get_fragment(p, starts[i]);
+      }
+    }
+    lookup_ns = (now_ns() - t0) / (rounds * nslots);
+
+    for (r = 0; r < rounds; ++r) {
+      t0 = now_ns();
+      for (i = 0; i < nslots; i += 2) {
+        sink += fp_release(p, starts[i]);
+      }
+      release_ns += now_ns() - t0 - clock_ns;
+      nreleased += (nslots + 1) / 2;
+      /* Each hole is exactly one fragment, and is refilled in order. */
+      for (i = 0; i < nslots; i += 2) {
+        uint8_t* be;
+        if (starts[i] != fp_request(p, FRAGMENT_SIZE, FRAGMENT_SIZE, &be)) {
+          fprintf(stderr, "refill mismatch at %u slots\n", nslots);
+          return EXIT_FAILURE;
+        }
+      }
+    }
+    release_ns /= nreleased;
+
+    rounds = BURST_OPS_PER_SIZE / nslots;
+    for (r = 0; r < rounds; ++r) {
+      t0 = now_ns();
+      for (i = 0; i < nslots; ++i) {
+        sink += fp_release(p, starts[i]);
+      }
+      burst_ns += now_ns() - t0 - clock_ns;
+      if (0 != refill_pool(p, nslots, starts)) {
+        fprintf(stderr, "refill mismatch at %u slots\n", nslots);
+        return EXIT_FAILURE;
+      }
+      t0 = now_ns();
+      sink += fp_release_many(p, (const uint8_t* const*)starts, nslots);
+      burst_many_ns += now_ns() - t0 - clock_ns;
+      if (0 != refill_pool(p, nslots, starts)) {
+        fprintf(stderr, "refill mismatch at %u slots\n", nslots);
+        return EXIT_FAILURE;
+      }
+    }
+    burst_ns /= rounds * nslots;
+    burst_many_ns /= rounds * nslots;
+
+    printf("%u\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", nslots, linear_ns, lookup_ns,
+           release_ns, burst_ns, burst_many_ns);
+    if (0 != fp_validate(p)) {
+      fprintf(stderr, "pool invalid after %u slots (%lu)\n", nslots, (unsigned long)sink);
+      return EXIT_FAILURE;
+    }
+    free(p->pool_start);
+    free(p);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/* Measure the cost of locating the best available fragment as the
+ * number of fragment slots in a pool grows.
+ *
+ * For each slot count a pool is filled with allocated fragments of
+ * varying length, and every other one is released so the available
+ * fragments cannot merge.  The search made by fp_request() is then
+ * timed for a request that only the remainder of the pool in the last
+ * slot reaches, so every length is examined: as a loop over the slots
+ * in the benchmark, through the library for a pool without an
+ * available length array, and through the library for the same pool
+ * with one.
+ *
+ * Output is one tab-separated line per slot count.  This requires a
+ * library built with WITH_LENGTH_ARRAY=1. */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <fragpool/fragpool_.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if ! FRAGPOOL_WITH_LENGTH_ARRAY
+#error bench-scan requires FRAGPOOL_WITH_LENGTH_ARRAY
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+
+#define FRAGMENT_UNIT 16
+#define FRAGMENT_UNITS 7
+#define SEARCHES_PER_SIZE 20000000UL
+
+/* The selection made by fp_request() without the array, reading each
+ * slot */
+static fp_fragment_t
+slot_find_best (fp_pool_t p,
+                fp_ssize_t min_size,
+                fp_ssize_t max_size)
+{
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+  fp_fragment_t bf = NULL;
+
+  do {
+    if (min_size <= f->length) {
+      if ((NULL == bf)
+          || ((f->length > bf->length) && (bf->length < max_size))
+          || ((f->length < bf->length) && (f->length >= max_size))) {
+        bf = f;
+      }
+    }
+  } while (++f < fe);
+  return bf;
+}
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+static fp_pool_t
+create_pool (unsigned long nslots)
+{
+  size_t size = nslots * FRAGMENT_UNIT * FRAGMENT_UNITS;
+  fp_pool_t p = calloc(1, sizeof(*p) + nslots * sizeof(*p->fragment));
+  uint8_t* data = malloc(size);
+  fp_ssize_t* lengths = malloc(nslots * sizeof(*lengths));
+  uint8_t** starts = malloc(nslots * sizeof(*starts));
+  unsigned long i;
+
+  if ((NULL == p) || (NULL == data) || (NULL == lengths) || (NULL == starts)) {
+    return NULL;
+  }
+  p->pool_start = data;
+  p->pool_end = data + size;
+  p->pool_alignment = sizeof(int);
+  p->fragment_count = nslots;
+  p->available_length = lengths;
+  fp_reset(p);
+  /* The last slot holds whatever remains */
+  for (i = 0; (i + 1) < nslots; ++i) {
+    fp_size_t len = FRAGMENT_UNIT * (1 + (i * 5) % FRAGMENT_UNITS);
+    uint8_t* be;
+
+    starts[i] = fp_request(p, len, len, &be);
+    if (NULL == starts[i]) {
+      return NULL;
+    }
+  }
+  for (i = 0; (i + 1) < nslots; i += 2) {
+    fp_release(p, starts[i]);
+  }
+  free(starts);
+  return p;
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  static const unsigned long slot_counts[] = { 8, 16, 32, 64, 128, 255, 1024, 4096, 16384 };
+  const int nsizes = sizeof(slot_counts) / sizeof(*slot_counts);
+  const fp_size_t min_size = FRAGMENT_UNIT;
+  const fp_size_t max_size = FRAGMENT_UNIT * (FRAGMENT_UNITS + 1);
+  int si;
+
+  printf("# bench-scan: ns per best-fragment search\n");
+  printf("# slots\tslot_loop\tslots\tlength_array\n");
+  for (si = 0; si < nsizes; ++si) {
+    unsigned long nslots = slot_counts[si];
+    unsigned long rounds = SEARCHES_PER_SIZE / nslots;
+    fp_ssize_t* lengths;
+    fp_fragment_t expect;
+    uintptr_t sink = 0;
+    unsigned long r;
+    double loop_ns;
+    double slots_ns;
+    double array_ns;
+    double t0;
+    fp_pool_t p;
+
+    if ((FP_MAX_COUNT < nslots)
+        || (FP_MAX_FRAGMENT_SIZE < nslots * FRAGMENT_UNIT * FRAGMENT_UNITS)) {
+      break;
+    }
+    p = create_pool(nslots);
+    if (NULL == p) {
+      fprintf(stderr, "unable to create pool with %lu slots\n", nslots);
+      return EXIT_FAILURE;
+    }
+    lengths = p->available_length;
+    expect = slot_find_best(p, min_size, max_size);
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+      sink += (uintptr_t)slot_find_best(p, min_size, max_size + (r & 1));
+    }
+    loop_ns = (now_ns() - t0) / rounds;
+
+    p->available_length = NULL;
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+      sink += (uintptr_t)fp_find_best_fragment(p, min_size, max_size + (r & 1));
+    }
+    slots_ns = (now_ns() - t0) / rounds;
+    p->available_length = lengths;
+
+    t0 = now_ns();
+    for (r = 0; r < rounds; ++r) {
+      sink += (uintptr_t)fp_find_best_fragment(p, min_size, max_size + (r & 1));
+    }
+    array_ns = (now_ns() - t0) / rounds;
+
+    printf("%lu\t%.1f\t%.1f\t%.1f\n", nslots, loop_ns, slots_ns, array_ns);
+    if ((expect != fp_find_best_fragment(p, min_size, max_size))
+        || (0 != fp_validate(p))) {
+      fprintf(stderr, "search mismatch at %lu slots (%lu)\n", nslots, (unsigned long)sink);
+      return EXIT_FAILURE;
+    }
+    free(p->pool_start);
+    free(lengths);
+    free(p);
+  }
+  return EXIT_SUCCESS;
+}
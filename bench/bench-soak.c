@@ -0,0 +1,221 @@
+/* Drive a pool with a long simulated packet stream and report how
+ * fragmentation develops.
+ *
+ * At each step every packet whose lifetime has expired is released,
+ * then one packet is received: a buffer is requested with no upper
+ * bound, as a stream receiver must, and shrunk to the packet length.
+ * Lengths follow the simple IMIX distribution (64, 576, and 1500
+ * octets in proportion 7:4:1) and lifetimes are geometrically
+ * distributed.  One packet in ten is then grown with fp_reallocate(),
+ * as when a header is added for forwarding.
+ *
+ * Every REPORT_INTERVAL steps a tab-separated line gives the state of
+ * the pool and the failure rate over the interval.  The number of
+ * steps may be given as the first argument.  When built with
+ * WITH_TRACE=1 the last TRACE_CAPACITY operations are written to the
+ * file named by the second argument, for use with replay. */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_SIZE 32000
+#define POOL_FRAGMENTS 64
+#define DEFAULT_STEPS 5000000UL
+#define REPORT_INTERVAL 250000UL
+#define MAX_HELD 128
+#define MEAN_LIFETIME 40
+#define MIN_RECEIVE 64
+#define GROWTH 128
+#define TRACE_CAPACITY (1UL << 20)
+
+static uint8_t pool_data[POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} pool_union = {
+  .generic = {
+    .pool_start = pool_data,
+    .pool_end = pool_data + sizeof(pool_data),
+    .pool_alignment = sizeof(int),
+    .fragment_count = POOL_FRAGMENTS
+  }
+};
+static fp_pool_t const pool = &pool_union.generic;
+
+typedef struct packet {
+  uint8_t* bp;
+  unsigned long expires;
+} packet;
+
+#if FRAGPOOL_WITH_TRACE
+/* Write the header and the retained records of the pool trace */
+static int
+write_trace (const char* path)
+{
+  fp_trace_t t = pool->trace;
+  struct fp_trace_header_t h;
+  unsigned long i = fp_trace_header(pool, &h);
+  unsigned long n = h.count;
+  FILE* fp = fopen(path, "wb");
+
+  if (NULL == fp) {
+    return -1;
+  }
+  fwrite(&h, sizeof(h), 1, fp);
+  while (0 < n) {
+    unsigned long chunk = t->capacity - i;
+    if (chunk > n) {
+      chunk = n;
+    }
+    fwrite(t->record + i, sizeof(*t->record), chunk, fp);
+    n -= chunk;
+    i = 0;
+  }
+  return fclose(fp);
+}
+#endif /* FRAGPOOL_WITH_TRACE */
+
+static uint32_t rng_state = 2463534242UL;
+
+static uint32_t
+rng (void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static fp_size_t
+packet_size (void)
+{
+  unsigned int r = rng() % 12;
+  if (7 > r) {
+    return 64;
+  }
+  if (11 > r) {
+    return 576;
+  }
+  return 1500;
+}
+
+static unsigned long
+lifetime (void)
+{
+  unsigned long n = 1;
+  while (0 != (rng() % MEAN_LIFETIME)) {
+    ++n;
+  }
+  return n;
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  packet held[MAX_HELD];
+  unsigned int nheld = 0;
+  unsigned long steps = DEFAULT_STEPS;
+  unsigned long step;
+  unsigned long requests = 0;
+  unsigned long failures = 0;
+  unsigned long moves = 0;
+  unsigned long bytes_copied = 0;
+
+  if (1 < argc) {
+    steps = strtoul(argv[1], NULL, 0);
+  }
+#if FRAGPOOL_WITH_TRACE
+  if (2 < argc) {
+    static struct fp_trace_t trace;
+
+    trace.record = malloc(TRACE_CAPACITY * sizeof(*trace.record));
+    trace.capacity = TRACE_CAPACITY;
+    if (NULL == trace.record) {
+      fprintf(stderr, "unable to allocate trace\n");
+      return EXIT_FAILURE;
+    }
+    pool->trace = &trace;
+  }
+#endif /* FRAGPOOL_WITH_TRACE */
+  fp_reset(pool);
+  printf("# bench-soak: %u octets, %u slots, mean lifetime %u steps\n",
+         POOL_SIZE, POOL_FRAGMENTS, MEAN_LIFETIME);
+  printf("# step\tfailure_rate\tlargest_available\tavailable_bytes\tfragmentation\tactive_slots\tmoves\tbytes_copied\n");
+  for (step = 1; step <= steps; ++step) {
+    unsigned int i = 0;
+    fp_size_t len;
+    uint8_t* bp;
+    uint8_t* be;
+
+    while (i < nheld) {
+      if (held[i].expires <= step) {
+        fp_release(pool, held[i].bp);
+        held[i] = held[--nheld];
+      } else {
+        ++i;
+      }
+    }
+
+    ++requests;
+    bp = NULL;
+    if (nheld < MAX_HELD) {
+      bp = fp_request(pool, MIN_RECEIVE, FP_MAX_FRAGMENT_SIZE, &be);
+    }
+    len = packet_size();
+    if ((NULL != bp) && ((be - bp) < len)) {
+      /* Received more than the fragment could hold */
+      fp_release(pool, bp);
+      bp = NULL;
+    }
+    if (NULL == bp) {
+      ++failures;
+    } else {
+      fp_resize(pool, bp, len, &be);
+      if (0 == (rng() % 10)) {
+        uint8_t* nbp = fp_reallocate(pool, bp, len, len + GROWTH, &be);
+        if ((NULL != nbp) && (nbp != bp)) {
+          ++moves;
+          bytes_copied += len;
+        }
+        if (NULL != nbp) {
+          bp = nbp;
+        }
+      }
+      held[nheld].bp = bp;
+      held[nheld].expires = step + lifetime();
+      ++nheld;
+    }
+
+    if (0 == (step % REPORT_INTERVAL)) {
+      struct fp_stats_t st;
+
+      fp_stats(pool, &st);
+      printf("%lu\t%.5f\t%u\t%u\t%u\t%u\t%lu\t%lu\n", step,
+             (double)failures / requests,
+             (unsigned int)st.largest_available,
+             (unsigned int)st.available_bytes,
+             st.fragmentation,
+             (unsigned int)(st.allocated_slots + st.available_slots),
+             moves, bytes_copied);
+      requests = failures = 0;
+    }
+  }
+  if (0 != fp_validate(pool)) {
+    fprintf(stderr, "pool invalid after %lu steps\n", steps);
+    return EXIT_FAILURE;
+  }
+#if FRAGPOOL_WITH_TRACE
+  if ((NULL != pool->trace) && (0 != write_trace(argv[2]))) {
+    perror(argv[2]);
+    return EXIT_FAILURE;
+  }
+#endif /* FRAGPOOL_WITH_TRACE */
+  return EXIT_SUCCESS;
+}
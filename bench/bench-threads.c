@@ -0,0 +1,208 @@
+/* Measure throughput of a pool shared by several threads.
+ *
+ * Each thread repeatedly receives a packet into a fragment, grows it
+ * with fp_reallocate() (which normally moves and copies the data),
+ * and releases it, holding a few packets at a time.  Three ways of
+ * protecting the pool are compared:
+ *
+ * caller: the pool has no lock hooks and every call is wrapped in a
+ * global mutex, so the lock is held while fp_reallocate() copies;
+ *
+ * mutex: the pool lock hooks use a pthread mutex;
+ *
+ * spin: the pool lock hooks use a spinlock.
+ *
+ * Output is one tab-separated line per mode and thread count.  This
+ * requires a library built with WITH_LOCK=1. */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if ! FRAGPOOL_WITH_LOCK
+#error bench-threads requires FRAGPOOL_WITH_LOCK
+#endif /* FRAGPOOL_WITH_LOCK */
+
+#define POOL_SIZE 32000
+#define POOL_FRAGMENTS 64
+#define HELD_PER_THREAD 2
+#define RECEIVE_SIZE 512
+#define GROWN_SIZE 1536
+#define ITERATIONS 200000UL
+#define MAX_THREADS 8
+
+enum {
+  MODE_CALLER,
+  MODE_MUTEX,
+  MODE_SPIN,
+};
+
+static const char* const mode_name[] = { "caller", "mutex", "spin" };
+
+static uint8_t pool_data[POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} pool_union = {
+  .generic = {
+    .pool_start = pool_data,
+    .pool_end = pool_data + sizeof(pool_data),
+    .pool_alignment = sizeof(int),
+    .fragment_count = POOL_FRAGMENTS
+  }
+};
+static fp_pool_t const pool = &pool_union.generic;
+
+static pthread_mutex_t caller_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int pool_spin;
+static int mode;
+
+static void
+mutex_lock (void* context)
+{
+  pthread_mutex_lock(context);
+}
+
+static void
+mutex_unlock (void* context)
+{
+  pthread_mutex_unlock(context);
+}
+
+static void
+spin_lock (void* context)
+{
+  int* lp = context;
+  while (__atomic_exchange_n(lp, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(lp, __ATOMIC_RELAXED)) {
+      ;
+    }
+  }
+}
+
+static void
+spin_unlock (void* context)
+{
+  __atomic_store_n((int*)context, 0, __ATOMIC_RELEASE);
+}
+
+static const struct fp_lock_t mutex_hooks = { mutex_lock, mutex_unlock, &pool_mutex };
+static const struct fp_lock_t spin_hooks = { spin_lock, spin_unlock, &pool_spin };
+
+#define CALLER_LOCK() do {                      \
+    if (MODE_CALLER == mode) {                  \
+      pthread_mutex_lock(&caller_mutex);        \
+    }                                           \
+  } while (0)
+
+#define CALLER_UNLOCK() do {                    \
+    if (MODE_CALLER == mode) {                  \
+      pthread_mutex_unlock(&caller_mutex);      \
+    }                                           \
+  } while (0)
+
+static void*
+worker (void* arg)
+{
+  unsigned long* failures = arg;
+  uint8_t* held[HELD_PER_THREAD] = { NULL };
+  unsigned long i;
+
+  for (i = 0; i < ITERATIONS; ++i) {
+    unsigned int hi = i % HELD_PER_THREAD;
+    uint8_t* b;
+    uint8_t* be;
+
+    if (NULL != held[hi]) {
+      CALLER_LOCK();
+      fp_release(pool, held[hi]);
+      CALLER_UNLOCK();
+      held[hi] = NULL;
+    }
+    CALLER_LOCK();
+    b = fp_request(pool, RECEIVE_SIZE, RECEIVE_SIZE, &be);
+    CALLER_UNLOCK();
+    if (NULL == b) {
+      ++*failures;
+      continue;
+    }
+    memset(b, (int)i, be - b);
+    CALLER_LOCK();
+    be = NULL;
+    held[hi] = fp_reallocate(pool, b, RECEIVE_SIZE, GROWN_SIZE, &be);
+    CALLER_UNLOCK();
+    if (NULL == held[hi]) {
+      ++*failures;
+      held[hi] = b;
+    }
+  }
+  for (i = 0; i < HELD_PER_THREAD; ++i) {
+    if (NULL != held[i]) {
+      CALLER_LOCK();
+      fp_release(pool, held[i]);
+      CALLER_UNLOCK();
+    }
+  }
+  return NULL;
+}
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  pthread_t threads[MAX_THREADS];
+  unsigned long failures[MAX_THREADS];
+
+  printf("# bench-threads: ns per packet (request, reallocate, release)\n");
+  printf("# mode\tthreads\tns_per_packet\tfailures\n");
+  for (mode = MODE_CALLER; mode <= MODE_SPIN; ++mode) {
+    unsigned int nthreads;
+
+    pool->lock = NULL;
+    if (MODE_MUTEX == mode) {
+      pool->lock = &mutex_hooks;
+    } else if (MODE_SPIN == mode) {
+      pool->lock = &spin_hooks;
+    }
+    for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+      unsigned long total_failures = 0;
+      unsigned int ti;
+      double t0;
+
+      fp_reset(pool);
+      t0 = now_ns();
+      for (ti = 0; ti < nthreads; ++ti) {
+        failures[ti] = 0;
+        pthread_create(threads + ti, NULL, worker, failures + ti);
+      }
+      for (ti = 0; ti < nthreads; ++ti) {
+        pthread_join(threads[ti], NULL);
+        total_failures += failures[ti];
+      }
+      printf("%s\t%u\t%.1f\t%lu\n", mode_name[mode], nthreads,
+             (now_ns() - t0) / (nthreads * ITERATIONS), total_failures);
+      if (0 != fp_validate(pool)) {
+        fprintf(stderr, "pool invalid after %s with %u threads\n",
+                mode_name[mode], nthreads);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/* Replay a recorded pool trace against a fresh pool.
+ *
+ * The input is a trace file as written by bench-soak: a
+ * fp_trace_header_t followed by its records, oldest first.  A pool
+ * of the recorded size, slot count, and alignment is created with the
+ * same misalignment of its start, and each operation is applied to
+ * it in turn.  Where the fragment returned or the status differs from
+ * what was recorded the replay has diverged; the first divergence is
+ * described, and replay continues with the remaining operations.
+ * Compaction is replayed with no fragments pinned, so a trace in
+ * which the recorder pinned fragments during compaction may diverge.
+ *
+ * Output is the time per operation by type, then a summary line.
+ * The library must be built with the same FRAGPOOL_SIZE_BITS as the
+ * one that recorded the trace. */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char* const op_name[] = {
+  NULL, "reset", "request", "resize", "reallocate", "release", "compact", "split"
+};
+#define NUM_OPS (sizeof(op_name) / sizeof(*op_name))
+
+static double
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+static fp_pool_t
+create_pool (fp_trace_header_t hp)
+{
+  fp_pool_t p = calloc(1, sizeof(*p) + hp->fragment_count * sizeof(*p->fragment));
+  uint8_t* data = malloc(hp->pool_size + 2 * hp->alignment);
+  uintptr_t start;
+
+  if ((NULL == p) || (NULL == data)) {
+    return NULL;
+  }
+  start = ((uintptr_t)data + hp->alignment - 1) & ~(uintptr_t)(hp->alignment - 1);
+  p->pool_start = (uint8_t*)(start + hp->start_phase);
+  p->pool_end = p->pool_start + hp->pool_size;
+  p->pool_alignment = hp->alignment;
+  p->fragment_count = hp->fragment_count;
+  return p;
+}
+
+/* Convert a recorded offset into an address in the pool */
+static uint8_t*
+offset_address (fp_pool_t p,
+                fp_size_t offset)
+{
+  return (FP_TRACE_NO_OFFSET == offset) ? NULL : p->pool_start + offset;
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  struct fp_trace_header_t h;
+  fp_trace_record_t records;
+  fp_pool_t p;
+  FILE* fp;
+  double op_ns[NUM_OPS] = { 0 };
+  unsigned long op_count[NUM_OPS] = { 0 };
+  unsigned long divergences = 0;
+  unsigned long first = 0;
+  fp_size_t first_result = 0;
+  fp_size_t first_length = 0;
+  unsigned long i;
+
+  if (2 != argc) {
+    fprintf(stderr, "usage: %s trace-file\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  fp = fopen(argv[1], "rb");
+  if (NULL == fp) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (1 != fread(&h, sizeof(h), 1, fp)) {
+    fprintf(stderr, "%s: missing trace header\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (FP_TRACE_MAGIC != h.magic) {
+    fprintf(stderr, "%s: not a trace file\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (FRAGPOOL_SIZE_BITS != h.size_bits) {
+    fprintf(stderr, "%s: recorded with SIZE_BITS=%u, replay built with %u\n",
+            argv[1], h.size_bits, FRAGPOOL_SIZE_BITS);
+    return EXIT_FAILURE;
+  }
+  records = malloc(h.count * sizeof(*records));
+  if ((NULL == records) || (h.count != fread(records, sizeof(*records), h.count, fp))) {
+    fprintf(stderr, "%s: unable to read %lu records\n", argv[1], (unsigned long)h.count);
+    return EXIT_FAILURE;
+  }
+  fclose(fp);
+  if (h.wrapped) {
+    fprintf(stderr, "%s: trace wrapped, replay from an empty pool will diverge\n", argv[1]);
+  }
+  p = create_pool(&h);
+  if (NULL == p) {
+    fprintf(stderr, "unable to create pool of %lu octets\n", (unsigned long)h.pool_size);
+    return EXIT_FAILURE;
+  }
+  fp_reset(p);
+
+  for (i = 0; i < h.count; ++i) {
+    const fp_trace_record_t r = records + i;
+    uint8_t* bp = offset_address(p, r->offset);
+    uint8_t* rp = NULL;
+    uint8_t* be = NULL;
+    int status = 0;
+    unsigned long moved = 0;
+    double t0;
+
+    t0 = now_ns();
+    switch (r->op) {
+      case FP_TRACE_RESET:
+        fp_reset(p);
+        break;
+      case FP_TRACE_REQUEST:
+        rp = fp_request(p, r->min_size, r->max_size, &be);
+        break;
+      case FP_TRACE_RESIZE:
+        rp = fp_resize(p, bp, r->min_size, &be);
+        break;
+      case FP_TRACE_REALLOCATE:
+        rp = fp_reallocate(p, bp, r->min_size, r->max_size, &be);
+        break;
+      case FP_TRACE_RELEASE:
+        status = fp_release(p, bp);
+        break;
+      case FP_TRACE_SPLIT:
+        rp = fp_split(p, bp, r->min_size, &be);
+        break;
+      case FP_TRACE_COMPACT:
+        moved = (FP_TRACE_NO_OFFSET == r->max_size)
+          ? fp_compact(p, NULL) : fp_compact_step(p, NULL, r->max_size);
+        break;
+      default:
+        status = -1;
+        break;
+    }
+    if ((0 < r->op) && (NUM_OPS > r->op)) {
+      op_ns[r->op] += now_ns() - t0;
+      ++op_count[r->op];
+    }
+    if (FP_TRACE_RELEASE == r->op) {
+      /* The released length is not returned, only the status */
+      rp = offset_address(p, r->result);
+      be = rp + r->length;
+    } else if ((FP_TRACE_COMPACT == r->op) && (moved != r->length)) {
+      status = -1;
+    }
+    if ((status != r->status)
+        || (rp != offset_address(p, r->result))
+        || ((NULL != rp) && ((fp_size_t)(be - rp) != r->length))) {
+      if (0 == divergences++) {
+        first = i;
+        first_result = (NULL != rp) ? (fp_size_t)(rp - p->pool_start) : FP_TRACE_NO_OFFSET;
+        first_length = (NULL != rp) ? (fp_size_t)(be - rp) : (fp_size_t)moved;
+      }
+    }
+  }
+
+  printf("# replay: %s, %lu octets, %lu slots, alignment %u\n", argv[1],
+         (unsigned long)h.pool_size, (unsigned long)h.fragment_count, h.alignment);
+  printf("# op\tcount\tns_per_op\n");
+  for (i = 1; i < NUM_OPS; ++i) {
+    if (0 < op_count[i]) {
+      printf("%s\t%lu\t%.1f\n", op_name[i], op_count[i], op_ns[i] / op_count[i]);
+    }
+  }
+  printf("# %lu operations, %lu divergences\n", (unsigned long)h.count, divergences);
+  if (0 < divergences) {
+    const fp_trace_record_t r = records + first;
+    printf("# first divergence at %lu: op %u offset %ld min %lu max %lu: "
+           "recorded status %u result %ld length %lu, replayed result %ld length %lu\n",
+           first, r->op, (long)(fp_ssize_t)r->offset,
+           (unsigned long)r->min_size, (unsigned long)r->max_size, r->status,
+           (long)(fp_ssize_t)r->result, (unsigned long)r->length,
+           (long)(fp_ssize_t)first_result, (unsigned long)first_length);
+  }
+  if (0 != fp_validate(p)) {
+    fprintf(stderr, "pool invalid after replay\n");
+    return EXIT_FAILURE;
+  }
+  return (0 == divergences) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
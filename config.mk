@@ -0,0 +1,48 @@
+# Build-time configuration options.  These affect the layout of pool
+# structures, so the library and everything that defines a pool must
+# be compiled with the same settings.  This file is included by the
+# top-level Makefile and by those in subdirectories.
+
+ifdef WITH_SIZE_INDEX
+CPPFLAGS += -DFRAGPOOL_WITH_SIZE_INDEX=$(WITH_SIZE_INDEX)
+endif # WITH_SIZE_INDEX
+
+ifdef WITH_LENGTH_ARRAY
+CPPFLAGS += -DFRAGPOOL_WITH_LENGTH_ARRAY=$(WITH_LENGTH_ARRAY)
+endif # WITH_LENGTH_ARRAY
+
+ifdef WITH_COMPACT_SLOTS
+CPPFLAGS += -DFRAGPOOL_WITH_COMPACT_SLOTS=$(WITH_COMPACT_SLOTS)
+endif # WITH_COMPACT_SLOTS
+
+ifdef SIZE_BITS
+CPPFLAGS += -DFRAGPOOL_SIZE_BITS=$(SIZE_BITS)
+endif # SIZE_BITS
+
+ifdef COUNT_BITS
+CPPFLAGS += -DFRAGPOOL_COUNT_BITS=$(COUNT_BITS)
+endif # COUNT_BITS
+
+ifdef WITH_LOCK
+CPPFLAGS += -DFRAGPOOL_WITH_LOCK=$(WITH_LOCK)
+endif # WITH_LOCK
+
+ifdef WITH_NOTIFY
+CPPFLAGS += -DFRAGPOOL_WITH_NOTIFY=$(WITH_NOTIFY)
+endif # WITH_NOTIFY
+
+ifdef WITH_STATS
+CPPFLAGS += -DFRAGPOOL_WITH_STATS=$(WITH_STATS)
+endif # WITH_STATS
+
+ifdef WITH_SDT
+CPPFLAGS += -DFRAGPOOL_WITH_SDT=$(WITH_SDT)
+endif # WITH_SDT
+
+ifdef WITH_TRACE
+CPPFLAGS += -DFRAGPOOL_WITH_TRACE=$(WITH_TRACE)
+endif # WITH_TRACE
+
+ifdef WITH_HANDLES
+CPPFLAGS += -DFRAGPOOL_WITH_HANDLES=$(WITH_HANDLES)
+endif # WITH_HANDLES
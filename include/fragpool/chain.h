@@ -0,0 +1,192 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FRAGPOOL_CHAIN_H_
+#define FRAGPOOL_CHAIN_H_
+
+/** @file
+ *
+ * @brief Header providing interface for chains of pool fragments.
+ *
+ * A chain holds data that is stored in several fragments, so a packet
+ * can be received even when no single available fragment is long
+ * enough, and a stream receiver can continue into a new link instead
+ * of using fp_reallocate() to copy what it already has.
+ *
+ * The caller provides the array that describes the links.  The data
+ * of the chain fills the links in order: each link but the last that
+ * holds data is full.  A chain may be walked with fp_chain_segment():
+ @verbatim
+ unsigned long off = 0;
+ while (off < chain->length) {
+   fp_size_t n;
+   const uint8_t* sp = fp_chain_segment(chain, off, &n);
+   consume(sp, n);
+   off += n;
+ }
+ @endverbatim
+ *
+ * @homepage http://github.com/pabigot/fragpool
+ * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
+ */
+
+#include <fragpool/fragpool.h>
+
+/** One fragment of a chain. */
+typedef struct fp_link_t {
+  /** The start of the fragment. */
+  uint8_t* start;
+
+  /** The end of the fragment. */
+  uint8_t* end;
+} *fp_link_t;
+
+/** A sequence of fragments from one pool holding a single unit of
+ * data. */
+typedef struct fp_chain_t {
+  /** Storage for the links, provided by the caller. */
+  struct fp_link_t* link;
+
+  /** The number of elements in @c link. */
+  unsigned int capacity;
+
+  /** The number of links that hold fragments. */
+  unsigned int count;
+
+  /** The number of octets of data in the chain, which the caller
+   * updates as it stores data. */
+  unsigned long length;
+} *fp_chain_t;
+
+/** Initialize an empty chain.
+ *
+ * @param chain the chain to be initialized
+ *
+ * @param links storage for the links of the chain
+ *
+ * @param capacity the number of elements in @p links */
+void fp_chain_init (fp_chain_t chain,
+                    struct fp_link_t* links,
+                    unsigned int capacity);
+
+/** Determine the total octets in the fragments of a chain.
+ *
+ * @param chain the chain to be inspected
+ *
+ * @return the sum of the lengths of the links */
+unsigned long fp_chain_space (const struct fp_chain_t* chain);
+
+/** Append one fragment to a chain.
+ *
+ * This is fp_request() placing the result in a new link.  A stream
+ * receiver that has filled the chain passes #FP_MAX_FRAGMENT_SIZE as
+ * @p max_size to obtain the longest fragment available.
+ *
+ * @param pool the pool from which memory is obtained
+ *
+ * @param chain the chain to be extended
+ *
+ * @param min_size as with fp_request()
+ *
+ * @param max_size as with fp_request()
+ *
+ * @return the new link, or a null pointer if the chain has no unused
+ * links or the pool cannot satisfy the request. */
+fp_link_t fp_chain_append (fp_pool_t pool,
+                           fp_chain_t chain,
+                           fp_size_t min_size,
+                           fp_size_t max_size);
+
+/** Extend a chain until it can hold a given amount of data.
+ *
+ * Fragments are added as by fp_chain_append(), each requesting what
+ * is still lacking so that a long enough fragment is used if there is
+ * one.  Fragments shorter than @p link_min_size are not used, so a
+ * chain is not made from many small pieces.
+ *
+ * @param pool the pool from which memory is obtained
+ *
+ * @param chain the chain to be extended
+ *
+ * @param size the number of octets the chain must be able to hold
+ *
+ * @param link_min_size the minimum length of each added fragment,
+ * unless less than that is needed
+ *
+ * @return zero on success; #FP_EINVAL if @p link_min_size is zero;
+ * #FP_ENOMEM if the space cannot be obtained using the unused links,
+ * in which case no fragments are added. */
+int fp_chain_request (fp_pool_t pool,
+                      fp_chain_t chain,
+                      unsigned long size,
+                      fp_size_t link_min_size);
+
+/** Locate data within a chain.
+ *
+ * @param chain the chain holding the data
+ *
+ * @param offset the offset of an octet within the data of the chain
+ *
+ * @param lengthp where to store the number of octets of data that
+ * are contiguous starting at @p offset
+ *
+ * @return the address of the octet at @p offset, or a null pointer if
+ * @p offset is not less than the length of the chain. */
+uint8_t* fp_chain_segment (const struct fp_chain_t* chain,
+                           unsigned long offset,
+                           fp_size_t* lengthp);
+
+/** Return the space that the data of a chain does not use.
+ *
+ * Links that hold no data are released, and the last link that does
+ * is resized to fit the data.
+ *
+ * @param pool the pool from which the chain was allocated
+ *
+ * @param chain the chain to be trimmed
+ *
+ * @return zero, or an error code if a fragment could not be released
+ * or resized */
+int fp_chain_trim (fp_pool_t pool,
+                   fp_chain_t chain);
+
+/** Release all fragments of a chain, leaving it empty.
+ *
+ * @param pool the pool from which the chain was allocated
+ *
+ * @param chain the chain to be released
+ *
+ * @return zero if all fragments are released, or an error code if
+ * any of them is invalid. */
+int fp_chain_release (fp_pool_t pool,
+                      fp_chain_t chain);
+
+#endif /* FRAGPOOL_CHAIN_H_ */
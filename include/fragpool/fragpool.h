@@ -60,13 +60,29 @@
  * <fragpool/fragpool.h>:
  *
  * @li fp_request() allocates a buffer given the minimum acceptable
- * and maximum expected final sizes;
+ * and maximum expected final sizes, and fp_request_many() allocates
+ * a set of buffers or none of them;
  *
  * @li fp_resize() and fp_reallocate() decrease or increase the size
  * of the reserved space, preserving initial content; they differ in
  * that fp_resize() is not permitted to move the buffer;
  *
- * @li fp_release() is ultimately invoked to return the buffer;
+ * @li fp_split() divides an allocated buffer in two without copying,
+ * so data received past the end of one packet starts the next;
+ *
+ * @li fp_release() is ultimately invoked to return the buffer, and
+ * fp_release_many() returns several at once;
+ *
+ * @li with #FRAGPOOL_WITH_HANDLES, fp_request_handle() also returns a
+ * #fp_handle_t through which the buffer can be resized, reallocated
+ * and released without searching the pool;
+ *
+ * @li fp_compact() moves allocated buffers together to consolidate
+ * the available space, and fp_compact_step() does so incrementally;
+ *
+ * @li fp_largest_available() reports the longest fragment that could
+ * be allocated, and fp_stats() describes the state and usage of the
+ * pool;
  *
  * @li fp_reset() clears the pool and fp_validate() checks it for
  * consistency.
@@ -79,7 +95,11 @@
  *
  * @note All fragpool routines are non-blocking and are intended to be
  * callable from hard interrupt context.  Protection against
- * re-entrancy must be supplied by the caller.
+ * re-entrancy must be supplied by the caller, unless the library is
+ * built with #FRAGPOOL_WITH_LOCK and the pool is given lock hooks.
+ * Callers that would rather wait for space than fail may use
+ * #FRAGPOOL_WITH_NOTIFY; on Linux <fragpool/linux.h> provides an
+ * eventfd that becomes readable when space is returned.
  *
  * @homepage http://github.com/pabigot/fragpool
  * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
@@ -90,6 +110,29 @@
 /** A integral monotonically increasing version number */
 #define FP_VERSION 20170302
 
+#ifndef FRAGPOOL_SIZE_BITS
+/** The width, in bits, of fragment sizes: 16 or 32.
+ *
+ * The default of 16 limits fragments to 32767 octets, which is
+ * appropriate for the memory constrained devices fragpool was
+ * designed for.  Hosts that need larger pools may select 32.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_SIZE_BITS 16
+#endif /* FRAGPOOL_SIZE_BITS */
+
+#ifndef FRAGPOOL_COUNT_BITS
+/** The width, in bits, of the fragment count of a pool: 8, 16, or 32.
+ *
+ * The default of 8 limits pools to 255 fragments.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_COUNT_BITS 8
+#endif /* FRAGPOOL_COUNT_BITS */
+
+#if (16 == FRAGPOOL_SIZE_BITS) || defined(FP_DOXYGEN)
 /** Type used to represent a fragment size in API calls.
  *
  * @note Due to sign tricks used internally, the effective maximum
@@ -104,10 +147,463 @@ typedef int16_t fp_ssize_t;
  * value. */
 #define FP_MAX_FRAGMENT_SIZE INT16_MAX
 
+/** Type used to represent the alignment of a pool. */
+typedef uint8_t fp_alignment_t;
+#elif 32 == FRAGPOOL_SIZE_BITS
+typedef uint32_t fp_size_t;
+typedef int32_t fp_ssize_t;
+#define FP_MAX_FRAGMENT_SIZE INT32_MAX
+typedef uint16_t fp_alignment_t;
+#else
+#error FRAGPOOL_SIZE_BITS must be 16 or 32
+#endif /* FRAGPOOL_SIZE_BITS */
+
+#if (8 == FRAGPOOL_COUNT_BITS) || defined(FP_DOXYGEN)
+/** Type used to represent a number of fragments, or the index of a
+ * fragment slot within a pool. */
+typedef uint8_t fp_count_t;
+
+/** The maximum value of #fp_count_t. */
+#define FP_MAX_COUNT UINT8_MAX
+#elif 16 == FRAGPOOL_COUNT_BITS
+typedef uint16_t fp_count_t;
+#define FP_MAX_COUNT UINT16_MAX
+#elif 32 == FRAGPOOL_COUNT_BITS
+typedef uint32_t fp_count_t;
+#define FP_MAX_COUNT UINT32_MAX
+#else
+#error FRAGPOOL_COUNT_BITS must be 8, 16, or 32
+#endif /* FRAGPOOL_COUNT_BITS */
+
 /** The (positive) value of the error code returned when a fragpool
  * function is invoked with unacceptable parameters. */
 #define FP_EINVAL 1
 
+/** The (positive) value of the error code returned when a fragpool
+ * function cannot obtain the memory it needs from the pool. */
+#define FP_ENOMEM 2
+
+#ifndef FRAGPOOL_WITH_SIZE_INDEX
+/** Nonzero to maintain a segregated size-class index of the available
+ * fragments in each pool.
+ *
+ * Without the index fp_request() and fp_reallocate() examine every
+ * slot of the pool to locate the best available fragment.  With the
+ * index the available fragments are also kept on per-class lists,
+ * where class @em c holds fragments with lengths in [2<sup>c</sup>,
+ * 2<sup>c+1</sup>), and a bitmap records which classes are non-empty.
+ * The best fragment is then located by examining only the lists for
+ * the classes that can hold it, which is normally one.  The
+ * selection is identical to the one made without the index.
+ *
+ * The lists are not ordered, so each list examined is walked in
+ * full: the search skips allocated slots and classes that cannot
+ * hold the request, but takes time proportional to the number of
+ * available fragments in the classes it examines.  In the worst
+ * case, when most available fragments share one class as they do
+ * in workloads of similarly sized packets, this is proportional to
+ * the number of available fragments, as without the index.
+ *
+ * The index adds two #fp_count_t links to each fragment slot, and a
+ * class map and #FP_SIZE_CLASS_COUNT list heads to each pool.
+ * Operations that shift the fragment array already take time
+ * proportional to the number of slots, and rebuild the index from
+ * scratch.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_SIZE_INDEX 0
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#if (FRAGPOOL_WITH_SIZE_INDEX) || defined(FP_DOXYGEN)
+/** The number of size classes in a pool size index.  Class @em c
+ * holds available fragments with lengths in [2<sup>c</sup>,
+ * 2<sup>c+1</sup>). */
+#define FP_SIZE_CLASS_COUNT (FRAGPOOL_SIZE_BITS - 1)
+
+#if (16 == FRAGPOOL_SIZE_BITS) || defined(FP_DOXYGEN)
+/** Type used to record the non-empty classes of a size index.  Bit
+ * @em c is set if class @em c has at least one fragment. */
+typedef uint16_t fp_size_class_map_t;
+#else /* FRAGPOOL_SIZE_BITS */
+typedef uint32_t fp_size_class_map_t;
+#endif /* FRAGPOOL_SIZE_BITS */
+
+/** Value stored in a size index link to indicate there is no
+ * fragment. */
+#define FP_NO_SLOT FP_MAX_COUNT
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#ifndef FRAGPOOL_WITH_LENGTH_ARRAY
+/** Nonzero to allow pools to keep the lengths of their available
+ * fragments in a dense array.
+ *
+ * Each pool then has an @c available_length field which, if not null,
+ * references an array of @c fragment_count #fp_ssize_t values.  The
+ * array must be assigned before the pool is first reset, and must not
+ * be changed afterwards.  Each entry holds the length of the
+ * corresponding slot if that fragment is available, and zero
+ * otherwise.
+ *
+ * Without the array fp_request() and fp_reallocate() read every
+ * fragment slot, which occupies at least 16 octets on 64-bit hosts,
+ * to examine its length.  With it they read only the array.  When compiled for a
+ * target that supports SSE2 or AVX2 many entries are examined with
+ * each instruction.  The selection is identical to the one made
+ * without the array.
+ *
+ * This is an alternative to #FRAGPOOL_WITH_SIZE_INDEX, and suits
+ * pools with at most a few thousand slots, for which a dense scan is
+ * competitive with maintaining size-class lists.  It adds only a
+ * pointer to pools that do not use it.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_LENGTH_ARRAY 0
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+
+#if (FRAGPOOL_WITH_LENGTH_ARRAY) && (FRAGPOOL_WITH_SIZE_INDEX)
+#error FRAGPOOL_WITH_LENGTH_ARRAY and FRAGPOOL_WITH_SIZE_INDEX are alternatives
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+
+#ifndef FRAGPOOL_WITH_LOCK
+/** Nonzero to build a thread-safe library.
+ *
+ * Each pool then has a @c lock field which, if not null, references
+ * the hooks used to serialize access to the pool.  The hooks may
+ * implement a spinlock, a mutex, or on embedded systems simply
+ * disable and restore interrupts.  All public functions that inspect
+ * or modify a pool hold the lock for the duration of the operation,
+ * except that fp_reallocate() releases it while moving data between
+ * fragments.  The pool records each such copy, and fp_compact()
+ * leaves both fragments involved where they are until it completes.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_LOCK 0
+#endif /* FRAGPOOL_WITH_LOCK */
+
+#if (FRAGPOOL_WITH_LOCK) || defined(FP_DOXYGEN)
+/** Hooks used to serialize access to a pool.
+ *
+ * The hooks are not required to support recursive locking, and are
+ * never invoked recursively by the library. */
+typedef struct fp_lock_t {
+  /** Acquire exclusive access to the pool.  This must not fail. */
+  void (* lock) (void* context);
+
+  /** Release exclusive access to the pool. */
+  void (* unlock) (void* context);
+
+  /** Arbitrary data passed to the hooks, such as the address of a
+   * mutex. */
+  void* context;
+
+  /** Nonzero if other processes use the pool through their own pool
+   * structures, as with fp_shared_attach().  Compaction can neither
+   * see their copies in progress nor tell them that fragments have
+   * moved, so fp_compact() and fp_compact_step() move nothing. */
+  int shared;
+} *fp_lock_t;
+
+/** A copy between fragments that fp_reallocate() is making with the
+ * pool unlocked.  Copies in progress are linked from the pool so
+ * compaction does not move either fragment. */
+struct fp_copy_t {
+  /** The start of the fragment being copied from */
+  const uint8_t* src;
+
+  /** The start of the fragment being copied into */
+  const uint8_t* dst;
+
+  /** The next copy in progress, or a null pointer */
+  struct fp_copy_t* next;
+};
+#endif /* FRAGPOOL_WITH_LOCK */
+
+#ifndef FRAGPOOL_WITH_NOTIFY
+/** Nonzero to support notification when space becomes available.
+ *
+ * Each pool then has a @c notify field which, if not null, references
+ * a hook that is invoked whenever fp_release(), fp_resize(),
+ * fp_reallocate(), or fp_reset() returns memory to the pool in a way
+ * that increases the length of the longest available fragment.  A
+ * consumer that could not obtain a fragment can wait for the hook
+ * rather than repeatedly retrying fp_request().
+ *
+ * While a hook is registered these operations determine the longest
+ * available fragment before and after they modify the pool.  This is
+ * inexpensive with #FRAGPOOL_WITH_SIZE_INDEX, and otherwise requires
+ * two scans of the slots.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_NOTIFY 0
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+#if (FRAGPOOL_WITH_NOTIFY) || defined(FP_DOXYGEN)
+struct fp_pool_t;
+
+/** Hook used to announce that more space is available in a pool. */
+typedef struct fp_notify_t {
+  /** Invoked after an operation increases the length of the longest
+   * available fragment in @p pool to @p length octets.
+   *
+   * The hook is invoked in the context of the operation that returned
+   * the memory, which may be an interrupt handler, after the pool
+   * lock has been released.  It may call fragpool functions.  By the
+   * time it runs another caller may already have consumed the
+   * space. */
+  void (* available) (struct fp_pool_t* pool,
+                      fp_size_t length,
+                      void* context);
+
+  /** Arbitrary data passed to the hook, such as the address of a
+   * semaphore. */
+  void* context;
+} *fp_notify_t;
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+#ifndef FRAGPOOL_WITH_STATS
+/** Nonzero to maintain usage counters and high-water marks in each
+ * pool, which are reported by fp_stats().
+ *
+ * Without the counters fp_stats() reports only the current state of
+ * the pool, and no operation does any additional work.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_STATS 0
+#endif /* FRAGPOOL_WITH_STATS */
+
+/** Usage counters maintained in a pool with #FRAGPOOL_WITH_STATS.
+ *
+ * All are cleared by fp_reset().  The event counters wrap on
+ * overflow. */
+typedef struct fp_counters_t {
+  /** The number of octets currently allocated. */
+  fp_size_t allocated_bytes;
+
+  /** The maximum value of allocated_bytes. */
+  fp_size_t max_allocated_bytes;
+
+  /** The maximum number of active fragment slots. */
+  fp_count_t max_active_slots;
+
+  /** The number of fragments requested. */
+  unsigned long requests;
+
+  /** The number of requests and reallocations that could not be
+   * satisfied. */
+  unsigned long failures;
+
+  /** The number of calls to fp_resize(). */
+  unsigned long resizes;
+
+  /** The number of calls to fp_reallocate(). */
+  unsigned long reallocations;
+
+  /** The number of reallocations that moved data. */
+  unsigned long moves;
+
+  /** The number of octets copied by reallocations that moved data. */
+  unsigned long bytes_copied;
+
+  /** The number of octets moved by fp_compact() and
+   * fp_compact_step(). */
+  unsigned long bytes_compacted;
+} *fp_counters_t;
+
+#ifndef FRAGPOOL_WITH_SDT
+/** Nonzero to place static tracepoints in the library.
+ *
+ * This requires <sys/sdt.h> from SystemTap.  The probes use the
+ * provider @c fragpool, cost only a no-op instruction when no tracer
+ * is attached, and can be used with perf, bpftrace, or SystemTap
+ * without rebuilding.  They are fired with the pool locked, and
+ * report:
+ *
+ * @li @c request: pool, aligned @p min_size and @p max_size, start of
+ * the fragment (null on failure), its length, and its slot index (-1
+ * on failure);
+ *
+ * @li @c resize: pool, fragment start, requested size, resulting
+ * length, and slot index;
+ *
+ * @li @c reallocate: pool, original fragment start, @p min_size,
+ * aligned @p max_size, new fragment start (null on failure), its
+ * length, its slot index, and the number of octets copied;
+ *
+ * @li @c release: pool, fragment start, its length, and its slot
+ * index, once for each fragment released by fp_release_many();
+ *
+ * @li @c release_suffix: pool, slot index of a fragment being
+ * trimmed, the octets trimmed, and the number of slots shifted to
+ * hold them, or -1 if no slot was available and the octets were kept
+ * by the fragment;
+ *
+ * @li @c split: pool, fragment start, aligned length retained, start
+ * of the new fragment (null on failure), and slot index (-1 if the
+ * fragment is not valid);
+ *
+ * @li @c compact: pool, the budget in octets (or @c ULONG_MAX for
+ * fp_compact()), the octets moved, and the number of fragments
+ * moved.
+ *
+ * This option does not affect the layout of pool structures. */
+#define FRAGPOOL_WITH_SDT 0
+#endif /* FRAGPOOL_WITH_SDT */
+
+#ifndef FRAGPOOL_WITH_TRACE
+/** Nonzero to support recording the operations on a pool.
+ *
+ * Each pool then has a @c trace field which, if not null, references
+ * a ring buffer to which a #fp_trace_record_t is appended for each
+ * operation.  A captured trace can be replayed against a new pool
+ * with the same configuration to reproduce its behavior.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_TRACE 0
+#endif /* FRAGPOOL_WITH_TRACE */
+
+/** Operations recorded in a trace. */
+enum fp_trace_op_t {
+  FP_TRACE_RESET = 1,           /**< fp_reset() */
+  FP_TRACE_REQUEST,             /**< fp_request(), or one block of fp_request_many() */
+  FP_TRACE_RESIZE,              /**< fp_resize() */
+  FP_TRACE_REALLOCATE,          /**< fp_reallocate() */
+  FP_TRACE_RELEASE,             /**< fp_release(), or one block of fp_release_many() */
+  FP_TRACE_COMPACT,             /**< fp_compact() or fp_compact_step() */
+  FP_TRACE_SPLIT,               /**< fp_split() */
+};
+
+/** Value recorded in a trace where there is no fragment, or a
+ * pointer does not lie within the pool. */
+#define FP_TRACE_NO_OFFSET ((fp_size_t)-1)
+
+/** A record of one pool operation.
+ *
+ * Fragments are identified by their offset from the start of the
+ * pool. */
+typedef struct fp_trace_record_t {
+  /** The operation, from #fp_trace_op_t */
+  uint8_t op;
+
+  /** The error code returned by fp_release(), otherwise zero */
+  uint8_t status;
+
+  /** The fragment passed to the operation, if any */
+  fp_size_t offset;
+
+  /** The @p min_size, @p new_size or @p length argument, if any */
+  fp_size_t min_size;
+
+  /** The @p max_size argument, if any, or the budget of
+   * fp_compact_step() (#FP_TRACE_NO_OFFSET if it is unbounded) */
+  fp_size_t max_size;
+
+  /** The fragment returned by the operation, if any */
+  fp_size_t result;
+
+  /** The length of the fragment returned by the operation, of the
+   * fragment released, or the octets moved by compaction */
+  fp_size_t length;
+} *fp_trace_record_t;
+
+/** A ring buffer of trace records, provided by the caller. */
+typedef struct fp_trace_t {
+  /** Storage for the records */
+  struct fp_trace_record_t* record;
+
+  /** The number of elements in @c record */
+  unsigned long capacity;
+
+  /** The number of records appended since the trace was created.
+   * The next record is stored at index <tt>count % capacity</tt>; if
+   * @c count exceeds @c capacity the oldest records have been
+   * overwritten. */
+  unsigned long count;
+} *fp_trace_t;
+
+/** Configuration of a traced pool, needed to replay the trace.
+ *
+ * A trace file consists of this header followed by @c count records
+ * in order from oldest to newest, all in the byte order of the
+ * system that recorded them. */
+typedef struct fp_trace_header_t {
+  /** #FP_TRACE_MAGIC */
+  uint32_t magic;
+
+  /** The pool alignment */
+  uint16_t alignment;
+
+  /** The misalignment of the pool start relative to @c alignment */
+  uint16_t start_phase;
+
+  /** FRAGPOOL_SIZE_BITS of the recording library */
+  uint8_t size_bits;
+
+  /** Nonzero if older records were overwritten, so the trace does
+   * not begin with the pool in a known state */
+  uint8_t wrapped;
+
+  /** Zero */
+  uint16_t reserved;
+
+  /** The number of octets in the pool */
+  uint32_t pool_size;
+
+  /** The number of fragment slots */
+  uint32_t fragment_count;
+
+  /** The number of records that follow */
+  uint32_t count;
+} *fp_trace_header_t;
+
+/** Value of fp_trace_header_t::magic. */
+#define FP_TRACE_MAGIC 0x52545046UL
+
+#ifndef FRAGPOOL_WITH_HANDLES
+/** Nonzero to support fragment handles.
+ *
+ * Each fragment slot then records the generation in which it was
+ * allocated, and fp_request_handle() and related functions identify
+ * a fragment by a #fp_handle_t that records its slot.  This usually
+ * occupies what would otherwise be padding in the slot.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_HANDLES 0
+#endif /* FRAGPOOL_WITH_HANDLES */
+
+#ifndef FRAGPOOL_WITH_COMPACT_SLOTS
+/** Nonzero to record the start of each fragment as an offset from
+ * the start of its pool rather than as an address.
+ *
+ * The offset is an #fp_size_t, so with 16-bit sizes each fragment
+ * slot occupies four octets instead of the eight needed for a pointer
+ * and a padded length on 32-bit targets, or sixteen on 64-bit hosts.
+ * Statically defined pools need correspondingly less RAM, and on
+ * hosts four times as many slots share a cache line.  Each use of a
+ * fragment start then adds the pool start.  On targets with 16-bit
+ * pointers this saves nothing.
+ *
+ * #FRAGPOOL_WITH_SIZE_INDEX and #FRAGPOOL_WITH_HANDLES add their
+ * fields to the compact slot.  Code outside the library that examines
+ * fragment slots must use #FP_FRAGMENT_START.
+ *
+ * The value must be the same when compiling the library and any code
+ * that defines a pool. */
+#define FRAGPOOL_WITH_COMPACT_SLOTS 0
+#endif /* FRAGPOOL_WITH_COMPACT_SLOTS */
+
+/** Type used to distinguish successive allocations of a fragment with
+ * #FRAGPOOL_WITH_HANDLES.  A handle is mistaken for a later
+ * allocation at the same address only if exactly a multiple of 65536
+ * allocations were made from the pool in between. */
+typedef uint16_t fp_generation_t;
+
 /** Bookkeeping for a fragment within the pool.
  *
  * The fragment state is allocated if its memory has been made
@@ -120,16 +616,50 @@ typedef int16_t fp_ssize_t;
  * You don't get to inspect or mutate the fields of this structure, so
  * any descriptive comments are irrelevant to you. */
 typedef struct fp_fragment_t {
+#if (FRAGPOOL_WITH_COMPACT_SLOTS) && ! defined(FP_DOXYGEN)
+  /* Offset of start from the pool_start of the corresponding pool */
+  fp_size_t offset;
+#else /* FRAGPOOL_WITH_COMPACT_SLOTS */
   /** Address within the corresponding pool's memory space.  This
-   * pointer must meet the pool's fragment alignment restrictions. */
+   * pointer must meet the pool's fragment alignment restrictions.
+   * With #FRAGPOOL_WITH_COMPACT_SLOTS this is stored as an offset
+   * from the start of the pool; use #FP_FRAGMENT_START. */
   uint8_t* start;
+#endif /* FRAGPOOL_WITH_COMPACT_SLOTS */
 
   /** Length of the pool.  A negative value indicates an allocated
    * fragment; a positive value indicates an available fragment; a
    * zero value indicates an inactive fragment. */
   fp_ssize_t length;
+
+#if (FRAGPOOL_WITH_SIZE_INDEX) || defined(FP_DOXYGEN)
+  /** Slot index of the previous available fragment in the same size
+   * class, or #FP_NO_SLOT.  Meaningful only for available fragments. */
+  fp_count_t size_class_prev;
+
+  /** Slot index of the next available fragment in the same size
+   * class, or #FP_NO_SLOT.  Meaningful only for available fragments. */
+  fp_count_t size_class_next;
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#if (FRAGPOOL_WITH_HANDLES) || defined(FP_DOXYGEN)
+  /** The pool generation when the fragment was last allocated. */
+  fp_generation_t generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
 } *fp_fragment_t;
 
+#if FRAGPOOL_WITH_COMPACT_SLOTS
+#define FP_FRAGMENT_START(_p, _f) ((_p)->pool_start + (_f)->offset)
+#define FP_FRAGMENT_SET_START(_p, _f, _s) \
+  ((_f)->offset = (fp_size_t)((_s) - (_p)->pool_start))
+#else /* FRAGPOOL_WITH_COMPACT_SLOTS */
+/** The address of the start of fragment @p _f in pool @p _p. */
+#define FP_FRAGMENT_START(_p, _f) ((_f)->start)
+
+/** Set the start of fragment @p _f in pool @p _p to address @p _s. */
+#define FP_FRAGMENT_SET_START(_p, _f, _s) ((_f)->start = (_s))
+#endif /* FRAGPOOL_WITH_COMPACT_SLOTS */
+
 /** Prefix common to all pool structures.
  *
  * For documentation on these fields see the pseudo-structure
@@ -165,8 +695,69 @@ typedef struct fp_fragment_t {
 #define FP_POOL_STRUCT_COMMON                   \
   uint8_t* pool_start;                          \
   uint8_t* pool_end;                            \
-  uint8_t pool_alignment;                       \
-  uint8_t fragment_count
+  fp_alignment_t pool_alignment;                \
+  fp_count_t fragment_count                     \
+  FP_POOL_STRUCT_SIZE_INDEX_                    \
+  FP_POOL_STRUCT_LENGTH_ARRAY_                  \
+  FP_POOL_STRUCT_LOCK_                          \
+  FP_POOL_STRUCT_NOTIFY_                        \
+  FP_POOL_STRUCT_STATS_                         \
+  FP_POOL_STRUCT_TRACE_                         \
+  FP_POOL_STRUCT_HANDLES_
+
+/* @cond DOXYGEN_EXCLUDE */
+#if FRAGPOOL_WITH_SIZE_INDEX
+#define FP_POOL_STRUCT_SIZE_INDEX_                      \
+  ;                                                     \
+  fp_size_class_map_t size_class_map;                   \
+  fp_count_t size_class_head[FP_SIZE_CLASS_COUNT]
+#else /* FRAGPOOL_WITH_SIZE_INDEX */
+#define FP_POOL_STRUCT_SIZE_INDEX_
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+#define FP_POOL_STRUCT_LENGTH_ARRAY_                    \
+  ;                                                     \
+  fp_ssize_t* available_length
+#else /* FRAGPOOL_WITH_LENGTH_ARRAY */
+#define FP_POOL_STRUCT_LENGTH_ARRAY_
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+#if FRAGPOOL_WITH_LOCK
+#define FP_POOL_STRUCT_LOCK_                            \
+  ;                                                     \
+  const struct fp_lock_t* lock;                         \
+  struct fp_copy_t* copying
+#else /* FRAGPOOL_WITH_LOCK */
+#define FP_POOL_STRUCT_LOCK_
+#endif /* FRAGPOOL_WITH_LOCK */
+#if FRAGPOOL_WITH_NOTIFY
+#define FP_POOL_STRUCT_NOTIFY_                          \
+  ;                                                     \
+  const struct fp_notify_t* notify
+#else /* FRAGPOOL_WITH_NOTIFY */
+#define FP_POOL_STRUCT_NOTIFY_
+#endif /* FRAGPOOL_WITH_NOTIFY */
+#if FRAGPOOL_WITH_STATS
+#define FP_POOL_STRUCT_STATS_                           \
+  ;                                                     \
+  struct fp_counters_t counters
+#else /* FRAGPOOL_WITH_STATS */
+#define FP_POOL_STRUCT_STATS_
+#endif /* FRAGPOOL_WITH_STATS */
+#if FRAGPOOL_WITH_TRACE
+#define FP_POOL_STRUCT_TRACE_                           \
+  ;                                                     \
+  struct fp_trace_t* trace
+#else /* FRAGPOOL_WITH_TRACE */
+#define FP_POOL_STRUCT_TRACE_
+#endif /* FRAGPOOL_WITH_TRACE */
+#if FRAGPOOL_WITH_HANDLES
+#define FP_POOL_STRUCT_HANDLES_                         \
+  ;                                                     \
+  fp_generation_t generation
+#else /* FRAGPOOL_WITH_HANDLES */
+#define FP_POOL_STRUCT_HANDLES_
+#endif /* FRAGPOOL_WITH_HANDLES */
+/* @endcond */
 
 #ifdef FP_DOXYGEN
 /** Prefix common to all pool structures.
@@ -187,10 +778,49 @@ struct FP_POOL_STRUCT_COMMON_ {
    * ensures addresses are 16-bit aligned; a value of 4 ensures
    * addresses are 32-bit aligned.  Value must be a nonzero power of
    * two. */
-  uint8_t pool_alignment;
+  fp_alignment_t pool_alignment;
+
+  /** The number of fragments supported by the pool.  With
+   * #FRAGPOOL_WITH_SIZE_INDEX this must be less than #FP_MAX_COUNT. */
+  fp_count_t fragment_count;
+
+  /** Only with #FRAGPOOL_WITH_SIZE_INDEX: the set of size classes
+   * that have at least one available fragment. */
+  fp_size_class_map_t size_class_map;
+
+  /** Only with #FRAGPOOL_WITH_SIZE_INDEX: the slot index of the first
+   * available fragment in each size class, or #FP_NO_SLOT. */
+  fp_count_t size_class_head[FP_SIZE_CLASS_COUNT];
+
+  /** Only with #FRAGPOOL_WITH_LENGTH_ARRAY: @c fragment_count
+   * entries holding the length of each available fragment and zero
+   * for other slots, or a null pointer. */
+  fp_ssize_t* available_length;
+
+  /** Only with #FRAGPOOL_WITH_LOCK: the hooks used to serialize
+   * access to the pool, or a null pointer if the caller provides its
+   * own protection. */
+  const struct fp_lock_t* lock;
+
+  /** Only with #FRAGPOOL_WITH_LOCK: the copies fp_reallocate() is
+   * making with the pool unlocked.  This must be null when the pool
+   * is defined. */
+  struct fp_copy_t* copying;
+
+  /** Only with #FRAGPOOL_WITH_NOTIFY: the hook invoked when more
+   * space becomes available, or a null pointer. */
+  const struct fp_notify_t* notify;
+
+  /** Only with #FRAGPOOL_WITH_STATS: usage counters. */
+  struct fp_counters_t counters;
 
-  /** The number of fragments supported by the pool. */
-  uint8_t fragment_count;
+  /** Only with #FRAGPOOL_WITH_TRACE: where operations are recorded,
+   * or a null pointer. */
+  struct fp_trace_t* trace;
+
+  /** Only with #FRAGPOOL_WITH_HANDLES: the generation of the most
+   * recent allocation. */
+  fp_generation_t generation;
 };
 #endif /* FP_DOXYGEN */
 
@@ -218,7 +848,7 @@ typedef struct fp_pool_t {
 /**  Reset the pool.
  *
  * All memory is assigned to a single fragment which is marked
- * unallocated.
+ * unallocated.  This must be invoked before the pool is first used.
  *
  * @param pool the pool to be validated
  */
@@ -255,6 +885,44 @@ uint8_t* fp_request (fp_pool_t pool,
                      fp_size_t max_size,
                      uint8_t** fragment_endp);
 
+/** One of a set of allocations made together by fp_request_many(). */
+typedef struct fp_request_t {
+  /** The minimum acceptable size, as with fp_request(). */
+  fp_size_t min_size;
+
+  /** The maximum desired size, as with fp_request(). */
+  fp_size_t max_size;
+
+  /** Set to the start of the allocated fragment, or to a null pointer
+   * if the set could not be allocated. */
+  uint8_t* start;
+
+  /** Set to the end of the allocated fragment, or to a null pointer
+   * if the set could not be allocated. */
+  uint8_t* end;
+} *fp_request_t;
+
+/** Obtain several blocks of memory from the pool, or none of them.
+ *
+ * The blocks are allocated in order exactly as successive calls to
+ * fp_request() would allocate them, but without releasing the pool
+ * lock between them.  If any of them cannot be allocated those that
+ * were are released, which leaves the fragments of the pool exactly
+ * as they were before the call.
+ *
+ * @param pool the pool from which memory is obtained
+ *
+ * @param requests the sizes of the blocks to be allocated, and where
+ * to store their locations
+ *
+ * @param count the number of elements in @p requests
+ *
+ * @return zero if all blocks were allocated, #FP_EINVAL if any sizes
+ * are unacceptable, or #FP_ENOMEM if the blocks do not fit. */
+int fp_request_many (fp_pool_t pool,
+                     fp_request_t requests,
+                     unsigned int count);
+
 /** Attempt to resize a fragment in-place.
  *
  * This operation will release trailing bytes to the pool or attempt
@@ -339,6 +1007,31 @@ uint8_t* fp_reallocate (fp_pool_t pool,
                         fp_size_t max_size,
                         uint8_t** fragment_endp);
 
+/** Divide an allocated fragment in two.
+ *
+ * The first @p length octets remain in the original fragment and the
+ * rest become a new allocated fragment, without moving any data.
+ * This requires an unused fragment slot.
+ *
+ * @param pool the pool from which the fragment was allocated
+ *
+ * @param bp the start of the fragment
+ *
+ * @param length the number of octets to retain in the original
+ * fragment.  This is increased if necessary to satisfy the pool
+ * alignment requirements, and must be less than the length of the
+ * fragment.
+ *
+ * @param fragment_endp where to store the end of the new fragment
+ *
+ * @return the start of the new fragment, or a null pointer if @p bp
+ * is not an allocated fragment, it is not longer than @p length, or
+ * no slot is available. */
+uint8_t* fp_split (fp_pool_t pool,
+                   uint8_t* bp,
+                   fp_size_t length,
+                   uint8_t** fragment_endp);
+
 /** Release a block of memory to the pool.
  *
  * @param pool the pool from which bp was allocated
@@ -351,6 +1044,218 @@ uint8_t* fp_reallocate (fp_pool_t pool,
 int fp_release (fp_pool_t pool,
                 const uint8_t* bp);
 
+/** Release several blocks of memory to the pool.
+ *
+ * This is equivalent to invoking fp_release() on each block, but
+ * locates all the fragments before merging any of them, then merges
+ * and compacts the fragment slots in a single pass.  It is
+ * substantially faster when many blocks are returned together.
+ *
+ * @param pool the pool from which the blocks were allocated
+ *
+ * @param bps the starts of the blocks to be released, in any order
+ *
+ * @param count the number of blocks in @p bps
+ *
+ * @return zero if all blocks are released, or an error code if any
+ * of them is invalid.  Valid blocks are released even if others are
+ * not. */
+int fp_release_many (fp_pool_t pool,
+                     const uint8_t* const* bps,
+                     unsigned int count);
+
+/** A reference to an allocated fragment that can be resolved without
+ * searching the pool.
+ *
+ * The handle is filled in by fp_request_handle() and updated by the
+ * operations that take it.  The @c start field is the start of the
+ * fragment and may be used as such; if fp_compact() moves the
+ * fragment the owner must update it in the relocation hook.  The
+ * other fields are private. */
+typedef struct fp_handle_t {
+  /** The start of the fragment */
+  uint8_t* start;
+
+  /** The slot holding the fragment when the handle was last used.
+   * Slots shift as other fragments are split and merged, in which
+   * case the fragment is located from @c start. */
+  fp_count_t slot;
+
+  /** The generation of the allocation */
+  fp_generation_t generation;
+} *fp_handle_t;
+
+#if (FRAGPOOL_WITH_HANDLES) || defined(FP_DOXYGEN)
+/** As fp_request(), also filling in a handle for the new fragment.
+ *
+ * @param handle where to store the handle; unchanged on failure */
+uint8_t* fp_request_handle (fp_pool_t pool,
+                            fp_size_t min_size,
+                            fp_size_t max_size,
+                            uint8_t** fragment_endp,
+                            fp_handle_t handle);
+
+/** As fp_resize(), for the fragment identified by a handle.
+ *
+ * @return as with fp_resize(); a null pointer if the handle does not
+ * identify an allocated fragment, e.g. because it was released. */
+uint8_t* fp_resize_handle (fp_pool_t pool,
+                           fp_handle_t handle,
+                           fp_size_t new_size,
+                           uint8_t** fragment_endp);
+
+/** As fp_reallocate(), for the fragment identified by a handle,
+ * which is updated to identify the result.
+ *
+ * @return as with fp_reallocate(); a null pointer if the handle does
+ * not identify an allocated fragment. */
+uint8_t* fp_reallocate_handle (fp_pool_t pool,
+                               fp_handle_t handle,
+                               fp_size_t min_size,
+                               fp_size_t max_size,
+                               uint8_t** fragment_endp);
+
+/** As fp_release(), for the fragment identified by a handle.
+ *
+ * @return zero if the fragment is released, or #FP_EINVAL if the
+ * handle does not identify an allocated fragment.  In particular, a
+ * handle that has already been released is rejected even if the
+ * space has since been allocated again. */
+int fp_release_handle (fp_pool_t pool,
+                       fp_handle_t handle);
+#endif /* FRAGPOOL_WITH_HANDLES */
+
+/** Hooks through which the owners of allocated fragments take part in
+ * compaction. */
+typedef struct fp_relocate_t {
+  /** Invoked after the content of an allocated fragment has been
+   * moved from @p old_start to @p new_start, so the owner can update
+   * its references. */
+  void (*moved) (struct fp_pool_t* pool,
+                 uint8_t* old_start,
+                 uint8_t* new_start,
+                 fp_size_t length,
+                 void* context);
+
+  /** Return nonzero if the allocated fragment at @p start must not be
+   * moved, for example because a device is accessing it.  A null
+   * pointer means no fragment is pinned. */
+  int (*pinned) (struct fp_pool_t* pool,
+                 const uint8_t* start,
+                 void* context);
+
+  /** Value passed to the hooks */
+  void* context;
+} *fp_relocate_t;
+
+/** Consolidate the available space in the pool.
+ *
+ * Allocated fragments are moved toward the start of the pool,
+ * preserving their order and content, so that the available space
+ * between them is merged.  Fragments that are pinned stay where they
+ * are; available space before each is left as a single fragment.  If
+ * no fragment is pinned all available space ends up in one fragment
+ * at the end of the pool.
+ *
+ * The hooks are invoked with the pool locked, and must not invoke
+ * any operation on the pool.  A pool whose lock hooks are
+ * fp_lock_t::shared is not compacted.
+ *
+ * @param pool the pool to be compacted
+ *
+ * @param hooks how to determine whether a fragment is pinned and how
+ * to notify its owner when it has moved.  This may be a null pointer
+ * only if nothing holds the addresses of allocated fragments.
+ *
+ * @return the number of octets moved */
+unsigned long fp_compact (fp_pool_t pool,
+                          const struct fp_relocate_t* hooks);
+
+/** Perform part of fp_compact().
+ *
+ * Fragments are moved in address order as by fp_compact() until the
+ * next would take the octets moved past @p budget.  At least one
+ * fragment is moved if any can be, even if it is longer than the
+ * budget, so repeated calls always finish.  This bounds the time the
+ * pool is locked, allowing compaction to proceed when the system is
+ * otherwise idle.
+ *
+ * @param pool the pool to be compacted
+ *
+ * @param hooks as for fp_compact()
+ *
+ * @param budget the maximum number of octets to move
+ *
+ * @return the number of octets moved; zero if the pool is fully
+ * compacted. */
+unsigned long fp_compact_step (fp_pool_t pool,
+                               const struct fp_relocate_t* hooks,
+                               unsigned long budget);
+
+/** Determine the longest fragment that could currently be allocated.
+ *
+ * @param pool the pool to be inspected
+ *
+ * @return the length of the longest available fragment, or zero if
+ * the pool has no available fragments.  fp_request() with this as @p
+ * min_size will succeed unless the pool is modified in the
+ * interim. */
+fp_size_t fp_largest_available (fp_pool_t pool);
+
+/** A snapshot of the state and usage of a pool. */
+typedef struct fp_stats_t {
+  /** The total length of the available fragments. */
+  fp_size_t available_bytes;
+
+  /** The length of the longest available fragment. */
+  fp_size_t largest_available;
+
+  /** The number of allocated fragments. */
+  fp_count_t allocated_slots;
+
+  /** The number of available fragments. */
+  fp_count_t available_slots;
+
+  /** The number of inactive fragment slots. */
+  fp_count_t inactive_slots;
+
+  /** The degree to which available memory is fragmented, in parts
+   * per thousand: zero if it is all in one fragment (or there is
+   * none), approaching 1000 as the longest available fragment
+   * becomes a small part of the total. */
+  unsigned int fragmentation;
+
+  /** The counters maintained with #FRAGPOOL_WITH_STATS.  Without
+   * that option all are zero. */
+  struct fp_counters_t counters;
+} *fp_stats_t;
+
+/** Describe the state and usage of a pool.
+ *
+ * This examines every fragment slot, and is intended for diagnostics
+ * and capacity planning rather than for use on each allocation.
+ *
+ * @param pool the pool to be inspected
+ *
+ * @param stats where to store the description */
+void fp_stats (fp_pool_t pool,
+               fp_stats_t stats);
+
+#if (FRAGPOOL_WITH_TRACE) || defined(FP_DOXYGEN)
+/** Describe the recording of a pool.
+ *
+ * @param pool a pool with a trace
+ *
+ * @param header where to store the description of the pool and its
+ * trace
+ *
+ * @return the index in the trace ring buffer of the oldest record
+ * retained, which is followed by @c header->count records (modulo the
+ * capacity of the buffer). */
+unsigned long fp_trace_header (fp_pool_t pool,
+                               fp_trace_header_t header);
+#endif /* FRAGPOOL_WITH_TRACE */
+
 /** Verify the integrity of the pool.
  *
  * @param pool the pool to be validated
@@ -56,8 +56,14 @@ fp_find_best_fragment (fp_pool_t p,
                        fp_size_t max_size);
 
 void
-fp_merge_adjacent_available (fp_fragment_t f,
+fp_merge_adjacent_available (fp_pool_t p,
+                             fp_fragment_t f,
                              fp_fragment_t fe);
+
+/* Reconstruct any derived bookkeeping (such as the size index) after
+ * the fragment array has been modified directly. */
+void
+fp_rebuild_index (fp_pool_t p);
 /** @endcond */
 
 #endif /* FRAGPOOL_INTERNAL_H_ */
@@ -0,0 +1,128 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FRAGPOOL_GROUP_H_
+#define FRAGPOOL_GROUP_H_
+
+/** @file
+ *
+ * @brief Header providing interface for groups of fragment pools.
+ *
+ * A pool group partitions memory among several independent pools,
+ * normally one per thread or per device queue, so that each can
+ * allocate from its own shard without contending with the others.
+ * A request that cannot be satisfied by the caller's shard is
+ * satisfied if possible by stealing from the shard that has the
+ * longest available fragment.  Memory may be returned to the group
+ * from any thread, since the owning shard is identified by address.
+ *
+ * The group adds no locking of its own.  Unless each shard is used
+ * only from one context, the library should be built with
+ * #FRAGPOOL_WITH_LOCK and each shard given lock hooks, since stealing
+ * and releases from other threads access shards that are not the
+ * caller's own.
+ *
+ * @homepage http://github.com/pabigot/fragpool
+ * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
+ */
+
+#include <fragpool/fragpool.h>
+
+/** Bookkeeping for a group of pools.
+ *
+ * The caller defines and resets the pools, which must occupy disjoint
+ * memory, and provides an array referencing them.  Nothing in the
+ * structure changes after it is initialized. */
+typedef struct fp_group_t {
+  /** The number of pools in the group. */
+  unsigned int pool_count;
+
+  /** The pools in the group.  The index of a pool in this array
+   * identifies it as a shard in fp_group_request(). */
+  fp_pool_t const* pool;
+} *fp_group_t;
+
+/** Obtain a block of memory from a group.
+ *
+ * This is fp_request() on the local shard, falling back to the shard
+ * with the longest available fragment if the local shard cannot
+ * provide @p min_size octets.
+ *
+ * @param group the group from which memory is obtained
+ *
+ * @param shard the index of the caller's own pool within the group
+ *
+ * @param min_size as with fp_request()
+ *
+ * @param max_size as with fp_request()
+ *
+ * @param fragment_endp as with fp_request()
+ *
+ * @return a pointer to the start of the returned region, or a null
+ * pointer if no shard can satisfy the allocation or @p shard is not
+ * valid. */
+uint8_t* fp_group_request (fp_group_t group,
+                           unsigned int shard,
+                           fp_size_t min_size,
+                           fp_size_t max_size,
+                           uint8_t** fragment_endp);
+
+/** Identify the pool within a group that holds an address.
+ *
+ * Use this to locate the pool for fp_resize() or fp_reallocate() on
+ * memory obtained from fp_group_request().
+ *
+ * @param group the group to be searched
+ *
+ * @param bp an address within one of the pools of the group
+ *
+ * @return the pool that holds @p bp, or a null pointer if it is not
+ * within any of the pools. */
+fp_pool_t fp_group_pool (fp_group_t group,
+                         const uint8_t* bp);
+
+/** Release a block of memory to the group.
+ *
+ * This may be invoked from any thread, regardless of which shard
+ * provided the block.
+ *
+ * @param group the group from which @p bp was allocated
+ *
+ * @param bp the start of an allocated block returned by
+ * fp_group_request(), or by fp_resize() or fp_reallocate() on the
+ * block's pool.
+ *
+ * @return zero if the block is released, or an error code if @p bp is
+ * invalid. */
+int fp_group_release (fp_group_t group,
+                      const uint8_t* bp);
+
+#endif /* FRAGPOOL_GROUP_H_ */
@@ -0,0 +1,601 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FRAGPOOL_LINUX_H_
+#define FRAGPOOL_LINUX_H_
+
+/** @file
+ *
+ * @brief Header providing Linux-specific support for fragment pools.
+ *
+ * The library includes these functions only when built natively on
+ * Linux.
+ *
+ * An eventfd may be attached to a pool built with
+ * #FRAGPOOL_WITH_NOTIFY.  The descriptor becomes readable whenever
+ * memory returned to the pool increases the length of the longest
+ * available fragment, so a consumer that cannot obtain a fragment may
+ * wait for it with poll(2) or epoll(7) instead of retrying.  To avoid
+ * losing a notification the consumer should clear the descriptor
+ * before each retry:
+ @verbatim
+ while (NULL == (bp = fp_request(pool, min_size, max_size, &bpe))) {
+   struct pollfd pfd = { .fd = efd->fd, .events = POLLIN };
+   poll(&pfd, 1, -1);
+   fp_eventfd_clear(efd);
+ }
+ @endverbatim
+ *
+ * The data of a fragment chain can be described for scatter/gather
+ * I/O with fp_chain_iovec().
+ *
+ * A stream such as a TCP socket or pipe may be read directly into
+ * pool fragments with fp_receive().  Each frame is delivered as a
+ * fragment of its own, and data beyond the end of a frame is carried
+ * into the next one with fp_split() rather than copied.
+ *
+ * On hosts a pool may be constructed over memory from mmap(2) with
+ * fp_pool_map(), which sizes the fragment array at runtime and can
+ * back the pool with huge pages to reduce TLB misses, prefault it so
+ * the first use of each page does not fault, or share it through a
+ * memfd.
+ *
+ * Pages of large available fragments can be returned to the kernel
+ * with fp_trim(), periodically or, with #FRAGPOOL_WITH_NOTIFY,
+ * whenever a release forms a long enough available fragment.
+ *
+ * Fragments may be transmitted directly from the pool with
+ * fp_send().  Ownership of each queued fragment passes to the
+ * sender, which releases it once the kernel no longer references its
+ * memory.  With writev(2) that is as soon as it has been written;
+ * with #FP_SEND_ZEROCOPY it is when the socket reports completion;
+ * and with #FP_SEND_VMSPLICE it is when the data has been read from
+ * the pipe.
+ *
+ * @homepage http://github.com/pabigot/fragpool
+ * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
+ */
+
+#include <fragpool/fragpool.h>
+#include <fragpool/chain.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#if (FRAGPOOL_WITH_NOTIFY) || defined(FP_DOXYGEN)
+
+/** State for an eventfd attached to a pool.
+ *
+ * The structure is filled in by fp_eventfd_attach() and must remain
+ * valid until fp_eventfd_detach() is invoked. */
+typedef struct fp_eventfd_t {
+  /** The hook registered with the pool. */
+  struct fp_notify_t notify;
+
+  /** The eventfd descriptor, which is non-blocking. */
+  int fd;
+} *fp_eventfd_t;
+
+/** Create an eventfd and register it as the notification hook of a
+ * pool.
+ *
+ * This replaces any hook previously registered with the pool, and
+ * must not be invoked while the pool is in use by other threads.
+ *
+ * @param pool the pool to be monitored
+ *
+ * @param efd the state for the eventfd
+ *
+ * @return zero on success, or -1 with @c errno set if the eventfd
+ * could not be created. */
+int fp_eventfd_attach (fp_pool_t pool,
+                       fp_eventfd_t efd);
+
+/** Clear any pending notification on the eventfd.
+ *
+ * @param efd the state for the eventfd
+ *
+ * @return the number of notifications that had been posted since it
+ * was last cleared. */
+unsigned long fp_eventfd_clear (fp_eventfd_t efd);
+
+/** Remove the notification hook from a pool and close the eventfd.
+ *
+ * This must not be invoked while the pool is in use by other threads.
+ *
+ * @param pool the pool passed to fp_eventfd_attach()
+ *
+ * @param efd the state for the eventfd */
+void fp_eventfd_detach (fp_pool_t pool,
+                        fp_eventfd_t efd);
+
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+/** Describe the data of a chain for writev(2) or sendmsg(2).
+ *
+ * @param chain the chain holding the data
+ *
+ * @param iov where to store the description, one element per link
+ * that holds data
+ *
+ * @param iovcnt the number of elements in @p iov
+ *
+ * @return the number of elements needed to describe all the data.
+ * If this exceeds @p iovcnt only the first @p iovcnt are stored. */
+int fp_chain_iovec (const struct fp_chain_t* chain,
+                    struct iovec* iov,
+                    int iovcnt);
+
+/** Locate the end of the first frame in received data.
+ *
+ * @param data the start of the received data, which begins a frame
+ *
+ * @param length the number of octets received
+ *
+ * @param context the context registered with fp_receiver_init()
+ *
+ * @return the length of the first frame, or zero if @p data does not
+ * yet hold a complete frame.  The value must not exceed @p length. */
+typedef fp_size_t (*fp_frame_end_t) (const uint8_t* data,
+                                     fp_size_t length,
+                                     void* context);
+
+/** State for receiving frames from a stream into pool fragments.
+ *
+ * The structure is initialized by fp_receiver_init().  Between calls
+ * to fp_receive() it owns the fragment holding any partial frame. */
+typedef struct fp_receiver_t {
+  /** The pool from which fragments are allocated. */
+  fp_pool_t pool;
+
+  /** The descriptor from which data is read. */
+  int fd;
+
+  /** The minimum length of a fragment to read into. */
+  fp_size_t min_size;
+
+  /** The function that locates frame boundaries. */
+  fp_frame_end_t frame_end;
+
+  /** Context passed to @c frame_end. */
+  void* context;
+
+  /** The fragment holding received data not yet delivered, or a null
+   * pointer if there is none. */
+  uint8_t* start;
+
+  /** The end of the fragment at @c start. */
+  uint8_t* end;
+
+  /** The number of octets received into the fragment at @c start. */
+  fp_size_t fill;
+
+  /** The number of octets copied since initialization because a
+   * fragment could not be extended or split in place. */
+  unsigned long copied;
+} *fp_receiver_t;
+
+/** Initialize a receiver.
+ *
+ * @param rx the receiver state
+ *
+ * @param pool the pool from which fragments are allocated
+ *
+ * @param fd the descriptor from which data is read.  It should be
+ * non-blocking if the caller multiplexes several descriptors.
+ *
+ * @param min_size the minimum length of a fragment to read into
+ *
+ * @param frame_end the function that locates frame boundaries
+ *
+ * @param context passed to @p frame_end */
+void fp_receiver_init (fp_receiver_t rx,
+                       fp_pool_t pool,
+                       int fd,
+                       fp_size_t min_size,
+                       fp_frame_end_t frame_end,
+                       void* context);
+
+/** Read from a stream until a complete frame is available.
+ *
+ * Data is read directly into a fragment of the largest available
+ * length.  When the fragment fills before a frame is complete it is
+ * extended in place if possible, and otherwise reallocated.  When a
+ * frame is complete the fragment is trimmed to it; any data that
+ * follows is kept in a fragment split from the end of the frame, or
+ * copied to a new fragment if the frame length is not a multiple of
+ * the pool alignment.
+ *
+ * @param rx the receiver state
+ *
+ * @param framep where to store the start of the frame.  The frame
+ * is an allocated fragment which the caller must release with
+ * fp_release().
+ *
+ * @return the length of the frame; zero at end of file; or -1 with
+ * @c errno set.  @c EAGAIN indicates a non-blocking descriptor has
+ * no more data, and @c ENOBUFS that no fragment could hold the data.
+ * Received data is retained in either case, and also at end of file
+ * where @c fill is non-zero if the stream ended within a frame. */
+ssize_t fp_receive (fp_receiver_t rx,
+                    uint8_t** framep);
+
+/** Release any fragment held by a receiver.
+ *
+ * The descriptor is not closed.
+ *
+ * @param rx the receiver state */
+void fp_receiver_close (fp_receiver_t rx);
+
+/** Flag for fp_sender_init() to transmit with sendmsg(2) and
+ * MSG_ZEROCOPY.  The descriptor must be a connected stream socket;
+ * fragments are released as completions are read from its error
+ * queue. */
+#define FP_SEND_ZEROCOPY 0x01
+
+/** Flag for fp_sender_init() to transmit with vmsplice(2).  The
+ * descriptor must be the write end of a pipe; fragments are released
+ * once the data has been read from the pipe.  A reader that splices
+ * the data on to a socket may leave the kernel referencing the pages
+ * after that, so such readers should use #FP_SEND_ZEROCOPY
+ * instead. */
+#define FP_SEND_VMSPLICE 0x02
+
+/** A fragment queued for transmission. */
+struct fp_send_entry_t {
+  /** The start of the fragment. */
+  uint8_t* start;
+
+  /** The number of octets to transmit from @c start. */
+  fp_size_t length;
+
+  /** What must be observed before the fragment can be released: the
+   * sequence number of the last zero-copy send that included it, or
+   * the stream offset of its end. */
+  unsigned long mark;
+};
+
+/** State for transmitting pool fragments without copying them.
+ *
+ * The structure is initialized by fp_sender_init().  Queued
+ * fragments are held in a ring supplied by the caller, oldest first:
+ * those that the kernel may still reference, then those that have
+ * not been fully submitted. */
+typedef struct fp_sender_t {
+  /** The pool to which fragments are released. */
+  fp_pool_t pool;
+
+  /** The descriptor to which data is written. */
+  int fd;
+
+  /** Zero or one of #FP_SEND_ZEROCOPY and #FP_SEND_VMSPLICE. */
+  unsigned int flags;
+
+  /** The ring of queued fragments. */
+  struct fp_send_entry_t* entry;
+
+  /** The number of elements in @c entry. */
+  unsigned int capacity;
+
+  /** The index of the oldest queued fragment. */
+  unsigned int head;
+
+  /** The number of queued fragments. */
+  unsigned int count;
+
+  /** The number of queued fragments that have been fully submitted. */
+  unsigned int submitted;
+
+  /** The number of octets of the first unsubmitted fragment that
+   * have been submitted. */
+  fp_size_t offset;
+
+  /** The total number of octets submitted. */
+  unsigned long octets;
+
+  /** The sequence number of the next zero-copy send. */
+  uint32_t next_send;
+
+  /** The number of zero-copy sends known to be complete. */
+  uint32_t completed;
+} *fp_sender_t;
+
+/** Initialize a sender.
+ *
+ * @param tx the sender state
+ *
+ * @param pool the pool to which transmitted fragments are released
+ *
+ * @param fd the descriptor to which data is written
+ *
+ * @param entry storage for the queue of fragments
+ *
+ * @param capacity the number of elements in @p entry
+ *
+ * @param flags zero to use writev(2), or one of #FP_SEND_ZEROCOPY
+ * and #FP_SEND_VMSPLICE
+ *
+ * @return zero on success, or -1 with @c errno set if zero-copy
+ * transmission could not be enabled on @p fd. */
+int fp_sender_init (fp_sender_t tx,
+                    fp_pool_t pool,
+                    int fd,
+                    struct fp_send_entry_t* entry,
+                    unsigned int capacity,
+                    unsigned int flags);
+
+/** Queue an allocated fragment for transmission.
+ *
+ * On success the sender owns the fragment and will release it.
+ *
+ * @param tx the sender state
+ *
+ * @param bp the start of the fragment
+ *
+ * @param length the number of octets to transmit from @p bp
+ *
+ * @return zero on success, or -1 with @c errno set to @c ENOBUFS if
+ * the queue is full. */
+int fp_send_queue (fp_sender_t tx,
+                   uint8_t* bp,
+                   fp_size_t length);
+
+/** Queue the data of a chain for transmission.
+ *
+ * The chain is trimmed, its links are queued in order, and it is left
+ * empty.  Either all links are queued or none are.
+ *
+ * @param tx the sender state
+ *
+ * @param chain the chain holding the data
+ *
+ * @return zero on success, or -1 with @c errno set to @c ENOBUFS if
+ * the queue cannot hold every link. */
+int fp_send_chain (fp_sender_t tx,
+                   fp_chain_t chain);
+
+/** Submit queued data to the kernel.
+ *
+ * As much queued data as the descriptor accepts is submitted in one
+ * system call, then fragments the kernel no longer references are
+ * released.
+ *
+ * @param tx the sender state
+ *
+ * @return the number of octets submitted, which is zero if nothing
+ * was queued; or -1 with @c errno set, for example to @c EAGAIN if a
+ * non-blocking descriptor is full. */
+ssize_t fp_send (fp_sender_t tx);
+
+/** Release fragments the kernel no longer references.
+ *
+ * With #FP_SEND_ZEROCOPY this reads all pending completions from the
+ * socket error queue.  It is invoked by fp_send(), and should also be
+ * invoked when poll(2) reports @c POLLERR on the socket or a pipe
+ * reader has made progress.
+ *
+ * @param tx the sender state
+ *
+ * @return the number of fragments released. */
+unsigned int fp_send_reclaim (fp_sender_t tx);
+
+/** Discard data that has not been submitted.
+ *
+ * Fragments none of which has been submitted are released, a
+ * partially submitted fragment is truncated to what was submitted,
+ * and fp_send_reclaim() is invoked.  Fragments the kernel may still
+ * reference remain queued.
+ *
+ * @param tx the sender state
+ *
+ * @return the number of fragments still queued; fp_send_reclaim()
+ * must be invoked until this is zero before @p tx is discarded. */
+unsigned int fp_sender_discard (fp_sender_t tx);
+
+/** Flag for fp_pool_map() to use pages from the hugetlb pool.  The
+ * mapping fails unless enough huge pages are reserved. */
+#define FP_MAP_HUGETLB 0x01
+
+/** Flag for fp_pool_map() to align the pool to the huge page size and
+ * advise the kernel to back it with transparent huge pages. */
+#define FP_MAP_THP 0x02
+
+/** Flag for fp_pool_map() to back the pool with a memfd, which other
+ * processes may map. */
+#define FP_MAP_MEMFD 0x04
+
+/** Flag for fp_pool_map() to fault in every page of the pool before
+ * it is returned. */
+#define FP_MAP_PREFAULT 0x08
+
+/** Flag for fp_pool_map() to lock the pool into memory.  This is
+ * subject to @c RLIMIT_MEMLOCK. */
+#define FP_MAP_MLOCK 0x10
+
+/** Construct a pool over memory obtained from mmap(2).
+ *
+ * The pool structure and its fragment array are allocated together
+ * with calloc(3), the memory is mapped as requested by @p flags, and
+ * the pool is reset.  Huge pages require a pool size wider than the
+ * default, such as <tt>SIZE_BITS=32</tt>.
+ *
+ * @param size the minimum length of the pool memory.  This is rounded
+ * up to a multiple of the huge page size if #FP_MAP_HUGETLB or
+ * #FP_MAP_THP is set, and of the page size otherwise.
+ *
+ * @param fragment_count the number of fragment slots
+ *
+ * @param alignment the pool alignment, a power of two
+ *
+ * @param flags a combination of #FP_MAP_HUGETLB, #FP_MAP_THP,
+ * #FP_MAP_MEMFD, #FP_MAP_PREFAULT, and #FP_MAP_MLOCK
+ *
+ * @param memfdp where to store the memfd backing the pool, which
+ * the caller must close, if #FP_MAP_MEMFD is set.  If this is null
+ * the memfd is closed once the pool is mapped.
+ *
+ * @return the pool, or a null pointer with @c errno set.  @c EINVAL
+ * indicates the rounded size exceeds #FP_MAX_FRAGMENT_SIZE, the
+ * alignment is not a power of two, or the fragment count is zero or,
+ * with #FRAGPOOL_WITH_SIZE_INDEX, not less than #FP_MAX_COUNT. */
+fp_pool_t fp_pool_map (size_t size,
+                       fp_count_t fragment_count,
+                       fp_alignment_t alignment,
+                       unsigned int flags,
+                       int* memfdp);
+
+/** Destroy a pool constructed by fp_pool_map().
+ *
+ * @param pool the pool, which must not be used afterwards */
+void fp_pool_unmap (fp_pool_t pool);
+
+/** State for returning the memory of available fragments to the
+ * kernel.
+ *
+ * Only whole pages within an available fragment are trimmed.  Each
+ * trimmed page is recorded so it is not advised again until fp_trim()
+ * finds, with mincore(2), that it has been faulted back in.  Pages
+ * given @c MADV_FREE may remain resident until the kernel needs them,
+ * so with that advice a page is instead assumed to be faulted back in
+ * when fp_trim() finds it within an allocated fragment. */
+typedef struct fp_trimmer_t {
+  /** The pool whose memory is trimmed. */
+  fp_pool_t pool;
+
+  /** The advice passed to madvise(2): @c MADV_DONTNEED or @c
+   * MADV_FREE for private memory, @c MADV_REMOVE for memory shared
+   * through a memfd. */
+  int advice;
+
+  /** The minimum length of an available fragment to be trimmed. */
+  fp_size_t min_length;
+
+  /** The longest available fragment at which fp_trim() is invoked
+   * from the notification hook. */
+  fp_size_t threshold;
+
+  /** The page size. */
+  size_t page_size;
+
+  /** The address of the first page that overlaps the pool. */
+  uint8_t* base;
+
+  /** One bit per page from @c base, set if the page is trimmed. */
+  unsigned long* trimmed;
+
+  /** One octet per page from @c base, for mincore(2). */
+  unsigned char* residency;
+
+  /** The number of pages now trimmed. */
+  unsigned long trimmed_pages;
+
+  /** The total number of pages trimmed. */
+  unsigned long pages_trimmed;
+
+  /** The number of trimmed pages later found allocated, each of which
+   * cost a page fault to restore. */
+  unsigned long pages_refaulted;
+
+  /** The number of madvise(2) calls made. */
+  unsigned long advise_calls;
+
+#if (FRAGPOOL_WITH_NOTIFY) || defined(FP_DOXYGEN)
+  /** The hook registered by fp_trimmer_attach(). */
+  struct fp_notify_t notify;
+
+  /** The hook it replaced, which it invokes. */
+  const struct fp_notify_t* chained;
+#endif /* FRAGPOOL_WITH_NOTIFY */
+} *fp_trimmer_t;
+
+/** Initialize a trimmer.
+ *
+ * @param tr the trimmer state
+ *
+ * @param pool the pool whose memory is trimmed
+ *
+ * @param advice the madvise(2) advice used to trim
+ *
+ * @param min_length the minimum length of an available fragment to
+ * be trimmed; this should be several pages, so fragments that will
+ * soon be reused are not trimmed
+ *
+ * @return zero on success, or -1 with @c errno set if the page record
+ * could not be allocated. */
+int fp_trimmer_init (fp_trimmer_t tr,
+                     fp_pool_t pool,
+                     int advice,
+                     fp_size_t min_length);
+
+/** Trim the pages of long available fragments.
+ *
+ * The pool lock is held while the fragments are examined and
+ * advised, so an available fragment cannot be allocated while it is
+ * trimmed.
+ *
+ * @param tr the trimmer state
+ *
+ * @return the number of pages trimmed by this call. */
+unsigned long fp_trim (fp_trimmer_t tr);
+
+/** Count the pages of the pool that are resident.
+ *
+ * @param tr the trimmer state
+ *
+ * @return the number of resident pages, as reported by mincore(2). */
+unsigned long fp_trimmer_resident (fp_trimmer_t tr);
+
+#if (FRAGPOOL_WITH_NOTIFY) || defined(FP_DOXYGEN)
+/** Invoke fp_trim() whenever a release forms an available fragment of
+ * at least @p threshold octets.
+ *
+ * The trimmer replaces the notification hook of the pool and invokes
+ * the hook it replaced, so it should be attached after other hooks
+ * such as fp_eventfd_attach().  This must not be invoked while the
+ * pool is in use by other threads.
+ *
+ * @param tr the trimmer state
+ *
+ * @param threshold the length of the longest available fragment at
+ * which to trim */
+void fp_trimmer_attach (fp_trimmer_t tr,
+                        fp_size_t threshold);
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+/** Release the resources of a trimmer.
+ *
+ * If it is attached to the pool its hook is replaced by the one it
+ * chained to.  Trimmed pages are not restored; they fault back in
+ * when used.
+ *
+ * @param tr the trimmer state */
+void fp_trimmer_destroy (fp_trimmer_t tr);
+
+#endif /* FRAGPOOL_LINUX_H_ */
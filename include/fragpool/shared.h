@@ -0,0 +1,238 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FRAGPOOL_SHARED_H_
+#define FRAGPOOL_SHARED_H_
+
+/** @file
+ *
+ * @brief Header providing pools shared between processes.
+ *
+ * A shared pool lives in a memory segment, such as a memfd or POSIX
+ * shared memory object, that several processes map, each at whatever
+ * address the kernel chooses.  The segment holds a process-shared
+ * mutex, the pool memory, and the fragment slots with each fragment
+ * start stored as an offset into the pool memory.
+ *
+ * Each process attaches to the segment with fp_shared_attach(), which
+ * provides an ordinary pool for use with fp_request(), fp_release()
+ * and the other pool functions.  Its lock hooks acquire the mutex and,
+ * if another process has changed the slots since this one last held
+ * it, convert them to addresses in this process; on release, changes
+ * are stored back as offsets.  A fragment is passed to another
+ * process as its offset, from fp_shared_offset(), and that process
+ * recovers its address with fp_shared_pointer() and may release it:
+ @verbatim
+ producer:                              consumer:
+ bp = fp_request(sh.pool, ...);
+ fill(bp);
+ send(fp_shared_offset(&sh, bp));  -->  bp = fp_shared_pointer(&sh, offset);
+                                        consume(bp);
+                                        fp_release(sh.pool, bp);
+ @endverbatim
+ *
+ * Every process must use a library built with the same options.
+ * Notification hooks, statistics and traces of each process's pool
+ * cover only the operations of that process.  A shared pool is
+ * never compacted: fp_compact() in one process could not see the
+ * copies fp_reallocate() makes in another, nor update the addresses
+ * other processes hold, so it moves nothing.  A process that dies
+ * while holding the mutex may leave the slots inconsistent, which
+ * fp_validate() will report.
+ *
+ * The shared pool requires a library built with #FRAGPOOL_WITH_LOCK
+ * and without #FRAGPOOL_WITH_SIZE_INDEX, is implemented with POSIX
+ * threads, and is included only in native builds.
+ *
+ * @homepage http://github.com/pabigot/fragpool
+ * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
+ */
+
+#include <fragpool/fragpool.h>
+#include <pthread.h>
+#include <stddef.h>
+
+#if ((FRAGPOOL_WITH_LOCK) && ! (FRAGPOOL_WITH_SIZE_INDEX)) || defined(FP_DOXYGEN)
+
+/** The value of fp_shared_header_t::magic in a formatted segment. */
+#define FP_SHARED_MAGIC 0x66705348
+
+/** A fragment slot as stored in a shared segment. */
+struct fp_shared_fragment_t {
+  /** Offset of the fragment start from the start of the pool memory. */
+  fp_size_t offset;
+
+  /** Length of the fragment, as with fp_fragment_t::length. */
+  fp_ssize_t length;
+
+#if (FRAGPOOL_WITH_HANDLES) || defined(FP_DOXYGEN)
+  /** Generation of the fragment. */
+  fp_generation_t generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
+};
+
+/** The start of a shared segment.  The pool memory follows the
+ * fragment slots, at @c data_offset. */
+typedef struct fp_shared_header_t {
+  /** #FP_SHARED_MAGIC */
+  uint32_t magic;
+
+  /** The size of a slot, which differs between incompatible
+   * library configurations. */
+  uint16_t slot_size;
+
+  /** The pool alignment. */
+  fp_alignment_t alignment;
+
+  /** The number of fragment slots. */
+  fp_count_t fragment_count;
+
+  /** The number of active slots. */
+  fp_count_t active;
+
+  /** Incremented each time a process changes the slots. */
+  uint32_t version;
+
+#if (FRAGPOOL_WITH_HANDLES) || defined(FP_DOXYGEN)
+  /** The generation of the most recently allocated fragment. */
+  fp_generation_t generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
+
+  /** The offset of the pool memory from the start of the segment. */
+  size_t data_offset;
+
+  /** The length of the pool memory. */
+  fp_size_t data_size;
+
+  /** Serializes access to the slots.  This is process-shared and
+   * robust. */
+  pthread_mutex_t mutex;
+
+  /** The fragment slots. */
+  struct fp_shared_fragment_t fragment[];
+} *fp_shared_header_t;
+
+/** A process's attachment to a shared segment.
+ *
+ * The structure is initialized by fp_shared_attach() and must remain
+ * valid until fp_shared_detach() is invoked. */
+typedef struct fp_shared_t {
+  /** The hooks registered as the lock of @c pool. */
+  struct fp_lock_t lock;
+
+  /** The segment in this process. */
+  fp_shared_header_t header;
+
+  /** The value of fp_shared_header_t::version when this process last
+   * held the mutex. */
+  uint32_t version;
+
+  /** The number of active slots when this process last held the
+   * mutex. */
+  fp_count_t active;
+
+  /** The pool through which this process uses the segment. */
+  fp_pool_t pool;
+} *fp_shared_t;
+
+/** Calculate the length of a shared segment.
+ *
+ * @param pool_size the length of the pool memory
+ *
+ * @param fragment_count the number of fragment slots
+ *
+ * @param alignment the pool alignment
+ *
+ * @return the number of octets required for the segment. */
+size_t fp_shared_size (fp_size_t pool_size,
+                       fp_count_t fragment_count,
+                       fp_alignment_t alignment);
+
+/** Format a segment as a shared pool with every fragment available.
+ *
+ * This must be done once, before any process attaches.
+ *
+ * @param segment the start of the segment, which must be page
+ * aligned and at least fp_shared_size() octets long
+ *
+ * @param pool_size the length of the pool memory
+ *
+ * @param fragment_count the number of fragment slots
+ *
+ * @param alignment the pool alignment, a power of two no greater than
+ * the page size
+ *
+ * @return zero on success, or -1 with @c errno set. */
+int fp_shared_format (void* segment,
+                      fp_size_t pool_size,
+                      fp_count_t fragment_count,
+                      fp_alignment_t alignment);
+
+/** Attach this process to a formatted segment.
+ *
+ * @param sh the attachment state
+ *
+ * @param segment the start of the segment in this process
+ *
+ * @return zero on success, or -1 with @c errno set to @c EINVAL if
+ * the segment was not formatted by a compatible library or its header
+ * does not describe a valid pool, or @c ENOMEM
+ * if the pool could not be allocated. */
+int fp_shared_attach (fp_shared_t sh,
+                      void* segment);
+
+/** Return the offset of an address in the pool memory.
+ *
+ * @param sh the attachment state
+ *
+ * @param bp an address in the pool memory in this process */
+fp_size_t fp_shared_offset (fp_shared_t sh,
+                            const uint8_t* bp);
+
+/** Return the address of an offset in the pool memory.
+ *
+ * @param sh the attachment state
+ *
+ * @param offset an offset from fp_shared_offset() in any process */
+uint8_t* fp_shared_pointer (fp_shared_t sh,
+                            fp_size_t offset);
+
+/** Detach this process from a shared segment.
+ *
+ * The pool is freed; fragments allocated through it remain allocated
+ * in the segment.  The segment is not unmapped.
+ *
+ * @param sh the attachment state */
+void fp_shared_detach (fp_shared_t sh);
+
+#endif /* FRAGPOOL_WITH_LOCK && ! FRAGPOOL_WITH_SIZE_INDEX */
+
+#endif /* FRAGPOOL_SHARED_H_ */
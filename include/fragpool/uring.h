@@ -0,0 +1,197 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FRAGPOOL_URING_H_
+#define FRAGPOOL_URING_H_
+
+/** @file
+ *
+ * @brief Header providing io_uring support for fragment pools.
+ *
+ * The library includes these functions only when built natively on
+ * Linux.  They work with an io_uring instance created by the
+ * application, with liburing or otherwise, and require a kernel that
+ * supports provided-buffer rings (5.19 or later).
+ *
+ * A provided-buffer ring lets the kernel pick a buffer when a receive
+ * completes instead of when it is submitted.  The ring managed here
+ * is filled with fragments from fp_request() of up to a maximum
+ * length.  When a completion selects a fragment, fp_uring_take()
+ * trims it to the received length, so the rest is immediately
+ * available to the pool, and passes it to the application, which
+ * releases it with fp_release() when done.  fp_uring_refill() then
+ * replaces the fragments taken from the ring:
+ @verbatim
+ sqe->flags |= IOSQE_BUFFER_SELECT;
+ sqe->buf_group = bufs.bgid;
+ ...
+ bp = fp_uring_take(&bufs, cqe->flags, cqe->res, &bpe);
+ if (NULL != bp) {
+   consume(bp, bpe - bp);
+   fp_release(pool, bp);
+ }
+ fp_uring_refill(&bufs);
+ @endverbatim
+ *
+ * If the pool cannot supply a fragment the ring may run empty, in
+ * which case receives complete with @c -ENOBUFS until fragments are
+ * released and the ring is refilled.
+ *
+ * @homepage http://github.com/pabigot/fragpool
+ * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
+ */
+
+#include <fragpool/fragpool.h>
+
+struct io_uring_buf_ring;
+
+/** State for a provided-buffer ring of pool fragments.
+ *
+ * The structure is initialized by fp_uring_setup() and must remain
+ * valid until fp_uring_teardown() is invoked.  It is not thread-safe:
+ * completions for the ring should be processed by one thread. */
+typedef struct fp_uring_bufs_t {
+  /** The pool from which fragments are allocated. */
+  fp_pool_t pool;
+
+  /** The io_uring descriptor with which the ring is registered. */
+  int ring_fd;
+
+  /** The buffer group ID used to select from the ring. */
+  uint16_t bgid;
+
+  /** The number of entries in the ring, a power of two. */
+  unsigned int entries;
+
+  /** The next tail of the ring. */
+  uint16_t tail;
+
+  /** The number of fragments in the ring. */
+  unsigned int count;
+
+  /** The minimum length of a fragment placed in the ring. */
+  fp_size_t min_size;
+
+  /** The maximum length of a fragment placed in the ring. */
+  fp_size_t max_size;
+
+  /** The start of the fragment given each buffer ID, or a null
+   * pointer if the ID is not in use. */
+  uint8_t** start;
+
+  /** The ring shared with the kernel. */
+  struct io_uring_buf_ring* br;
+} *fp_uring_bufs_t;
+
+/** Register the memory of a pool as fixed buffer zero of an io_uring.
+ *
+ * Fragments may then be transmitted or filled with
+ * IORING_OP_WRITE_FIXED and IORING_OP_READ_FIXED without the kernel
+ * mapping their pages for each operation.  The pages are pinned, and
+ * count against @c RLIMIT_MEMLOCK.  This fails with @c EBUSY if the
+ * ring already has fixed buffers.
+ *
+ * @param ring_fd the io_uring descriptor
+ *
+ * @param pool the pool to be registered
+ *
+ * @return zero on success, or -1 with @c errno set. */
+int fp_uring_register_pool (int ring_fd,
+                            fp_pool_t pool);
+
+/** Create a provided-buffer ring, register it, and fill it.
+ *
+ * @param bufs the ring state
+ *
+ * @param pool the pool from which fragments are allocated
+ *
+ * @param ring_fd the io_uring descriptor
+ *
+ * @param bgid the buffer group ID for the ring
+ *
+ * @param entries the number of entries in the ring, a power of two
+ * no greater than 32768
+ *
+ * @param start storage for @p entries fragment addresses
+ *
+ * @param min_size the minimum length of a fragment to place in the
+ * ring
+ *
+ * @param max_size the maximum length of a fragment to place in the
+ * ring, normally the largest message to be received
+ *
+ * @return zero on success, or -1 with @c errno set if the ring could
+ * not be created or registered. */
+int fp_uring_setup (fp_uring_bufs_t bufs,
+                    fp_pool_t pool,
+                    int ring_fd,
+                    uint16_t bgid,
+                    unsigned int entries,
+                    uint8_t** start,
+                    fp_size_t min_size,
+                    fp_size_t max_size);
+
+/** Place fragments from the pool into every unused ring entry.
+ *
+ * @param bufs the ring state
+ *
+ * @return the number of fragments placed in the ring.  This stops at
+ * the first request the pool cannot satisfy. */
+unsigned int fp_uring_refill (fp_uring_bufs_t bufs);
+
+/** Take the fragment selected by a completion.
+ *
+ * @param bufs the ring state
+ *
+ * @param cqe_flags the @c flags of the completion
+ *
+ * @param res the @c res of the completion
+ *
+ * @param fragment_endp where to store the end of the fragment
+ *
+ * @return the start of the fragment, which the caller must release
+ * with fp_release(), trimmed to the @p res octets received; or a null
+ * pointer if the completion did not select a buffer or received no
+ * data, in which case any selected fragment has been released. */
+uint8_t* fp_uring_take (fp_uring_bufs_t bufs,
+                        uint32_t cqe_flags,
+                        int32_t res,
+                        uint8_t** fragment_endp);
+
+/** Unregister and destroy a provided-buffer ring.
+ *
+ * Fragments remaining in the ring are released.  No operation that
+ * may select from the ring may be in flight.
+ *
+ * @param bufs the ring state */
+void fp_uring_teardown (fp_uring_bufs_t bufs);
+
+#endif /* FRAGPOOL_URING_H_ */
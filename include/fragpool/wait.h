@@ -0,0 +1,143 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FRAGPOOL_WAIT_H_
+#define FRAGPOOL_WAIT_H_
+
+/** @file
+ *
+ * @brief Header providing blocking allocation from fragment pools.
+ *
+ * A wait queue lets threads that cannot obtain a fragment block until
+ * one is available, instead of retrying fp_request().  Waiters are
+ * served strictly in arrival order: each time memory returned to the
+ * pool increases the longest available fragment the queue allocates
+ * on behalf of the oldest waiter, then the next, stopping at the first
+ * waiter whose minimum size cannot be met.  Only waiters that have
+ * been given a fragment are woken, and a large request cannot be
+ * starved by a stream of small ones that arrive after it.  Callers
+ * that use fp_request() directly are not queued, and may still obtain
+ * space ahead of the waiters.
+ *
+ * The queue is implemented with POSIX threads, requires a library
+ * built with #FRAGPOOL_WITH_NOTIFY, and should be used with a pool
+ * built with #FRAGPOOL_WITH_LOCK that has lock hooks.  The library
+ * includes these functions only in native builds.
+ *
+ * @homepage http://github.com/pabigot/fragpool
+ * @copyright Copyright 2012-2017, Peter A. Bigot.  Licensed under <a href="http://www.opensource.org/licenses/BSD-3-Clause">BSD-3-Clause</a>
+ */
+
+#include <fragpool/fragpool.h>
+#include <pthread.h>
+#include <time.h>
+
+#if (FRAGPOOL_WITH_NOTIFY) || defined(FP_DOXYGEN)
+
+/* Bookkeeping for a blocked request, private to the implementation. */
+struct fp_waiter_t;
+
+/** Bookkeeping for the requests waiting on a pool.
+ *
+ * The structure is filled in by fp_wait_queue_init() and must remain
+ * valid until fp_wait_queue_destroy() is invoked. */
+typedef struct fp_wait_queue_t {
+  /** The hook registered with the pool. */
+  struct fp_notify_t notify;
+
+  /** The pool from which waiters are served. */
+  fp_pool_t pool;
+
+  /** Protects the queue. */
+  pthread_mutex_t mutex;
+
+  /** The oldest waiter, or a null pointer. */
+  struct fp_waiter_t* head;
+
+  /** The newest waiter, or a null pointer. */
+  struct fp_waiter_t* tail;
+} *fp_wait_queue_t;
+
+/** Initialize a wait queue and register it as the notification hook
+ * of a pool.
+ *
+ * This replaces any hook previously registered with the pool, and
+ * must not be invoked while the pool is in use by other threads.
+ *
+ * @param wq the queue to be initialized
+ *
+ * @param pool the pool from which waiters will be served
+ *
+ * @return zero on success, or an error code from pthread_mutex_init()
+ */
+int fp_wait_queue_init (fp_wait_queue_t wq,
+                        fp_pool_t pool);
+
+/** Remove the notification hook from the pool and release the
+ * resources of a wait queue, which must have no waiters.
+ *
+ * @param wq the queue to be destroyed */
+void fp_wait_queue_destroy (fp_wait_queue_t wq);
+
+/** Determine the number of requests waiting in the queue.
+ *
+ * @param wq the queue to be inspected */
+unsigned int fp_wait_queue_length (fp_wait_queue_t wq);
+
+/** Obtain a block of memory from a pool, waiting if necessary.
+ *
+ * The request is satisfied immediately if no other request is waiting
+ * and fp_request() succeeds.  Otherwise it is queued behind the
+ * existing waiters.
+ *
+ * @param wq the queue of the pool from which memory is obtained
+ *
+ * @param min_size as with fp_request()
+ *
+ * @param max_size as with fp_request()
+ *
+ * @param fragment_endp as with fp_request()
+ *
+ * @param abstime the time, on @c CLOCK_MONOTONIC, at which to give up
+ * waiting, or a null pointer to wait indefinitely
+ *
+ * @return a pointer to the start of the returned region, or a null
+ * pointer if the arguments are invalid or the request could not be
+ * satisfied before @p abstime. */
+uint8_t* fp_request_wait (fp_wait_queue_t wq,
+                          fp_size_t min_size,
+                          fp_size_t max_size,
+                          uint8_t** fragment_endp,
+                          const struct timespec* abstime);
+
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+#endif /* FRAGPOOL_WAIT_H_ */
@@ -0,0 +1,168 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <fragpool/chain.h>
+
+void
+fp_chain_init (fp_chain_t c,
+               struct fp_link_t* links,
+               unsigned int capacity)
+{
+  c->link = links;
+  c->capacity = capacity;
+  c->count = 0;
+  c->length = 0;
+}
+
+unsigned long
+fp_chain_space (const struct fp_chain_t* c)
+{
+  unsigned long space = 0;
+  unsigned int i;
+
+  for (i = 0; i < c->count; ++i) {
+    space += c->link[i].end - c->link[i].start;
+  }
+  return space;
+}
+
+fp_link_t
+fp_chain_append (fp_pool_t p,
+                 fp_chain_t c,
+                 fp_size_t min_size,
+                 fp_size_t max_size)
+{
+  fp_link_t lp;
+
+  if (c->count >= c->capacity) {
+    return NULL;
+  }
+  lp = c->link + c->count;
+  lp->start = fp_request(p, min_size, max_size, &lp->end);
+  if (NULL == lp->start) {
+    return NULL;
+  }
+  ++c->count;
+  return lp;
+}
+
+int
+fp_chain_request (fp_pool_t p,
+                  fp_chain_t c,
+                  unsigned long size,
+                  fp_size_t link_min_size)
+{
+  const unsigned int first = c->count;
+  unsigned long space = fp_chain_space(c);
+
+  if (0 == link_min_size) {
+    return FP_EINVAL;
+  }
+  while (space < size) {
+    unsigned long need = size - space;
+    fp_size_t max_size = (need < FP_MAX_FRAGMENT_SIZE) ? (fp_size_t)need : FP_MAX_FRAGMENT_SIZE;
+    fp_size_t min_size = (max_size < link_min_size) ? max_size : link_min_size;
+    fp_link_t lp = fp_chain_append(p, c, min_size, max_size);
+
+    if (NULL == lp) {
+      /* Undo the partial chain, most recent first */
+      while (c->count > first) {
+        fp_release(p, c->link[--c->count].start);
+      }
+      return FP_ENOMEM;
+    }
+    space += lp->end - lp->start;
+  }
+  return 0;
+}
+
+uint8_t*
+fp_chain_segment (const struct fp_chain_t* c,
+                  unsigned long offset,
+                  fp_size_t* lengthp)
+{
+  unsigned long remaining;
+  unsigned int i;
+
+  if (offset >= c->length) {
+    return NULL;
+  }
+  remaining = c->length - offset;
+  for (i = 0; i < c->count; ++i) {
+    const struct fp_link_t* lp = c->link + i;
+    fp_size_t len = lp->end - lp->start;
+
+    if (offset < len) {
+      len -= offset;
+      *lengthp = (remaining < len) ? (fp_size_t)remaining : len;
+      return lp->start + offset;
+    }
+    offset -= len;
+  }
+  return NULL;
+}
+
+int
+fp_chain_trim (fp_pool_t p,
+               fp_chain_t c)
+{
+  unsigned long remaining = c->length;
+  unsigned int used = 0;
+  int rv = 0;
+
+  while ((used < c->count) && (0 < remaining)) {
+    fp_link_t lp = c->link + used++;
+    fp_size_t len = lp->end - lp->start;
+
+    if (remaining < len) {
+      if (NULL == fp_resize(p, lp->start, remaining, &lp->end)) {
+        rv = FP_EINVAL;
+      }
+      len = remaining;
+    }
+    remaining -= len;
+  }
+  while (c->count > used) {
+    if (0 != fp_release(p, c->link[--c->count].start)) {
+      rv = FP_EINVAL;
+    }
+  }
+  return rv;
+}
+
+int
+fp_chain_release (fp_pool_t p,
+                  fp_chain_t c)
+{
+  c->length = 0;
+  return fp_chain_trim(p, c);
+}
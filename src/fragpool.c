@@ -29,6 +29,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fragpool/fragpool.h>
@@ -59,7 +60,7 @@ static inline
 fp_ssize_t align_size_up (fp_pool_t p,
                           fp_ssize_t s)
 {
-  fp_size_t us = abs(s);
+  fp_size_t us = (0 > s) ? -s : s;
   us = (us + p->pool_alignment - 1) & ~(fp_size_t)(p->pool_alignment - 1);
   return (0 > s) ? -us : us;
 }
@@ -68,24 +69,347 @@ static inline
 fp_ssize_t align_size_down (fp_pool_t p,
                             fp_ssize_t s)
 {
-  fp_size_t us = abs(s);
+  fp_size_t us = (0 > s) ? -s : s;
   us &= ~(fp_size_t)(p->pool_alignment - 1);
   return (0 > s) ? -us : us;
 }
 
-/** Find the fragment that starts at bp.  bp must be a non-null
- * pointer within the pool. */
+#if FRAGPOOL_WITH_SIZE_INDEX
+
+/* Sizes and class maps are manipulated in the narrowest native word
+ * that holds them. */
+#if (16 < FRAGPOOL_SIZE_BITS) && (UINT_MAX < UINT32_MAX)
+typedef unsigned long index_word_t;
+#define INDEX_CLZ __builtin_clzl
+#define INDEX_CTZ __builtin_ctzl
+#else /* FRAGPOOL_SIZE_BITS */
+typedef unsigned int index_word_t;
+#define INDEX_CLZ __builtin_clz
+#define INDEX_CTZ __builtin_ctz
+#endif /* FRAGPOOL_SIZE_BITS */
+
+/** Return the size class of an available fragment of length s, being
+ * the index of the most significant set bit of s. */
+static inline
+unsigned int size_class (index_word_t s)
+{
+#if defined(__GNUC__)
+  return (8 * sizeof(index_word_t) - 1) - INDEX_CLZ(s);
+#else /* __GNUC__ */
+  unsigned int sc = 0;
+  while (s >>= 1) {
+    ++sc;
+  }
+  return sc;
+#endif /* __GNUC__ */
+}
+
+/** Return the lowest class present in a non-empty class map. */
+static inline
+unsigned int map_lowest_class (index_word_t m)
+{
+#if defined(__GNUC__)
+  return INDEX_CTZ(m);
+#else /* __GNUC__ */
+  unsigned int sc = 0;
+  while (! (m & 1)) {
+    m >>= 1;
+    ++sc;
+  }
+  return sc;
+#endif /* __GNUC__ */
+}
+
+/** Add an available fragment to the list for its size class. */
+static void
+index_insert (fp_pool_t p,
+              fp_fragment_t f)
+{
+  unsigned int sc = size_class(f->length);
+  fp_count_t fi = f - p->fragment;
+  fp_count_t hi = p->size_class_head[sc];
+
+  f->size_class_prev = FP_NO_SLOT;
+  f->size_class_next = hi;
+  if (FP_NO_SLOT != hi) {
+    p->fragment[hi].size_class_prev = fi;
+  }
+  p->size_class_head[sc] = fi;
+  p->size_class_map |= (fp_size_class_map_t)1 << sc;
+}
+
+/** Remove an available fragment from the list for its size class.
+ * This must be done before the fragment length is changed. */
+static void
+index_remove (fp_pool_t p,
+              fp_fragment_t f)
+{
+  unsigned int sc = size_class(f->length);
+
+  if (FP_NO_SLOT == f->size_class_prev) {
+    p->size_class_head[sc] = f->size_class_next;
+    if (FP_NO_SLOT == f->size_class_next) {
+      p->size_class_map &= ~((fp_size_class_map_t)1 << sc);
+    }
+  } else {
+    p->fragment[f->size_class_prev].size_class_next = f->size_class_next;
+  }
+  if (FP_NO_SLOT != f->size_class_next) {
+    p->fragment[f->size_class_next].size_class_prev = f->size_class_prev;
+  }
+}
+
+/** Discard the size index and reconstruct it from the fragment
+ * array.  This is used when the slots have been shifted, which
+ * invalidates every link. */
+static void
+index_rebuild (fp_pool_t p)
+{
+  fp_fragment_t f = p->fragment + p->fragment_count;
+  unsigned int sc;
+
+  for (sc = 0; sc < FP_SIZE_CLASS_COUNT; ++sc) {
+    p->size_class_head[sc] = FP_NO_SLOT;
+  }
+  p->size_class_map = 0;
+  /* Walk backwards so each list is ordered by address */
+  while (p->fragment <= --f) {
+    if (FRAGMENT_IS_AVAILABLE(f)) {
+      index_insert(p, f);
+    }
+  }
+}
+
+/** Find the best fragment in size class sc.  If at_least is nonzero
+ * this is the shortest fragment that is at least max_size; otherwise
+ * it is the longest fragment.  Ties go to the lowest address.
+ * Fragments in [xs, xe] are ignored. */
+static fp_fragment_t
+index_scan_class (fp_pool_t p,
+                  unsigned int sc,
+                  int at_least,
+                  fp_ssize_t max_size,
+                  fp_fragment_t xs,
+                  fp_fragment_t xe)
+{
+  fp_count_t fi = p->size_class_head[sc];
+  fp_fragment_t bf = NULL;
+
+  while (FP_NO_SLOT != fi) {
+    fp_fragment_t f = p->fragment + fi;
+
+    fi = f->size_class_next;
+    if ((xs <= f) && (f <= xe)) {
+      continue;
+    }
+    if (at_least) {
+      if ((f->length < max_size)
+          || ((NULL != bf)
+              && ((f->length > bf->length)
+                  || ((f->length == bf->length) && (f > bf))))) {
+        continue;
+      }
+    } else if ((NULL != bf)
+               && ((f->length < bf->length)
+                   || ((f->length == bf->length) && (f > bf)))) {
+      continue;
+    }
+    bf = f;
+  }
+  return bf;
+}
+
+/** Locate the best available fragment using the size index.
+ *
+ * This makes the same selection as the linear scan in
+ * find_best_fragment(): the shortest fragment that is at least
+ * max_size if there is one, otherwise the longest fragment provided
+ * it is at least min_size, in either case preferring the lowest
+ * address among fragments of equal length.
+ *
+ * Fragments in [xs, xe] are ignored; pass null pointers if there are
+ * none to ignore. */
+static fp_fragment_t
+index_find_best (fp_pool_t p,
+                 fp_size_t min_size,
+                 fp_size_t max_size,
+                 fp_fragment_t xs,
+                 fp_fragment_t xe)
+{
+  unsigned int msc = size_class(max_size);
+  const index_word_t one = 1;
+  index_word_t map;
+  fp_fragment_t bf;
+
+  /* Classes below msc cannot hold anything as long as max_size; any
+   * fragment in a higher class is longer than max_size. */
+  map = p->size_class_map & ~((one << msc) - 1);
+  while (0 != map) {
+    unsigned int sc = map_lowest_class(map);
+
+    bf = index_scan_class(p, sc, 1, max_size, xs, xe);
+    if (NULL != bf) {
+      return bf;
+    }
+    map &= map - 1;
+  }
+
+  /* Nothing reaches max_size, so take the longest fragment. */
+  map = p->size_class_map & ((one << msc) | ((one << msc) - 1));
+  while (0 != map) {
+    /* The highest class in the map is found like a size class */
+    unsigned int sc = size_class(map);
+
+    bf = index_scan_class(p, sc, 0, max_size, xs, xe);
+    if (NULL != bf) {
+      return ((fp_ssize_t)min_size <= bf->length) ? bf : NULL;
+    }
+    map &= ~(one << sc);
+  }
+  return NULL;
+}
+
+#define INDEX_INSERT(_p, _f) index_insert(_p, _f)
+#define INDEX_REMOVE(_p, _f) index_remove(_p, _f)
+#define INDEX_REBUILD(_p) index_rebuild(_p)
+
+#elif FRAGPOOL_WITH_LENGTH_ARRAY
+
+/* The available length array changes at exactly the points where the
+ * size index would, so it is maintained through the same hooks. */
+
+#define LENGTHS_SET(_p, _f, _v) do {                            \
+    if (NULL != (_p)->available_length) {                       \
+      (_p)->available_length[(_f) - (_p)->fragment] = (_v);     \
+    }                                                           \
+  } while (0)
+
+/** Reconstruct the available length array from the fragment array. */
+static void
+lengths_rebuild (fp_pool_t p)
+{
+  fp_ssize_t* lp = p->available_length;
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+
+  if (NULL != lp) {
+    do {
+      *lp++ = FRAGMENT_IS_AVAILABLE(f) ? f->length : 0;
+    } while (++f < fe);
+  }
+}
+
+#define INDEX_INSERT(_p, _f) LENGTHS_SET(_p, _f, (_f)->length)
+#define INDEX_REMOVE(_p, _f) LENGTHS_SET(_p, _f, 0)
+#define INDEX_REBUILD(_p) lengths_rebuild(_p)
+
+#else /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#define INDEX_INSERT(_p, _f) do { } while (0)
+#define INDEX_REMOVE(_p, _f) do { } while (0)
+#define INDEX_REBUILD(_p) do { } while (0)
+
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#if FRAGPOOL_WITH_LOCK
+
+#define POOL_LOCK(_p) do {                              \
+    if (NULL != (_p)->lock) {                           \
+      (_p)->lock->lock((_p)->lock->context);            \
+    }                                                   \
+  } while (0)
+
+#define POOL_UNLOCK(_p) do {                            \
+    if (NULL != (_p)->lock) {                           \
+      (_p)->lock->unlock((_p)->lock->context);          \
+    }                                                   \
+  } while (0)
+
+/** Remove a completed copy from those in progress. */
+static void
+copy_finished (fp_pool_t p,
+               struct fp_copy_t* cp)
+{
+  struct fp_copy_t** cpp = &p->copying;
+
+  while (cp != *cpp) {
+    cpp = &(*cpp)->next;
+  }
+  *cpp = cp->next;
+}
+
+/** Return nonzero if an allocated fragment starting at bp is the
+ * source or destination of a copy in progress. */
+static int
+copy_in_progress (fp_pool_t p,
+                  const uint8_t* bp)
+{
+  const struct fp_copy_t* cp;
+
+  for (cp = p->copying; NULL != cp; cp = cp->next) {
+    if ((bp == cp->src) || (bp == cp->dst)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Copy data between allocated fragments with the pool unlocked, so
+ * other users of the pool need not wait for the copy.  The copy is
+ * recorded in the pool while it runs, so compaction leaves both
+ * fragments in place. */
+#define COPY_UNLOCKED(_p, _dst, _src, _len) do {        \
+    struct fp_copy_t cp_;                               \
+    cp_.src = (_src);                                   \
+    cp_.dst = (_dst);                                   \
+    cp_.next = (_p)->copying;                           \
+    (_p)->copying = &cp_;                               \
+    POOL_UNLOCK(_p);                                    \
+    memmove(_dst, _src, _len);                          \
+    POOL_LOCK(_p);                                      \
+    copy_finished(_p, &cp_);                            \
+  } while (0)
+
+#define COPY_IN_PROGRESS(_p, _bp) copy_in_progress(_p, _bp)
+
+#else /* FRAGPOOL_WITH_LOCK */
+
+#define POOL_LOCK(_p) do { } while (0)
+#define POOL_UNLOCK(_p) do { } while (0)
+#define COPY_UNLOCKED(_p, _dst, _src, _len) memmove(_dst, _src, _len)
+#define COPY_IN_PROGRESS(_p, _bp) 0
+
+#endif /* FRAGPOOL_WITH_LOCK */
+
+/** Find the active fragment that starts at bp.
+ *
+ * Active fragments partition the pool in address order and all
+ * inactive fragments follow them, so this is a binary search in
+ * which inactive fragments compare above any address.
+ *
+ * @return the fragment, or a null pointer if no active fragment
+ * starts at bp. */
 static fp_fragment_t
 get_fragment (fp_pool_t p,
               const uint8_t* bp)
 {
   fp_fragment_t f = p->fragment;
-  fp_fragment_t fe = f + p->fragment_count;
-  do {
-    if (f->start == bp) {
-      return f;
+  fp_count_t n = p->fragment_count;
+  const uintptr_t bi = (uintptr_t)bp;
+
+  while (0 < n) {
+    fp_count_t half = n / 2;
+    fp_fragment_t mf = f + half;
+
+    if (FRAGMENT_IS_INACTIVE(mf) || (bi < (uintptr_t)FP_FRAGMENT_START(p, mf))) {
+      n = half;
+    } else if (bi > (uintptr_t)FP_FRAGMENT_START(p, mf)) {
+      f = mf + 1;
+      n -= half + 1;
+    } else {
+      return mf;
     }
-  } while ((++f < fe) && (NULL != f->start));
+  }
   return NULL;
 }
 
@@ -99,6 +423,210 @@ get_fragment (fp_pool_t p,
    || (((_new_len) < (_cur_len))                        \
        && ((_new_len) >= (_max_size))))
 
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+
+/* Vector operations on available lengths, for the widest instruction
+ * set the library is compiled for.  LV_SELECT(m, a, b) takes lanes of
+ * a where m is set and lanes of b elsewhere. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+typedef __m256i lvec_t;
+#define LV_LOADU(_lp) _mm256_loadu_si256((const lvec_t*)(_lp))
+#define LV_STOREU(_lp, _v) _mm256_storeu_si256((lvec_t*)(_lp), _v)
+#define LV_OR(_a, _b) _mm256_or_si256(_a, _b)
+#define LV_SELECT(_m, _a, _b) _mm256_blendv_epi8(_b, _a, _m)
+#define LV_MOVEMASK(_v) (unsigned int)_mm256_movemask_epi8(_v)
+#if 16 == FRAGPOOL_SIZE_BITS
+#define LV_SET1(_x) _mm256_set1_epi16(_x)
+#define LV_CMPGT(_a, _b) _mm256_cmpgt_epi16(_a, _b)
+#define LV_CMPEQ(_a, _b) _mm256_cmpeq_epi16(_a, _b)
+#define LV_MIN(_a, _b) _mm256_min_epi16(_a, _b)
+#define LV_MAX(_a, _b) _mm256_max_epi16(_a, _b)
+#else /* FRAGPOOL_SIZE_BITS */
+#define LV_SET1(_x) _mm256_set1_epi32(_x)
+#define LV_CMPGT(_a, _b) _mm256_cmpgt_epi32(_a, _b)
+#define LV_CMPEQ(_a, _b) _mm256_cmpeq_epi32(_a, _b)
+#define LV_MIN(_a, _b) _mm256_min_epi32(_a, _b)
+#define LV_MAX(_a, _b) _mm256_max_epi32(_a, _b)
+#endif /* FRAGPOOL_SIZE_BITS */
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128i lvec_t;
+#define LV_LOADU(_lp) _mm_loadu_si128((const lvec_t*)(_lp))
+#define LV_STOREU(_lp, _v) _mm_storeu_si128((lvec_t*)(_lp), _v)
+#define LV_OR(_a, _b) _mm_or_si128(_a, _b)
+#define LV_SELECT(_m, _a, _b) _mm_or_si128(_mm_and_si128(_m, _a), _mm_andnot_si128(_m, _b))
+#define LV_MOVEMASK(_v) (unsigned int)_mm_movemask_epi8(_v)
+#if 16 == FRAGPOOL_SIZE_BITS
+#define LV_SET1(_x) _mm_set1_epi16(_x)
+#define LV_CMPGT(_a, _b) _mm_cmpgt_epi16(_a, _b)
+#define LV_CMPEQ(_a, _b) _mm_cmpeq_epi16(_a, _b)
+#define LV_MIN(_a, _b) _mm_min_epi16(_a, _b)
+#define LV_MAX(_a, _b) _mm_max_epi16(_a, _b)
+#else /* FRAGPOOL_SIZE_BITS */
+/* SSE2 has no 32-bit minimum or maximum; arguments must be simple */
+#define LV_SET1(_x) _mm_set1_epi32(_x)
+#define LV_CMPGT(_a, _b) _mm_cmpgt_epi32(_a, _b)
+#define LV_CMPEQ(_a, _b) _mm_cmpeq_epi32(_a, _b)
+#define LV_MIN(_a, _b) LV_SELECT(_mm_cmpgt_epi32(_a, _b), _b, _a)
+#define LV_MAX(_a, _b) LV_SELECT(_mm_cmpgt_epi32(_a, _b), _a, _b)
+#endif /* FRAGPOOL_SIZE_BITS */
+#endif /* __AVX2__ */
+
+#if defined(LV_LOADU)
+/** The number of lengths examined by each vector operation */
+#define LV_LANES (sizeof(lvec_t) / sizeof(fp_ssize_t))
+#endif /* LV_LOADU */
+
+/** Locate the best available length in lp[begin, end).
+ *
+ * The selection is the one PREFER_NEW_SIZE makes over the slots in
+ * order, expressed so it can be made many lengths at a time: the
+ * shortest length that is at least both min_size and max_size if
+ * there is one, otherwise the longest length provided it is at least
+ * min_size.  The first occurrence of the selected length is returned.
+ *
+ * @return the index of the best length, or @p end if none is at least
+ * min_size. */
+static fp_count_t
+lengths_scan (const fp_ssize_t* lp,
+              fp_count_t begin,
+              fp_count_t end,
+              fp_ssize_t min_size,
+              fp_ssize_t max_size)
+{
+  const fp_ssize_t at_least = (max_size > min_size) ? max_size : min_size;
+  fp_ssize_t shortest = FP_MAX_FRAGMENT_SIZE;
+  fp_ssize_t longest = 0;
+  int reached = 0;
+  fp_ssize_t want;
+  fp_count_t i = begin;
+
+#if defined(LV_LANES)
+  if (LV_LANES <= (fp_count_t)(end - begin)) {
+    const lvec_t below = LV_SET1(at_least - 1);
+    lvec_t vshortest = LV_SET1(FP_MAX_FRAGMENT_SIZE);
+    lvec_t vlongest = LV_SET1(0);
+    lvec_t vreached = LV_SET1(0);
+    fp_ssize_t lane[2][LV_LANES];
+    unsigned int li;
+
+    for (; (fp_count_t)(end - i) >= LV_LANES; i += LV_LANES) {
+      const lvec_t v = LV_LOADU(lp + i);
+      const lvec_t m = LV_CMPGT(v, below);
+      const lvec_t c = LV_SELECT(m, v, vshortest);
+
+      vreached = LV_OR(vreached, m);
+      vshortest = LV_MIN(vshortest, c);
+      vlongest = LV_MAX(vlongest, v);
+    }
+    reached = (0 != LV_MOVEMASK(vreached));
+    LV_STOREU(lane[0], vshortest);
+    LV_STOREU(lane[1], vlongest);
+    for (li = 0; li < LV_LANES; ++li) {
+      if (lane[0][li] < shortest) {
+        shortest = lane[0][li];
+      }
+      if (lane[1][li] > longest) {
+        longest = lane[1][li];
+      }
+    }
+  }
+#endif /* LV_LANES */
+  for (; i < end; ++i) {
+    if (lp[i] >= at_least) {
+      reached = 1;
+      if (lp[i] < shortest) {
+        shortest = lp[i];
+      }
+    }
+    if (lp[i] > longest) {
+      longest = lp[i];
+    }
+  }
+  if (reached) {
+    want = shortest;
+  } else if (longest >= min_size) {
+    want = longest;
+  } else {
+    return end;
+  }
+
+  i = begin;
+#if defined(LV_LANES)
+  {
+    const lvec_t vwant = LV_SET1(want);
+
+    for (; (fp_count_t)(end - i) >= LV_LANES; i += LV_LANES) {
+      unsigned int mask = LV_MOVEMASK(LV_CMPEQ(LV_LOADU(lp + i), vwant));
+
+      if (0 != mask) {
+        return i + __builtin_ctz(mask) / sizeof(fp_ssize_t);
+      }
+    }
+  }
+#endif /* LV_LANES */
+  while (lp[i] != want) {
+    ++i;
+  }
+  return i;
+}
+
+/** Locate the best available fragment using the available length
+ * array, making the same selection as find_best_fragment().
+ *
+ * Fragments in [xs, xe] are ignored; pass null pointers if there are
+ * none to ignore.  Pools without an array are scanned slot by
+ * slot. */
+static fp_fragment_t
+lengths_find_best (fp_pool_t p,
+                   fp_size_t min_size,
+                   fp_size_t max_size,
+                   fp_fragment_t xs,
+                   fp_fragment_t xe)
+{
+  const fp_ssize_t* lp = p->available_length;
+  const fp_count_t n = p->fragment_count;
+  fp_count_t bi;
+  fp_count_t ai;
+
+  if (NULL == lp) {
+    fp_fragment_t f = p->fragment;
+    const fp_fragment_t fe = f + n;
+    fp_fragment_t bf = NULL;
+
+    do {
+      if (((xs <= f) && (f <= xe))
+          || ((fp_ssize_t)min_size > f->length)) {
+        continue;
+      }
+      if ((NULL == bf) || PREFER_NEW_SIZE(f->length, bf->length, (fp_ssize_t)max_size)) {
+        bf = f;
+      }
+    } while (++f < fe);
+    return bf;
+  }
+  if (NULL == xs) {
+    bi = lengths_scan(lp, 0, n, min_size, max_size);
+    return (bi < n) ? (p->fragment + bi) : NULL;
+  }
+  /* Choose between the best before and the best after the ignored
+   * fragments; ties go to the lower address. */
+  bi = lengths_scan(lp, 0, xs - p->fragment, min_size, max_size);
+  if (bi == (fp_count_t)(xs - p->fragment)) {
+    bi = n;
+  }
+  ai = lengths_scan(lp, xe - p->fragment + 1, n, min_size, max_size);
+  if ((ai < n)
+      && ((bi == n)
+          || PREFER_NEW_SIZE(lp[ai], lp[bi], (fp_ssize_t)max_size))) {
+    bi = ai;
+  }
+  return (bi < n) ? (p->fragment + bi) : NULL;
+}
+
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+
 /** Locate the best available fragment to use for the given allocation.
  *
  * Satisfactory fragments must be available and have at least min_size octets.
@@ -122,6 +650,11 @@ find_best_fragment (fp_pool_t p,
                     fp_size_t min_size,
                     fp_size_t max_size)
 {
+#if FRAGPOOL_WITH_SIZE_INDEX
+  return index_find_best(p, min_size, max_size, NULL, NULL);
+#elif FRAGPOOL_WITH_LENGTH_ARRAY
+  return lengths_find_best(p, min_size, max_size, NULL, NULL);
+#else /* FRAGPOOL_WITH_SIZE_INDEX */
   fp_fragment_t f = p->fragment;
   const fp_fragment_t fe = f + p->fragment_count;
   fp_fragment_t bf = NULL;
@@ -139,11 +672,248 @@ find_best_fragment (fp_pool_t p,
   } while (++f < fe);
 
   return bf;
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+}
+
+/** Return the length of the longest available fragment, or zero if
+ * there is none. */
+static fp_size_t
+largest_available (fp_pool_t p)
+{
+  /* The best fragment for an unbounded request is the longest */
+  fp_fragment_t f = find_best_fragment(p, 1, FP_MAX_FRAGMENT_SIZE);
+
+  return (NULL != f) ? f->length : 0;
+}
+
+#if FRAGPOOL_WITH_NOTIFY
+
+/** Record in _v the length of the longest available fragment before
+ * an operation that may return memory to the pool.  _v must be
+ * initialized to zero. */
+#define NOTIFY_BEGIN(_p, _v) do {                       \
+    if (NULL != (_p)->notify) {                         \
+      (_v) = largest_available(_p);                     \
+    }                                                   \
+  } while (0)
+
+/** Replace _v with the length of the longest available fragment if
+ * the operation increased it, otherwise with zero. */
+#define NOTIFY_END(_p, _v) do {                         \
+    if (NULL != (_p)->notify) {                         \
+      fp_size_t largest_ = largest_available(_p);       \
+      (_v) = (largest_ > (_v)) ? largest_ : 0;          \
+    }                                                   \
+  } while (0)
+
+/** Invoke the notification hook if NOTIFY_END recorded an increase.
+ * This must be done with the pool unlocked. */
+#define NOTIFY(_p, _v) do {                                     \
+    if (0 != (_v)) {                                            \
+      (_p)->notify->available(_p, _v, (_p)->notify->context);   \
+    }                                                           \
+  } while (0)
+
+#else /* FRAGPOOL_WITH_NOTIFY */
+
+#define NOTIFY_BEGIN(_p, _v) do { (void)(_v); } while (0)
+#define NOTIFY_END(_p, _v) do { } while (0)
+#define NOTIFY(_p, _v) do { } while (0)
+
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+#if FRAGPOOL_WITH_STATS
+
+/** Return the number of active fragment slots.  These precede all
+ * inactive slots, so this is a binary search. */
+static fp_count_t
+active_slot_count (fp_pool_t p)
+{
+  fp_count_t lo = 0;
+  fp_count_t n = p->fragment_count;
+
+  while (0 < n) {
+    fp_count_t half = n / 2;
+
+    if (FRAGMENT_IS_INACTIVE(p->fragment + lo + half)) {
+      n = half;
+    } else {
+      lo += half + 1;
+      n -= half + 1;
+    }
+  }
+  return lo;
+}
+
+/** Account for a change in the number of allocated octets, and
+ * update the high-water marks. */
+static void
+stats_allocated (fp_pool_t p,
+                 long delta)
+{
+  fp_counters_t c = &p->counters;
+  fp_count_t nactive = active_slot_count(p);
+
+  c->allocated_bytes += delta;
+  if (c->allocated_bytes > c->max_allocated_bytes) {
+    c->max_allocated_bytes = c->allocated_bytes;
+  }
+  if (nactive > c->max_active_slots) {
+    c->max_active_slots = nactive;
+  }
 }
 
+#define STATS_COUNT(_p, _counter) do {          \
+    ++(_p)->counters._counter;                  \
+  } while (0)
+#define STATS_ADD(_p, _counter, _n) do {        \
+    (_p)->counters._counter += (_n);            \
+  } while (0)
+#define STATS_ALLOCATED(_p, _delta) stats_allocated(_p, _delta)
+
+#else /* FRAGPOOL_WITH_STATS */
+
+#define STATS_COUNT(_p, _counter) do { } while (0)
+#define STATS_ADD(_p, _counter, _n) do { } while (0)
+#define STATS_ALLOCATED(_p, _delta) do { } while (0)
+
+#endif /* FRAGPOOL_WITH_STATS */
+
+#if FRAGPOOL_WITH_SDT
+#include <sys/sdt.h>
+
+/* Static probes, with provider fragpool.  The arguments of each are
+ * documented at FRAGPOOL_WITH_SDT. */
+#define PROBE4(_name, _a1, _a2, _a3, _a4)                       \
+  DTRACE_PROBE4(fragpool, _name, _a1, _a2, _a3, _a4)
+#define PROBE5(_name, _a1, _a2, _a3, _a4, _a5)                  \
+  DTRACE_PROBE5(fragpool, _name, _a1, _a2, _a3, _a4, _a5)
+#define PROBE6(_name, _a1, _a2, _a3, _a4, _a5, _a6)             \
+  DTRACE_PROBE6(fragpool, _name, _a1, _a2, _a3, _a4, _a5, _a6)
+#define PROBE8(_name, _a1, _a2, _a3, _a4, _a5, _a6, _a7, _a8)   \
+  DTRACE_PROBE8(fragpool, _name, _a1, _a2, _a3, _a4, _a5, _a6, _a7, _a8)
+
+#else /* FRAGPOOL_WITH_SDT */
+
+#define PROBE4(_name, _a1, _a2, _a3, _a4) do { } while (0)
+#define PROBE5(_name, _a1, _a2, _a3, _a4, _a5) do { } while (0)
+#define PROBE6(_name, _a1, _a2, _a3, _a4, _a5, _a6) do { } while (0)
+#define PROBE8(_name, _a1, _a2, _a3, _a4, _a5, _a6, _a7, _a8) do { } while (0)
+
+#endif /* FRAGPOOL_WITH_SDT */
+
+/** The slot index of a fragment, or -1 for none, as reported by
+ * probes. */
+#define SLOT_INDEX(_p, _f) ((NULL != (_f)) ? (int)((_f) - (_p)->fragment) : -1)
+
+#if FRAGPOOL_WITH_TRACE
+
+/** Return the offset of bp within the pool, or FP_TRACE_NO_OFFSET. */
+static fp_size_t
+trace_offset (fp_pool_t p,
+              const uint8_t* bp)
+{
+  uintptr_t bi = (uintptr_t)bp;
+
+  if ((bi < (uintptr_t)p->pool_start) || (bi >= (uintptr_t)p->pool_end)) {
+    return FP_TRACE_NO_OFFSET;
+  }
+  return bp - p->pool_start;
+}
+
+/** Append a record to the trace of the pool. */
+static void
+trace_record (fp_pool_t p,
+              uint8_t op,
+              uint8_t status,
+              const uint8_t* bp,
+              fp_size_t min_size,
+              fp_size_t max_size,
+              const uint8_t* rp,
+              fp_size_t length)
+{
+  fp_trace_t t = p->trace;
+  fp_trace_record_t r = t->record + (t->count++ % t->capacity);
+
+  r->op = op;
+  r->status = status;
+  r->offset = trace_offset(p, bp);
+  r->min_size = min_size;
+  r->max_size = max_size;
+  r->result = trace_offset(p, rp);
+  r->length = length;
+}
+
+#define TRACE(_p, _op, _status, _bp, _min, _max, _rp, _len) do {         \
+    if (NULL != (_p)->trace) {                                          \
+      trace_record(_p, _op, _status, _bp, _min, _max, _rp, _len);       \
+    }                                                                   \
+  } while (0)
+
+#else /* FRAGPOOL_WITH_TRACE */
+
+#define TRACE(_p, _op, _status, _bp, _min, _max, _rp, _len) do { } while (0)
+
+#endif /* FRAGPOOL_WITH_TRACE */
+
+#if FRAGPOOL_WITH_HANDLES
+
+/** Find the allocated fragment identified by a handle.
+ *
+ * The recorded slot is checked first.  Only if other fragments have
+ * shifted it is the fragment located by address.
+ *
+ * @return the fragment, or a null pointer if the handle is stale */
+static fp_fragment_t
+handle_fragment (fp_pool_t p,
+                 fp_handle_t h)
+{
+  fp_fragment_t f = NULL;
+
+  if (h->slot < p->fragment_count) {
+    f = p->fragment + h->slot;
+    if ((FP_FRAGMENT_START(p, f) != h->start) || FRAGMENT_IS_INACTIVE(f)) {
+      f = NULL;
+    }
+  }
+  if (NULL == f) {
+    f = get_fragment(p, h->start);
+  }
+  if ((NULL == f) || (! FRAGMENT_IS_ALLOCATED(f)) || (f->generation != h->generation)) {
+    return NULL;
+  }
+  return f;
+}
+
+#define NEW_GENERATION(_p, _f) do {             \
+    (_f)->generation = ++(_p)->generation;      \
+  } while (0)
+
+#define LOCATE(_p, _bp, _h) \
+  ((NULL != (_h)) ? handle_fragment(_p, _h) : get_fragment(_p, _bp))
+
+#define SET_HANDLE(_p, _h, _f) do {                     \
+    if (NULL != (_h)) {                                 \
+      fp_fragment_t hf_ = (_f);                         \
+      (_h)->start = FP_FRAGMENT_START(_p, hf_);         \
+      (_h)->slot = hf_ - (_p)->fragment;                \
+      (_h)->generation = hf_->generation;               \
+    }                                                   \
+  } while (0)
+
+#else /* FRAGPOOL_WITH_HANDLES */
+
+#define NEW_GENERATION(_p, _f) do { } while (0)
+#define LOCATE(_p, _bp, _h) get_fragment(_p, _bp)
+#define SET_HANDLE(_p, _h, _f) do { } while (0)
+
+#endif /* FRAGPOOL_WITH_HANDLES */
+
 /** If a fragment slot is available, trim excess octets off the tail
  * of the provided fragment and make it available as a new fragment.
  *
+ * @param p the pool being manipulated
+ *
  * @param f an allocated fragment with more space than it needs
  *
  * @param fe the end of the fragment array
@@ -152,7 +922,8 @@ find_best_fragment (fp_pool_t p,
  * value must satisfy the pool alignment constraints.
  */
 static void
-release_suffix (fp_fragment_t f,
+release_suffix (fp_pool_t p,
+                fp_fragment_t f,
                 fp_fragment_t fe,
                 fp_size_t excess)
 {
@@ -162,24 +933,32 @@ release_suffix (fp_fragment_t f,
     return;
   }
   if (FRAGMENT_IS_INACTIVE(nf)) {
+    PROBE4(release_suffix, p, SLOT_INDEX(p, f), excess, 0);
     nf->length = excess;
     f->length += excess;
-    nf->start = f->start - f->length;
+    FP_FRAGMENT_SET_START(p, nf, FP_FRAGMENT_START(p, f) - f->length);
+    INDEX_INSERT(p, nf);
   } else if (FRAGMENT_IS_AVAILABLE(nf)) {
+    PROBE4(release_suffix, p, SLOT_INDEX(p, f), excess, 0);
+    INDEX_REMOVE(p, nf);
     nf->length += excess;
     f->length += excess;
-    nf->start -= excess;
+    FP_FRAGMENT_SET_START(p, nf, FP_FRAGMENT_START(p, nf) - excess);
+    INDEX_INSERT(p, nf);
   } else {
     while ((++nf < fe) && (!FRAGMENT_IS_INACTIVE(nf))) {
       ;
     }
+    PROBE4(release_suffix, p, SLOT_INDEX(p, f), excess,
+           (nf < fe) ? (int)(nf - f - 1) : -1);
     if (nf < fe) {
       do {
         nf[0] = nf[-1];
       } while (--nf > f);
       f[0].length += excess;
-      f[1].start = f[0].start - f[0].length;
+      FP_FRAGMENT_SET_START(p, f+1, FP_FRAGMENT_START(p, f) - f[0].length);
       f[1].length = excess;
+      INDEX_REBUILD(p);
     }
   }
 }
@@ -206,57 +985,84 @@ complete_allocation (fp_pool_t p,
   const fp_fragment_t fe = p->fragment + p->fragment_count;
   fp_size_t flen = f->length;
 
+  INDEX_REMOVE(p, f);
   f->length = -f->length;
+  NEW_GENERATION(p, f);
   if (((f+1) < fe) && (FP_MAX_FRAGMENT_SIZE != max_size)) {
     max_size = align_size_up(p, max_size);
     if (flen > max_size) {
-      release_suffix(f, fe, flen - max_size);
+      release_suffix(p, f, fe, flen - max_size);
     }
   }
-  *fragment_endp = f->start - f->length;
-  return f->start;
+  *fragment_endp = FP_FRAGMENT_START(p, f) - f->length;
+  return FP_FRAGMENT_START(p, f);
 }
 
 /** Extend the space of the provided fragment (allocated or available)
  * by the following fragment, which is then eliminated.
  *
+ * @param p the pool being manipulated
+ *
  * @param f is a fragment (either allocated or available), and the
  * next fragment is available.
  *
  * @param fe is the end of the fragment array
  */
 static void
-merge_adjacent_available (fp_fragment_t f,
+merge_adjacent_available (fp_pool_t p,
+                          fp_fragment_t f,
                           fp_fragment_t fe)
 {
   fp_fragment_t nf = f+1;
 
+  INDEX_REMOVE(p, nf);
   if (FRAGMENT_IS_ALLOCATED(f)) {
     f->length -= nf->length;
   } else {
+    INDEX_REMOVE(p, f);
     f->length += nf->length;
+    INDEX_INSERT(p, f);
   }
   while ((++nf < fe) && (! FRAGMENT_IS_INACTIVE(nf))) {
     nf[-1] = nf[0];
   }
   nf[-1].length = 0;
+  if (nf > (f+2)) {
+    INDEX_REBUILD(p);
+  }
 }
 
 void
 fp_reset (fp_pool_t p)
 {
-  p->fragment[0].start = align_pointer_up(p, p->pool_start);
-  p->fragment[0].length = align_pointer_down(p, p->pool_end) - p->fragment[0].start;
+  fp_size_t largest = 0;
+
+  POOL_LOCK(p);
+  NOTIFY_BEGIN(p, largest);
+  FP_FRAGMENT_SET_START(p, p->fragment, align_pointer_up(p, p->pool_start));
+  p->fragment[0].length = align_pointer_down(p, p->pool_end) - FP_FRAGMENT_START(p, p->fragment);
   memset(p->fragment+1, 0, (p->fragment_count-1)*sizeof(*p->fragment));
+  INDEX_REBUILD(p);
+#if FRAGPOOL_WITH_STATS
+  memset(&p->counters, 0, sizeof(p->counters));
+  p->counters.max_active_slots = 1;
+#endif /* FRAGPOOL_WITH_STATS */
+  TRACE(p, FP_TRACE_RESET, 0, NULL, 0, 0, NULL, 0);
+  NOTIFY_END(p, largest);
+  POOL_UNLOCK(p);
+  NOTIFY(p, largest);
 }
 
-uint8_t*
-fp_request (fp_pool_t p,
+/** Implement fp_request(), storing a handle if @p h is not null. */
+static uint8_t*
+do_request (fp_pool_t p,
             fp_size_t min_size,
             fp_size_t max_size,
-            uint8_t** fragment_endp)
+            uint8_t** fragment_endp,
+            fp_handle_t h)
 {
   fp_fragment_t f;
+  uint8_t* bp = NULL;
 
   /* Validate arguments */
   if ((0 >= min_size) || (min_size > max_size) || (NULL == fragment_endp)) {
@@ -266,88 +1072,437 @@ fp_request (fp_pool_t p,
   if (FP_MAX_FRAGMENT_SIZE != max_size) {
     max_size = align_size_up(p, max_size);
   }
+  POOL_LOCK(p);
+  STATS_COUNT(p, requests);
   f = find_best_fragment(p, min_size, max_size);
-  if (NULL == f) {
-    return NULL;
+  if (NULL != f) {
+    bp = complete_allocation(p, f, max_size, fragment_endp);
+    STATS_ALLOCATED(p, *fragment_endp - bp);
+    SET_HANDLE(p, h, f);
+  } else {
+    STATS_COUNT(p, failures);
+  }
+  PROBE6(request, p, min_size, max_size, bp,
+         (NULL != bp) ? (fp_size_t)(*fragment_endp - bp) : 0, SLOT_INDEX(p, f));
+  TRACE(p, FP_TRACE_REQUEST, 0, NULL, min_size, max_size, bp,
+        (NULL != bp) ? (fp_size_t)(*fragment_endp - bp) : 0);
+  POOL_UNLOCK(p);
+  return bp;
+}
+
+uint8_t*
+fp_request (fp_pool_t p,
+            fp_size_t min_size,
+            fp_size_t max_size,
+            uint8_t** fragment_endp)
+{
+  return do_request(p, min_size, max_size, fragment_endp, NULL);
+}
+
+/** Move allocated fragments toward the start of the pool.
+ *
+ * The slots are rewritten in a single pass.  Each allocated fragment
+ * that can move is placed immediately after the previous allocated
+ * fragment; a fragment that cannot move, because it is pinned or the
+ * budget is exhausted, is preceded by one available fragment covering
+ * the gap.  There is at least one available fragment in the input
+ * for every available fragment written, so the output never overtakes
+ * the input.
+ *
+ * @return the number of octets moved */
+static unsigned long
+compact_pool (fp_pool_t p,
+              const struct fp_relocate_t* hooks,
+              unsigned long budget)
+{
+  fp_fragment_t f = p->fragment;
+  fp_fragment_t wf = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+  uint8_t* dst = FP_FRAGMENT_START(p, f);
+  uint8_t* end = dst;
+  unsigned long moved = 0;
+  unsigned int nmoved = 0;
+  int stopped = 0;
+
+  for (; (f < fe) && (! FRAGMENT_IS_INACTIVE(f)); ++f) {
+    struct fp_fragment_t fr = *f;
+    uint8_t* start = FP_FRAGMENT_START(p, f);
+    fp_size_t len;
+
+    if (FRAGMENT_IS_AVAILABLE(&fr)) {
+      end = start + fr.length;
+      continue;
+    }
+    len = -fr.length;
+    end = start + len;
+    if ((start != dst) && (! stopped)) {
+      int pinned = COPY_IN_PROGRESS(p, start)
+        || ((NULL != hooks) && (NULL != hooks->pinned)
+            && hooks->pinned(p, start, hooks->context));
+
+      if ((! pinned) && (0 < moved)
+          && ((moved >= budget) || (len > (budget - moved)))) {
+        stopped = 1;
+      } else if (! pinned) {
+        memmove(dst, start, len);
+        if ((NULL != hooks) && (NULL != hooks->moved)) {
+          hooks->moved(p, start, dst, len, hooks->context);
+        }
+        start = dst;
+        moved += len;
+        ++nmoved;
+      }
+    }
+    if (start != dst) {
+      /* The fragment stays, preceded by the space left before it */
+      FP_FRAGMENT_SET_START(p, wf, dst);
+      wf->length = start - dst;
+      ++wf;
+    }
+    FP_FRAGMENT_SET_START(p, &fr, start);
+    *wf++ = fr;
+    dst = start + len;
   }
-  return complete_allocation(p, f, max_size, fragment_endp);
+  if (dst < end) {
+    FP_FRAGMENT_SET_START(p, wf, dst);
+    wf->length = end - dst;
+    ++wf;
+  }
+  while (wf < f) {
+    (wf++)->length = 0;
+  }
+  if (0 < nmoved) {
+    INDEX_REBUILD(p);
+    STATS_ADD(p, bytes_compacted, moved);
+  }
+  PROBE4(compact, p, budget, moved, nmoved);
+  TRACE(p, FP_TRACE_COMPACT, 0, NULL, 0,
+        (budget < FP_TRACE_NO_OFFSET) ? (fp_size_t)budget : FP_TRACE_NO_OFFSET,
+        NULL, moved);
+  return moved;
 }
 
-int
-fp_release (fp_pool_t p,
-            const uint8_t* bp)
+unsigned long
+fp_compact (fp_pool_t p,
+            const struct fp_relocate_t* hooks)
+{
+  return fp_compact_step(p, hooks, ULONG_MAX);
+}
+
+unsigned long
+fp_compact_step (fp_pool_t p,
+                 const struct fp_relocate_t* hooks,
+                 unsigned long budget)
+{
+  unsigned long moved;
+  fp_size_t largest = 0;
+
+#if FRAGPOOL_WITH_LOCK
+  /* Other processes' copies and references are not visible here */
+  if ((NULL != p->lock) && p->lock->shared) {
+    return 0;
+  }
+#endif /* FRAGPOOL_WITH_LOCK */
+  POOL_LOCK(p);
+  NOTIFY_BEGIN(p, largest);
+  moved = compact_pool(p, hooks, budget);
+  NOTIFY_END(p, largest);
+  POOL_UNLOCK(p);
+  NOTIFY(p, largest);
+  return moved;
+}
+
+fp_size_t
+fp_largest_available (fp_pool_t p)
+{
+  fp_size_t rv;
+
+  POOL_LOCK(p);
+  rv = largest_available(p);
+  POOL_UNLOCK(p);
+  return rv;
+}
+
+/** Return an allocated fragment to the pool, merging it with
+ * adjacent available fragments.
+ *
+ * @param p the pool being manipulated
+ *
+ * @param f an allocated fragment
+ */
+static void
+release_fragment (fp_pool_t p,
+                  fp_fragment_t f)
 {
-  fp_fragment_t f = get_fragment(p, bp);
   fp_fragment_t nf;
   const fp_fragment_t fe = p->fragment + p->fragment_count;
 
-  if ((NULL == f) || (! FRAGMENT_IS_ALLOCATED(f))) {
-    return FP_EINVAL;
-  }
   f->length = -f->length;
+  INDEX_INSERT(p, f);
   if ((p->fragment < f) && FRAGMENT_IS_AVAILABLE(f-1)) {
-    merge_adjacent_available(--f, fe);
+    merge_adjacent_available(p, --f, fe);
   }
   nf = f+1;
   if ((nf < fe) && FRAGMENT_IS_AVAILABLE(nf)) {
-    merge_adjacent_available(f, fe);
+    merge_adjacent_available(p, f, fe);
   }
-  return 0;
 }
 
-uint8_t*
-fp_resize (fp_pool_t p,
-           uint8_t* bp,
-           fp_size_t new_size,
-           uint8_t** fragment_endp)
+/** Implement fp_release(), locating the fragment by handle if @p h
+ * is not null. */
+static int
+do_release (fp_pool_t p,
+            const uint8_t* bp,
+            fp_handle_t h)
 {
-  fp_fragment_t f = get_fragment(p, bp);
-  fp_fragment_t fe = p->fragment + p->fragment_count;
+  fp_fragment_t f;
+  int rv = FP_EINVAL;
+  fp_size_t largest = 0;
+
+  POOL_LOCK(p);
+  f = LOCATE(p, bp, h);
+  if ((NULL != f) && FRAGMENT_IS_ALLOCATED(f)) {
+    NOTIFY_BEGIN(p, largest);
+    STATS_ALLOCATED(p, f->length);
+    PROBE4(release, p, bp, (fp_size_t)-f->length, SLOT_INDEX(p, f));
+    TRACE(p, FP_TRACE_RELEASE, 0, bp, 0, 0, NULL, -f->length);
+    release_fragment(p, f);
+    NOTIFY_END(p, largest);
+    rv = 0;
+  } else {
+    TRACE(p, FP_TRACE_RELEASE, FP_EINVAL, bp, 0, 0, NULL, 0);
+  }
+  POOL_UNLOCK(p);
+  NOTIFY(p, largest);
+  return rv;
+}
+
+int
+fp_release (fp_pool_t p,
+            const uint8_t* bp)
+{
+  return do_release(p, bp, NULL);
+}
+
+int
+fp_release_many (fp_pool_t p,
+                 const uint8_t* const* bps,
+                 unsigned int count)
+{
+  fp_fragment_t f;
   fp_fragment_t nf;
+  const fp_fragment_t fe = p->fragment + p->fragment_count;
+  unsigned int nreleased = 0;
+  unsigned int i;
+  int rv = 0;
+  fp_size_t largest = 0;
 
-  if ((NULL == f) || (!FRAGMENT_IS_ALLOCATED(f))) {
-    return NULL;
+  POOL_LOCK(p);
+  NOTIFY_BEGIN(p, largest);
+  /* Mark the fragments available.  Nothing moves until they have all
+   * been located. */
+  for (i = 0; i < count; ++i) {
+    f = get_fragment(p, bps[i]);
+    if ((NULL != f) && FRAGMENT_IS_ALLOCATED(f)) {
+      STATS_ALLOCATED(p, f->length);
+      PROBE4(release, p, bps[i], (fp_size_t)-f->length, SLOT_INDEX(p, f));
+      TRACE(p, FP_TRACE_RELEASE, 0, bps[i], 0, 0, NULL, -f->length);
+      f->length = -f->length;
+      ++nreleased;
+    } else {
+      TRACE(p, FP_TRACE_RELEASE, FP_EINVAL, bps[i], 0, 0, NULL, 0);
+      rv = FP_EINVAL;
+    }
   }
-  nf = f+1;
+  if (0 < nreleased) {
+    /* Merge adjacent available fragments while compacting the slots
+     * in a single pass. */
+    f = nf = p->fragment;
+    while ((++nf < fe) && (! FRAGMENT_IS_INACTIVE(nf))) {
+      if (FRAGMENT_IS_AVAILABLE(f) && FRAGMENT_IS_AVAILABLE(nf)) {
+        f->length += nf->length;
+      } else {
+        *++f = *nf;
+      }
+    }
+    while (++f < nf) {
+      f->length = 0;
+    }
+    INDEX_REBUILD(p);
+  }
+  NOTIFY_END(p, largest);
+  POOL_UNLOCK(p);
+  NOTIFY(p, largest);
+  return rv;
+}
+
+int
+fp_request_many (fp_pool_t p,
+                 fp_request_t requests,
+                 unsigned int count)
+{
+  fp_request_t rp;
+  const fp_request_t rpe = requests + count;
+  int rv = 0;
+
+  /* Validate arguments */
+  for (rp = requests; rp < rpe; ++rp) {
+    if ((0 >= rp->min_size) || (rp->min_size > rp->max_size)) {
+      return FP_EINVAL;
+    }
+  }
+  POOL_LOCK(p);
+  STATS_ADD(p, requests, count);
+  for (rp = requests; rp < rpe; ++rp) {
+    fp_size_t min_size = align_size_up(p, rp->min_size);
+    fp_size_t max_size = rp->max_size;
+    fp_fragment_t f;
+
+    if (FP_MAX_FRAGMENT_SIZE != max_size) {
+      max_size = align_size_up(p, max_size);
+    }
+    f = find_best_fragment(p, min_size, max_size);
+    if (NULL == f) {
+      rv = FP_ENOMEM;
+      break;
+    }
+    rp->start = complete_allocation(p, f, max_size, &rp->end);
+  }
+  if (0 != rv) {
+    STATS_COUNT(p, failures);
+    /* Each allocation either consumed an available fragment or split
+     * one, so releasing them in reverse order restores the original
+     * partition exactly. */
+    while (requests < rp--) {
+      release_fragment(p, get_fragment(p, rp->start));
+    }
+    for (rp = requests; rp < rpe; ++rp) {
+      rp->start = rp->end = NULL;
+    }
+  } else {
+    /* Account for the set only once it is committed, so a set that
+     * is rolled back does not raise the high-water marks. */
+    for (rp = requests; rp < rpe; ++rp) {
+      STATS_ALLOCATED(p, rp->end - rp->start);
+    }
+  }
+#if FRAGPOOL_WITH_TRACE
+  /* A set that could not be allocated left no trace */
+  for (rp = requests; (0 == rv) && (rp < rpe); ++rp) {
+    TRACE(p, FP_TRACE_REQUEST, 0, NULL, rp->min_size, rp->max_size,
+          rp->start, rp->end - rp->start);
+  }
+#endif /* FRAGPOOL_WITH_TRACE */
+  POOL_UNLOCK(p);
+  return rv;
+}
+
+/** Resize an allocated fragment in place.  See fp_resize().
+ *
+ * @param p the pool being manipulated
+ *
+ * @param f an allocated fragment
+ *
+ * @param new_size as with fp_resize()
+ *
+ * @param fragment_endp as with fp_resize()
+ *
+ * @return the start of the fragment
+ */
+static uint8_t*
+resize_fragment (fp_pool_t p,
+                 fp_fragment_t f,
+                 fp_size_t new_size,
+                 uint8_t** fragment_endp)
+{
+  fp_fragment_t fe = p->fragment + p->fragment_count;
+  fp_fragment_t nf = f+1;
+
   if (nf < fe) {
     fp_size_t cur_size = - f->length;
     if (FP_MAX_FRAGMENT_SIZE == new_size) {
       if (FRAGMENT_IS_AVAILABLE(nf)) {
-        merge_adjacent_available(f, fe);
+        merge_adjacent_available(p, f, fe);
       }
     } else {
       new_size = align_size_up(p, new_size);
       if (new_size < cur_size) {
         /* Give back, if possible */
-        release_suffix(f, p->fragment + p->fragment_count, cur_size - new_size);
+        release_suffix(p, f, fe, cur_size - new_size);
       } else if (new_size > cur_size) {
         /* Extend to following fragment? */
         if (FRAGMENT_IS_AVAILABLE(nf)) {
           fp_size_t lacking = new_size - cur_size;
           if (nf->length > (fp_ssize_t)lacking) {
             /* More available than needed; take only what's requested */
-            nf->start += lacking;
+            INDEX_REMOVE(p, nf);
+            FP_FRAGMENT_SET_START(p, nf, FP_FRAGMENT_START(p, nf) + lacking);
             nf->length -= lacking;
             f->length -= lacking;
+            INDEX_INSERT(p, nf);
           } else {
-            merge_adjacent_available(f, fe);
+            merge_adjacent_available(p, f, fe);
           }
         }
       }
     }
   }
-  *fragment_endp = f->start - f->length;
-  return f->start;
+  *fragment_endp = FP_FRAGMENT_START(p, f) - f->length;
+  return FP_FRAGMENT_START(p, f);
+}
+
+/** Implement fp_resize(), locating the fragment by handle if @p h is
+ * not null. */
+static uint8_t*
+do_resize (fp_pool_t p,
+           uint8_t* bp,
+           fp_size_t new_size,
+           uint8_t** fragment_endp,
+           fp_handle_t h)
+{
+  fp_fragment_t f;
+  fp_size_t largest = 0;
+
+  POOL_LOCK(p);
+  f = LOCATE(p, bp, h);
+  if ((NULL == f) || (!FRAGMENT_IS_ALLOCATED(f))) {
+    bp = NULL;
+  } else {
+    NOTIFY_BEGIN(p, largest);
+    STATS_COUNT(p, resizes);
+    STATS_ALLOCATED(p, f->length);
+    bp = resize_fragment(p, f, new_size, fragment_endp);
+    STATS_ALLOCATED(p, *fragment_endp - bp);
+    PROBE5(resize, p, bp, new_size, (fp_size_t)(*fragment_endp - bp), SLOT_INDEX(p, f));
+    TRACE(p, FP_TRACE_RESIZE, 0, bp, new_size, 0, bp, *fragment_endp - bp);
+    NOTIFY_END(p, largest);
+    SET_HANDLE(p, h, f);
+  }
+  POOL_UNLOCK(p);
+  NOTIFY(p, largest);
+  return bp;
 }
 
 uint8_t*
-fp_reallocate (fp_pool_t p,
+fp_resize (fp_pool_t p,
+           uint8_t* bp,
+           fp_size_t new_size,
+           uint8_t** fragment_endp)
+{
+  return do_resize(p, bp, new_size, fragment_endp, NULL);
+}
+
+/** Implement fp_reallocate(), locating the fragment by handle and
+ * updating the handle if @p h is not null. */
+static uint8_t*
+do_reallocate (fp_pool_t p,
                uint8_t* bp,
                fp_size_t min_size,
                fp_size_t max_size,
-               uint8_t** fragment_endp)
+               uint8_t** fragment_endp,
+               fp_handle_t h)
 {
-  fp_fragment_t f = get_fragment(p, bp);
+  fp_fragment_t f;
   fp_fragment_t frs;
   fp_fragment_t fre;
   fp_size_t original_min_size;
@@ -356,11 +1511,11 @@ fp_reallocate (fp_pool_t p,
   fp_size_t bflen;
   const fp_fragment_t fe = p->fragment + p->fragment_count;
   fp_size_t copy_len;
+  uint8_t* fstart;
+  fp_size_t largest = 0;
 
   /* Validate arguments */
-  if ((NULL == f)
-      || (! FRAGMENT_IS_ALLOCATED(f))
-      || (0 >= min_size)
+  if ((0 >= min_size)
       || (min_size > max_size)
       || (NULL == fragment_endp)) {
     return NULL;
@@ -372,6 +1527,15 @@ fp_reallocate (fp_pool_t p,
     max_size = align_size_up(p, max_size);
   }
 
+  POOL_LOCK(p);
+  f = LOCATE(p, bp, h);
+  if ((NULL == f) || (! FRAGMENT_IS_ALLOCATED(f))) {
+    POOL_UNLOCK(p);
+    return NULL;
+  }
+  NOTIFY_BEGIN(p, largest);
+  STATS_COUNT(p, reallocations);
+
   /* Create hooks for a pseudo-slot at f0 for flen octets,
    * representing what would happen if this fragment were released. */
   frs = fre = f;
@@ -384,6 +1548,24 @@ fp_reallocate (fp_pool_t p,
     fre = f+1;
     frlen += fre->length;
   }
+#if (FRAGPOOL_WITH_SIZE_INDEX) || (FRAGPOOL_WITH_LENGTH_ARRAY)
+  /* Use the index for everything except the sequence around the
+   * current fragment, then see whether that sequence is better. */
+#if FRAGPOOL_WITH_SIZE_INDEX
+  bf = index_find_best(p, min_size, max_size, frs, fre);
+#else /* FRAGPOOL_WITH_SIZE_INDEX */
+  bf = lengths_find_best(p, min_size, max_size, frs, fre);
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+  bflen = (NULL != bf) ? bf->length : 0;
+  if (min_size <= frlen) {
+    if ((NULL == bf)
+        || PREFER_NEW_SIZE(frlen, bflen, max_size)
+        || ((frlen == bflen) && (frs < bf))) {
+      bf = frs;
+      bflen = frlen;
+    }
+  }
+#else /* FRAGPOOL_WITH_SIZE_INDEX || FRAGPOOL_WITH_LENGTH_ARRAY */
   bf = NULL;
   bflen = 0;
   {
@@ -396,7 +1578,7 @@ fp_reallocate (fp_pool_t p,
       if (xf == frs) {
         flen = frlen;
       }
-      if (min_size <= flen) {
+      if ((fp_ssize_t)min_size <= flen) {
         if ((NULL == bf) || PREFER_NEW_SIZE(flen, bflen, max_size)) {
           bf = xf;
           bflen = flen;
@@ -407,11 +1589,17 @@ fp_reallocate (fp_pool_t p,
       }
     } while (++xf < fe);
   }
+#endif /* FRAGPOOL_WITH_SIZE_INDEX || FRAGPOOL_WITH_LENGTH_ARRAY */
 
   /* If nothing can satisfy the minimum, fail. */
   if (NULL == bf) {
+    STATS_COUNT(p, failures);
+    PROBE8(reallocate, p, bp, original_min_size, max_size, NULL, 0, -1, 0);
+    TRACE(p, FP_TRACE_REALLOCATE, 0, bp, original_min_size, max_size, NULL, 0);
+    POOL_UNLOCK(p);
     return NULL;
   }
+  STATS_ALLOCATED(p, f->length);
   /* Save the minimum of the current fragment length and the desired
    * new size */
   copy_len = -f->length;
@@ -420,8 +1608,19 @@ fp_reallocate (fp_pool_t p,
   }
   /* If best is same fragment, just resize */
   if (bf == f) { /* == frs */
-    return fp_resize(p, bp, max_size, fragment_endp);
+    bp = resize_fragment(p, f, max_size, fragment_endp);
+    STATS_ALLOCATED(p, *fragment_endp - bp);
+    PROBE8(reallocate, p, bp, original_min_size, max_size, bp,
+           (fp_size_t)(*fragment_endp - bp), SLOT_INDEX(p, f), 0);
+    TRACE(p, FP_TRACE_REALLOCATE, 0, bp, original_min_size, max_size,
+          bp, *fragment_endp - bp);
+    SET_HANDLE(p, h, f);
+    NOTIFY_END(p, largest);
+    POOL_UNLOCK(p);
+    NOTIFY(p, largest);
+    return bp;
   }
+  fstart = FP_FRAGMENT_START(p, f);
   /* If best is available fragment preceding this fragment, shift the
    * data. */
   if (bf == frs) {
@@ -429,34 +1628,172 @@ fp_reallocate (fp_pool_t p,
     fp_size_t new_len;
 
     if (f < fre) {
-      merge_adjacent_available(f, fe);
+      merge_adjacent_available(p, f, fe);
     }
-    memmove(frs->start, f->start, copy_len);
-    ffrs_len = frs->length - f->length;
+    /* Claim the preceding fragment while the data moves into it */
+    bp = FP_FRAGMENT_START(p, frs);
+    INDEX_REMOVE(p, frs);
+    frs->length = -frs->length;
+    NEW_GENERATION(p, frs);
+    STATS_COUNT(p, moves);
+    STATS_ADD(p, bytes_copied, copy_len);
+    COPY_UNLOCKED(p, bp, fstart, copy_len);
+#if FRAGPOOL_WITH_LOCK
+    /* Other operations may have shifted the slots, but not merged
+     * into either fragment since both are allocated, and compaction
+     * has not moved them while the copy was recorded. */
+    frs = get_fragment(p, bp);
+    f = frs + 1;
+#endif /* FRAGPOOL_WITH_LOCK */
+    ffrs_len = -(frs->length + f->length);
     new_len = ffrs_len;
     if (new_len > max_size) {
       new_len = max_size;
     }
     frs->length = -new_len;
-    *fragment_endp = frs->start + new_len;
+    *fragment_endp = FP_FRAGMENT_START(p, frs) + new_len;
     if (ffrs_len == new_len) {
       while ((++f < fe) && (! FRAGMENT_IS_INACTIVE(f))) {
         f[-1] = f[0];
       }
       f[-1].length = 0;
+      INDEX_REBUILD(p);
     } else {
-      f->start = *fragment_endp;
+      FP_FRAGMENT_SET_START(p, f, *fragment_endp);
       f->length = ffrs_len - new_len;
+      INDEX_INSERT(p, f);
+#if FRAGPOOL_WITH_LOCK
+      /* The following fragment may have been released while the data
+       * moved. */
+      if (((f+1) < fe) && FRAGMENT_IS_AVAILABLE(f+1)) {
+        merge_adjacent_available(p, f, fe);
+      }
+#endif /* FRAGPOOL_WITH_LOCK */
     }
-    return frs->start;
+    STATS_ALLOCATED(p, new_len);
+    PROBE8(reallocate, p, fstart, original_min_size, max_size, bp,
+           new_len, SLOT_INDEX(p, frs), copy_len);
+    TRACE(p, FP_TRACE_REALLOCATE, 0, fstart, original_min_size, max_size,
+          bp, new_len);
+    SET_HANDLE(p, h, frs);
+    NOTIFY_END(p, largest);
+    POOL_UNLOCK(p);
+    NOTIFY(p, largest);
+    return bp;
   }
-  const uint8_t* fstart = f->start;
+  /* Both fragments remain allocated while the data is copied */
   bp = complete_allocation(p, bf, max_size, fragment_endp);
-  memmove(bp, fstart, copy_len);
-  fp_release(p, fstart);
+  PROBE8(reallocate, p, fstart, original_min_size, max_size, bp,
+         (fp_size_t)(*fragment_endp - bp), SLOT_INDEX(p, bf), copy_len);
+  STATS_COUNT(p, moves);
+  STATS_ADD(p, bytes_copied, copy_len);
+  COPY_UNLOCKED(p, bp, fstart, copy_len);
+  /* Compaction cannot have moved either fragment */
+  release_fragment(p, get_fragment(p, fstart));
+  STATS_ALLOCATED(p, *fragment_endp - bp);
+  TRACE(p, FP_TRACE_REALLOCATE, 0, fstart, original_min_size, max_size,
+        bp, *fragment_endp - bp);
+  /* Releasing the original may have shifted the new fragment */
+  SET_HANDLE(p, h, get_fragment(p, bp));
+  NOTIFY_END(p, largest);
+  POOL_UNLOCK(p);
+  NOTIFY(p, largest);
   return bp;
 }
 
+uint8_t*
+fp_reallocate (fp_pool_t p,
+               uint8_t* bp,
+               fp_size_t min_size,
+               fp_size_t max_size,
+               uint8_t** fragment_endp)
+{
+  return do_reallocate(p, bp, min_size, max_size, fragment_endp, NULL);
+}
+
+uint8_t*
+fp_split (fp_pool_t p,
+          uint8_t* bp,
+          fp_size_t length,
+          uint8_t** fragment_endp)
+{
+  fp_fragment_t f;
+  fp_fragment_t nf;
+  const fp_fragment_t fe = p->fragment + p->fragment_count;
+  uint8_t* sp = NULL;
+
+  /* Validate arguments */
+  if ((0 >= length) || (NULL == fragment_endp)) {
+    return NULL;
+  }
+  length = align_size_up(p, length);
+  POOL_LOCK(p);
+  f = get_fragment(p, bp);
+  if ((NULL != f) && FRAGMENT_IS_ALLOCATED(f) && (length < (fp_size_t)-f->length)) {
+    nf = f;
+    while ((++nf < fe) && (! FRAGMENT_IS_INACTIVE(nf))) {
+      ;
+    }
+    if (nf < fe) {
+      /* Shift the following slots to make room for the suffix */
+      do {
+        nf[0] = nf[-1];
+      } while (--nf > f);
+      FP_FRAGMENT_SET_START(p, f+1, FP_FRAGMENT_START(p, f) + length);
+      f[1].length = f[0].length + length;
+      f[0].length = -length;
+      NEW_GENERATION(p, f+1);
+      INDEX_REBUILD(p);
+      STATS_ALLOCATED(p, 0);
+      sp = FP_FRAGMENT_START(p, f+1);
+      *fragment_endp = sp - f[1].length;
+    }
+  }
+  PROBE5(split, p, bp, length, sp, SLOT_INDEX(p, f));
+  TRACE(p, FP_TRACE_SPLIT, 0, bp, length, 0, sp,
+        (NULL != sp) ? (fp_size_t)(*fragment_endp - sp) : 0);
+  POOL_UNLOCK(p);
+  return sp;
+}
+
+#if FRAGPOOL_WITH_HANDLES
+uint8_t*
+fp_request_handle (fp_pool_t p,
+                   fp_size_t min_size,
+                   fp_size_t max_size,
+                   uint8_t** fragment_endp,
+                   fp_handle_t h)
+{
+  return do_request(p, min_size, max_size, fragment_endp, h);
+}
+
+uint8_t*
+fp_resize_handle (fp_pool_t p,
+                  fp_handle_t h,
+                  fp_size_t new_size,
+                  uint8_t** fragment_endp)
+{
+  return do_resize(p, h->start, new_size, fragment_endp, h);
+}
+
+uint8_t*
+fp_reallocate_handle (fp_pool_t p,
+                      fp_handle_t h,
+                      fp_size_t min_size,
+                      fp_size_t max_size,
+                      uint8_t** fragment_endp)
+{
+  return do_reallocate(p, h->start, min_size, max_size, fragment_endp, h);
+}
+
+int
+fp_release_handle (fp_pool_t p,
+                   fp_handle_t h)
+{
+  return do_release(p, h->start, h);
+}
+#endif /* FRAGPOOL_WITH_HANDLES */
+
 enum {
   FPVal_OK,
   FPVal_PoolBufferInvalid,
@@ -467,10 +1804,75 @@ enum {
   FPVal_FragmentUnmerged,
   FPVal_FragmentUsedPastEnd,
   FPVal_FragmentPoolLengthInconsistent,
+  FPVal_SizeIndexInconsistent,
+  FPVal_LengthArrayInconsistent,
 };
 
-int
-fp_validate (fp_pool_t p)
+#if FRAGPOOL_WITH_SIZE_INDEX
+/** Verify that the size index holds exactly the available fragments,
+ * each in the list for its class. */
+static int
+validate_index (fp_pool_t p)
+{
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+  unsigned int nindexed = 0;
+  unsigned int navailable = 0;
+  unsigned int sc;
+
+  for (sc = 0; sc < FP_SIZE_CLASS_COUNT; ++sc) {
+    fp_count_t pi = FP_NO_SLOT;
+    fp_count_t fi = p->size_class_head[sc];
+
+    if ((FP_NO_SLOT == fi)
+        != (0 == (p->size_class_map & ((fp_size_class_map_t)1 << sc)))) {
+      return FPVal_SizeIndexInconsistent;
+    }
+    while (FP_NO_SLOT != fi) {
+      if ((fi >= p->fragment_count)
+          || (! FRAGMENT_IS_AVAILABLE(p->fragment + fi))
+          || (sc != size_class(p->fragment[fi].length))
+          || (pi != p->fragment[fi].size_class_prev)
+          || (++nindexed > p->fragment_count)) {
+        return FPVal_SizeIndexInconsistent;
+      }
+      pi = fi;
+      fi = p->fragment[fi].size_class_next;
+    }
+  }
+  do {
+    navailable += FRAGMENT_IS_AVAILABLE(f);
+  } while (++f < fe);
+  if (navailable != nindexed) {
+    return FPVal_SizeIndexInconsistent;
+  }
+  return FPVal_OK;
+}
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+/** Verify that the available length array, if any, matches the
+ * fragment array. */
+static int
+validate_lengths (fp_pool_t p)
+{
+  const fp_ssize_t* lp = p->available_length;
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+
+  if (NULL != lp) {
+    do {
+      if (*lp++ != (FRAGMENT_IS_AVAILABLE(f) ? f->length : 0)) {
+        return FPVal_LengthArrayInconsistent;
+      }
+    } while (++f < fe);
+  }
+  return FPVal_OK;
+}
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+
+static int
+validate_pool (fp_pool_t p)
 {
   int size = 0;
   uint8_t* b;
@@ -500,7 +1902,7 @@ fp_validate (fp_pool_t p)
       break;
     }
     /* Fragment must start where last one left off */
-    if (f->start != b) {
+    if (FP_FRAGMENT_START(p, f) != b) {
       return FPVal_FragmentWrongStart;
     }
     /* Fragment length must satisfy alignment */
@@ -533,7 +1935,84 @@ fp_validate (fp_pool_t p)
   if (ape != b) {
     return FPVal_FragmentPoolLengthInconsistent;
   }
+#if FRAGPOOL_WITH_SIZE_INDEX
+  return validate_index(p);
+#elif FRAGPOOL_WITH_LENGTH_ARRAY
+  return validate_lengths(p);
+#else /* FRAGPOOL_WITH_SIZE_INDEX */
   return FPVal_OK;
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+}
+
+void
+fp_stats (fp_pool_t p,
+          fp_stats_t sp)
+{
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+
+  memset(sp, 0, sizeof(*sp));
+  POOL_LOCK(p);
+  do {
+    if (FRAGMENT_IS_ALLOCATED(f)) {
+      ++sp->allocated_slots;
+    } else if (FRAGMENT_IS_AVAILABLE(f)) {
+      ++sp->available_slots;
+      sp->available_bytes += f->length;
+      if (f->length > sp->largest_available) {
+        sp->largest_available = f->length;
+      }
+    } else {
+      ++sp->inactive_slots;
+    }
+  } while (++f < fe);
+#if FRAGPOOL_WITH_STATS
+  sp->counters = p->counters;
+#endif /* FRAGPOOL_WITH_STATS */
+  POOL_UNLOCK(p);
+  if (0 < sp->available_bytes) {
+    sp->fragmentation = (1000ULL * (sp->available_bytes - sp->largest_available)) / sp->available_bytes;
+  }
+}
+
+#if FRAGPOOL_WITH_TRACE
+unsigned long
+fp_trace_header (fp_pool_t p,
+                 fp_trace_header_t hp)
+{
+  fp_trace_t t = p->trace;
+  unsigned long n;
+  unsigned long oldest;
+
+  POOL_LOCK(p);
+  n = t->count;
+  hp->wrapped = (n > t->capacity);
+  if (hp->wrapped) {
+    n = t->capacity;
+  }
+  oldest = (t->count - n) % t->capacity;
+  POOL_UNLOCK(p);
+  hp->magic = FP_TRACE_MAGIC;
+  hp->size_bits = FRAGPOOL_SIZE_BITS;
+  hp->alignment = p->pool_alignment;
+  hp->start_phase = (uintptr_t)p->pool_start & (p->pool_alignment - 1);
+  hp->reserved = 0;
+  hp->pool_size = p->pool_end - p->pool_start;
+  hp->fragment_count = p->fragment_count;
+  hp->count = n;
+  return oldest;
+}
+#endif /* FRAGPOOL_WITH_TRACE */
+
+int
+fp_validate (fp_pool_t p)
+{
+  int rv;
+
+  POOL_LOCK(p);
+  rv = validate_pool(p);
+  POOL_UNLOCK(p);
+  return rv;
 }
 
 #if FRAGPOOL_EXPOSE_INTERNALS
@@ -555,10 +2034,17 @@ fp_find_best_fragment (fp_pool_t p,
 }
 
 void
-fp_merge_adjacent_available (fp_fragment_t f,
+fp_merge_adjacent_available (fp_pool_t p,
+                             fp_fragment_t f,
                              fp_fragment_t fe)
 {
-  merge_adjacent_available (f, fe);
+  merge_adjacent_available (p, f, fe);
+}
+
+void
+fp_rebuild_index (fp_pool_t p)
+{
+  INDEX_REBUILD(p);
 }
 
 #endif /* FRAGPOOL_EXPOSE_INTERNALS */
@@ -0,0 +1,103 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <fragpool/group.h>
+
+uint8_t*
+fp_group_request (fp_group_t g,
+                  unsigned int shard,
+                  fp_size_t min_size,
+                  fp_size_t max_size,
+                  uint8_t** fragment_endp)
+{
+  unsigned int attempts;
+  uint8_t* bp;
+
+  if (shard >= g->pool_count) {
+    return NULL;
+  }
+  bp = fp_request(g->pool[shard], min_size, max_size, fragment_endp);
+  /* Each attempt to steal re-evaluates the victim, since other
+   * threads may be changing the shards. */
+  attempts = g->pool_count - 1;
+  while ((NULL == bp) && (0 < attempts--)) {
+    fp_pool_t victim = NULL;
+    fp_size_t victim_len = 0;
+    unsigned int pi;
+
+    for (pi = 0; pi < g->pool_count; ++pi) {
+      fp_size_t len;
+
+      if (pi == shard) {
+        continue;
+      }
+      len = fp_largest_available(g->pool[pi]);
+      if (len > victim_len) {
+        victim = g->pool[pi];
+        victim_len = len;
+      }
+    }
+    if ((NULL == victim) || (victim_len < min_size)) {
+      break;
+    }
+    bp = fp_request(victim, min_size, max_size, fragment_endp);
+  }
+  return bp;
+}
+
+fp_pool_t
+fp_group_pool (fp_group_t g,
+               const uint8_t* bp)
+{
+  unsigned int pi;
+
+  for (pi = 0; pi < g->pool_count; ++pi) {
+    fp_pool_t p = g->pool[pi];
+
+    if ((p->pool_start <= bp) && (bp < p->pool_end)) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+int
+fp_group_release (fp_group_t g,
+                  const uint8_t* bp)
+{
+  fp_pool_t p = fp_group_pool(g, bp);
+
+  if (NULL == p) {
+    return FP_EINVAL;
+  }
+  return fp_release(p, bp);
+}
@@ -0,0 +1,828 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <fragpool/linux.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+/* The most fragments submitted by one fp_send() */
+#define SEND_IOV_MAX 64
+
+#if FRAGPOOL_WITH_NOTIFY
+#include <sys/eventfd.h>
+
+static void
+post_eventfd (struct fp_pool_t* pool,
+              fp_size_t length,
+              void* context)
+{
+  fp_eventfd_t efd = context;
+  uint64_t one = 1;
+  ssize_t rc;
+
+  /* The only failure of interest is an interrupted write.  The
+   * counter cannot practically overflow. */
+  do {
+    rc = write(efd->fd, &one, sizeof(one));
+  } while ((0 > rc) && (EINTR == errno));
+}
+
+int
+fp_eventfd_attach (fp_pool_t p,
+                   fp_eventfd_t efd)
+{
+  efd->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (0 > efd->fd) {
+    return -1;
+  }
+  efd->notify.available = post_eventfd;
+  efd->notify.context = efd;
+  p->notify = &efd->notify;
+  return 0;
+}
+
+unsigned long
+fp_eventfd_clear (fp_eventfd_t efd)
+{
+  uint64_t count;
+
+  if (sizeof(count) != read(efd->fd, &count, sizeof(count))) {
+    return 0;
+  }
+  return count;
+}
+
+void
+fp_eventfd_detach (fp_pool_t p,
+                   fp_eventfd_t efd)
+{
+  if (&efd->notify == p->notify) {
+    p->notify = NULL;
+  }
+  close(efd->fd);
+  efd->fd = -1;
+}
+
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+int
+fp_chain_iovec (const struct fp_chain_t* c,
+                struct iovec* iov,
+                int iovcnt)
+{
+  unsigned long remaining = c->length;
+  unsigned int i;
+  int n = 0;
+
+  for (i = 0; (i < c->count) && (0 < remaining); ++i, ++n) {
+    const struct fp_link_t* lp = c->link + i;
+    unsigned long len = lp->end - lp->start;
+
+    if (len > remaining) {
+      len = remaining;
+    }
+    if (n < iovcnt) {
+      iov[n].iov_base = lp->start;
+      iov[n].iov_len = len;
+    }
+    remaining -= len;
+  }
+  return n;
+}
+
+void
+fp_receiver_init (fp_receiver_t rx,
+                  fp_pool_t pool,
+                  int fd,
+                  fp_size_t min_size,
+                  fp_frame_end_t frame_end,
+                  void* context)
+{
+  memset(rx, 0, sizeof(*rx));
+  rx->pool = pool;
+  rx->fd = fd;
+  rx->min_size = min_size;
+  rx->frame_end = frame_end;
+  rx->context = context;
+}
+
+/* Make room after the received data, preferably without moving it */
+static int
+extend_receiver (fp_receiver_t rx)
+{
+  uint8_t* bp;
+  uint8_t* bpe;
+
+  if (NULL == rx->start) {
+    bp = fp_request(rx->pool, rx->min_size, FP_MAX_FRAGMENT_SIZE, &bpe);
+  } else {
+    bp = fp_resize(rx->pool, rx->start, FP_MAX_FRAGMENT_SIZE, &bpe);
+    if ((NULL != bp) && (bpe == rx->end)) {
+      /* No fragment can hold more than the largest fragment size */
+      if (((unsigned long)rx->fill + rx->min_size) > FP_MAX_FRAGMENT_SIZE) {
+        bp = NULL;
+      } else {
+        bp = fp_reallocate(rx->pool, rx->start, rx->fill + rx->min_size,
+                           FP_MAX_FRAGMENT_SIZE, &bpe);
+        if (NULL != bp) {
+          rx->copied += rx->fill;
+        }
+      }
+    }
+  }
+  if (NULL == bp) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  rx->start = bp;
+  rx->end = bpe;
+  return 0;
+}
+
+/* Detach the first length octets as a frame, keeping what follows */
+static int
+deliver_frame (fp_receiver_t rx,
+               fp_size_t length,
+               uint8_t** framep)
+{
+  const fp_size_t tail = rx->fill - length;
+  const fp_size_t aligned = (length + rx->pool->pool_alignment - 1) & ~(rx->pool->pool_alignment - 1);
+  uint8_t* bp;
+  uint8_t* bpe;
+
+  if (0 == tail) {
+    fp_resize(rx->pool, rx->start, length, &bpe);
+    *framep = rx->start;
+    rx->start = NULL;
+    rx->fill = 0;
+    return 0;
+  }
+  bp = NULL;
+  if ((aligned + tail) <= (fp_size_t)(rx->end - rx->start)) {
+    bp = fp_split(rx->pool, rx->start, length, &bpe);
+    if ((NULL != bp) && (aligned != length)) {
+      memmove(bp, rx->start + length, tail);
+      rx->copied += tail;
+    }
+  }
+  if (NULL == bp) {
+    bp = fp_request(rx->pool, (tail > rx->min_size) ? tail : rx->min_size,
+                    FP_MAX_FRAGMENT_SIZE, &bpe);
+    if (NULL == bp) {
+      errno = ENOBUFS;
+      return -1;
+    }
+    memcpy(bp, rx->start + length, tail);
+    rx->copied += tail;
+    fp_resize(rx->pool, rx->start, length, &rx->end);
+  }
+  *framep = rx->start;
+  rx->start = bp;
+  rx->end = bpe;
+  rx->fill = tail;
+  return 0;
+}
+
+ssize_t
+fp_receive (fp_receiver_t rx,
+            uint8_t** framep)
+{
+  /* Data carried from the previous frame may complete another */
+  int scan = 1;
+  ssize_t rc;
+
+  while (1) {
+    if (scan && (0 < rx->fill)) {
+      fp_size_t length = rx->frame_end(rx->start, rx->fill, rx->context);
+      if (0 < length) {
+        return (0 == deliver_frame(rx, length, framep)) ? (ssize_t)length : -1;
+      }
+    }
+    if ((NULL == rx->start) || (rx->fill == (rx->end - rx->start))) {
+      if (0 != extend_receiver(rx)) {
+        return -1;
+      }
+    }
+    rc = read(rx->fd, rx->start + rx->fill, rx->end - rx->start - rx->fill);
+    if (0 > rc) {
+      if (EINTR == errno) {
+        scan = 0;
+        continue;
+      }
+      return -1;
+    }
+    if (0 == rc) {
+      return 0;
+    }
+    rx->fill += rc;
+    scan = 1;
+  }
+}
+
+void
+fp_receiver_close (fp_receiver_t rx)
+{
+  if (NULL != rx->start) {
+    fp_release(rx->pool, rx->start);
+  }
+  rx->start = NULL;
+  rx->end = NULL;
+  rx->fill = 0;
+}
+
+int
+fp_sender_init (fp_sender_t tx,
+                fp_pool_t pool,
+                int fd,
+                struct fp_send_entry_t* entry,
+                unsigned int capacity,
+                unsigned int flags)
+{
+  memset(tx, 0, sizeof(*tx));
+  tx->pool = pool;
+  tx->fd = fd;
+  tx->flags = flags;
+  tx->entry = entry;
+  tx->capacity = capacity;
+  if (FP_SEND_ZEROCOPY & flags) {
+    int one = 1;
+    if (0 != setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Return the queued fragment at a position relative to the oldest */
+static struct fp_send_entry_t*
+send_entry (fp_sender_t tx,
+            unsigned int i)
+{
+  return tx->entry + ((tx->head + i) % tx->capacity);
+}
+
+int
+fp_send_queue (fp_sender_t tx,
+               uint8_t* bp,
+               fp_size_t length)
+{
+  struct fp_send_entry_t* e;
+
+  if (tx->count == tx->capacity) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  e = send_entry(tx, tx->count++);
+  e->start = bp;
+  e->length = length;
+  e->mark = 0;
+  return 0;
+}
+
+int
+fp_send_chain (fp_sender_t tx,
+               fp_chain_t c)
+{
+  unsigned long remaining;
+  unsigned int i;
+
+  fp_chain_trim(tx->pool, c);
+  if ((tx->capacity - tx->count) < c->count) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  remaining = c->length;
+  for (i = 0; i < c->count; ++i) {
+    fp_size_t len = c->link[i].end - c->link[i].start;
+
+    if (len > remaining) {
+      len = remaining;
+    }
+    fp_send_queue(tx, c->link[i].start, len);
+    remaining -= len;
+  }
+  c->count = 0;
+  c->length = 0;
+  return 0;
+}
+
+/* Read zero-copy completions from the socket error queue */
+static void
+read_completions (fp_sender_t tx)
+{
+  union {
+    char buf[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  struct cmsghdr* cm;
+
+  while (1) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (0 > recvmsg(tx->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT)) {
+      return;
+    }
+    for (cm = CMSG_FIRSTHDR(&msg); NULL != cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      const struct sock_extended_err* ee = (const struct sock_extended_err*)CMSG_DATA(cm);
+
+      if (! (((SOL_IP == cm->cmsg_level) && (IP_RECVERR == cm->cmsg_type))
+             || ((SOL_IPV6 == cm->cmsg_level) && (IPV6_RECVERR == cm->cmsg_type)))) {
+        continue;
+      }
+      /* Stream sockets complete sends in order, so a range either
+       * extends the completed sends or repeats them. */
+      if ((0 == ee->ee_errno)
+          && (SO_EE_ORIGIN_ZEROCOPY == ee->ee_origin)
+          && (0 >= (int32_t)(ee->ee_info - tx->completed))
+          && (0 < (int32_t)(ee->ee_data + 1 - tx->completed))) {
+        tx->completed = ee->ee_data + 1;
+      }
+    }
+  }
+}
+
+unsigned int
+fp_send_reclaim (fp_sender_t tx)
+{
+  unsigned long consumed = tx->octets;
+  unsigned int released = 0;
+
+  if (FP_SEND_ZEROCOPY & tx->flags) {
+    read_completions(tx);
+  } else if (FP_SEND_VMSPLICE & tx->flags) {
+    int unread;
+    if (0 != ioctl(tx->fd, FIONREAD, &unread)) {
+      return 0;
+    }
+    consumed -= unread;
+  }
+  while (0 < tx->submitted) {
+    struct fp_send_entry_t* e = send_entry(tx, 0);
+
+    if (FP_SEND_ZEROCOPY & tx->flags) {
+      if (0 >= (int32_t)(tx->completed - (uint32_t)e->mark)) {
+        break;
+      }
+    } else if (0 > (long)(consumed - e->mark)) {
+      break;
+    }
+    fp_release(tx->pool, e->start);
+    tx->head = (tx->head + 1) % tx->capacity;
+    --tx->count;
+    --tx->submitted;
+    ++released;
+  }
+  return released;
+}
+
+ssize_t
+fp_send (fp_sender_t tx)
+{
+  struct iovec iov[SEND_IOV_MAX];
+  unsigned int i;
+  int n = 0;
+  ssize_t rc;
+  size_t left;
+
+  for (i = tx->submitted; (i < tx->count) && (n < SEND_IOV_MAX); ++i, ++n) {
+    const struct fp_send_entry_t* e = send_entry(tx, i);
+    const fp_size_t skip = (i == tx->submitted) ? tx->offset : 0;
+
+    iov[n].iov_base = e->start + skip;
+    iov[n].iov_len = e->length - skip;
+  }
+  if (0 == n) {
+    fp_send_reclaim(tx);
+    return 0;
+  }
+  if (FP_SEND_ZEROCOPY & tx->flags) {
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    rc = sendmsg(tx->fd, &msg, MSG_ZEROCOPY);
+  } else if (FP_SEND_VMSPLICE & tx->flags) {
+    rc = vmsplice(tx->fd, iov, n, 0);
+  } else {
+    rc = writev(tx->fd, iov, n);
+  }
+  if (0 > rc) {
+    return -1;
+  }
+
+  /* Record what each fragment must wait for before release */
+  left = rc;
+  while (0 < left) {
+    struct fp_send_entry_t* e = send_entry(tx, tx->submitted);
+    size_t avail = e->length - tx->offset;
+
+    e->mark = tx->next_send;
+    if (left < avail) {
+      tx->offset += left;
+      tx->octets += left;
+      break;
+    }
+    left -= avail;
+    tx->octets += avail;
+    tx->offset = 0;
+    ++tx->submitted;
+    if (! (FP_SEND_ZEROCOPY & tx->flags)) {
+      e->mark = tx->octets;
+    }
+  }
+  if (FP_SEND_ZEROCOPY & tx->flags) {
+    ++tx->next_send;
+  }
+  fp_send_reclaim(tx);
+  return rc;
+}
+
+unsigned int
+fp_sender_discard (fp_sender_t tx)
+{
+  if (0 < tx->offset) {
+    struct fp_send_entry_t* e = send_entry(tx, tx->submitted++);
+
+    e->length = tx->offset;
+    if (! (FP_SEND_ZEROCOPY & tx->flags)) {
+      e->mark = tx->octets;
+    }
+    tx->offset = 0;
+  }
+  while (tx->count > tx->submitted) {
+    fp_release(tx->pool, send_entry(tx, --tx->count)->start);
+  }
+  fp_send_reclaim(tx);
+  return tx->count;
+}
+
+/* The default huge page size, or 2 MiB if it cannot be determined */
+static size_t
+huge_page_size (void)
+{
+  size_t size = 2UL << 20;
+  FILE* fp = fopen("/proc/meminfo", "r");
+  char line[128];
+
+  if (NULL == fp) {
+    return size;
+  }
+  while (NULL != fgets(line, sizeof(line), fp)) {
+    unsigned long kb;
+    if (1 == sscanf(line, "Hugepagesize: %lu kB", &kb)) {
+      size = kb << 10;
+      break;
+    }
+  }
+  fclose(fp);
+  return size;
+}
+
+fp_pool_t
+fp_pool_map (size_t size,
+             fp_count_t fragment_count,
+             fp_alignment_t alignment,
+             unsigned int flags,
+             int* memfdp)
+{
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t huge = (flags & (FP_MAP_HUGETLB | FP_MAP_THP)) ? huge_page_size() : page;
+  size_t len = (size + huge - 1) & ~(huge - 1);
+  size_t maplen = len;
+  int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+  uint8_t* mp = MAP_FAILED;
+  uint8_t* start;
+  fp_pool_t p;
+  int fd = -1;
+  int err;
+
+  if ((0 == size)
+      || (0 == fragment_count)
+#if FRAGPOOL_WITH_SIZE_INDEX
+      || (FP_NO_SLOT <= fragment_count)
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+      || (0 == alignment)
+      || (0 != (alignment & (alignment - 1)))
+      || (FP_MAX_FRAGMENT_SIZE < len)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  p = calloc(1, sizeof(*p) + fragment_count * sizeof(*p->fragment));
+  if (NULL == p) {
+    return NULL;
+  }
+  if (FP_MAP_MEMFD & flags) {
+    fd = memfd_create("fragpool", MFD_CLOEXEC | ((FP_MAP_HUGETLB & flags) ? MFD_HUGETLB : 0));
+    if ((0 > fd) || (0 != ftruncate(fd, len))) {
+      goto fail;
+    }
+    mflags = MAP_SHARED;
+  } else if (FP_MAP_HUGETLB & flags) {
+    mflags |= MAP_HUGETLB;
+  } else if (FP_MAP_THP & flags) {
+    /* Over-map so the pool can start on a huge page boundary */
+    maplen += huge;
+  }
+  mp = mmap(NULL, maplen, PROT_READ | PROT_WRITE, mflags, fd, 0);
+  if (MAP_FAILED == mp) {
+    goto fail;
+  }
+  start = mp;
+  if (maplen > len) {
+    start = (uint8_t*)(((uintptr_t)mp + huge - 1) & ~(uintptr_t)(huge - 1));
+    if (start > mp) {
+      munmap(mp, start - mp);
+    }
+    if ((start + len) < (mp + maplen)) {
+      munmap(start + len, (mp + maplen) - (start + len));
+    }
+    mp = start;
+    maplen = len;
+  }
+  if (FP_MAP_THP & flags) {
+    /* Advisory: the pool works without huge pages */
+    (void)madvise(start, len, MADV_HUGEPAGE);
+  }
+  if (FP_MAP_PREFAULT & flags) {
+    volatile uint8_t* vp = start;
+    size_t off;
+    for (off = 0; off < len; off += page) {
+      vp[off] = 0;
+    }
+  }
+  if ((FP_MAP_MLOCK & flags) && (0 != mlock(start, len))) {
+    goto fail;
+  }
+  if (NULL != memfdp) {
+    *memfdp = fd;
+  } else if (0 <= fd) {
+    close(fd);
+  }
+  p->pool_start = start;
+  p->pool_end = start + len;
+  p->pool_alignment = alignment;
+  p->fragment_count = fragment_count;
+  fp_reset(p);
+  return p;
+
+fail:
+  err = errno;
+  if (MAP_FAILED != mp) {
+    munmap(mp, maplen);
+  }
+  if (0 <= fd) {
+    close(fd);
+  }
+  free(p);
+  errno = err;
+  return NULL;
+}
+
+void
+fp_pool_unmap (fp_pool_t p)
+{
+  munmap(p->pool_start, p->pool_end - p->pool_start);
+  free(p);
+}
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+
+#if FRAGPOOL_WITH_LOCK
+#define TRIM_LOCK(_p) do {                              \
+    if (NULL != (_p)->lock) {                           \
+      (_p)->lock->lock((_p)->lock->context);            \
+    }                                                   \
+  } while (0)
+#define TRIM_UNLOCK(_p) do {                            \
+    if (NULL != (_p)->lock) {                           \
+      (_p)->lock->unlock((_p)->lock->context);          \
+    }                                                   \
+  } while (0)
+#else /* FRAGPOOL_WITH_LOCK */
+#define TRIM_LOCK(_p) do { } while (0)
+#define TRIM_UNLOCK(_p) do { } while (0)
+#endif /* FRAGPOOL_WITH_LOCK */
+
+/* The number of pages from the trimmer base that overlap the pool */
+static size_t
+trimmer_pages (fp_trimmer_t tr)
+{
+  return (tr->pool->pool_end - tr->base + tr->page_size - 1) / tr->page_size;
+}
+
+int
+fp_trimmer_init (fp_trimmer_t tr,
+                 fp_pool_t pool,
+                 int advice,
+                 fp_size_t min_length)
+{
+  const size_t page = sysconf(_SC_PAGESIZE);
+  size_t npages;
+
+  memset(tr, 0, sizeof(*tr));
+  tr->pool = pool;
+  tr->advice = advice;
+  tr->min_length = min_length;
+  tr->page_size = page;
+  tr->base = (uint8_t*)((uintptr_t)pool->pool_start & ~(uintptr_t)(page - 1));
+  npages = trimmer_pages(tr);
+  tr->trimmed = calloc((npages + BITS_PER_WORD - 1) / BITS_PER_WORD, sizeof(*tr->trimmed));
+  tr->residency = malloc(npages);
+  if ((NULL == tr->trimmed) || (NULL == tr->residency)) {
+    fp_trimmer_destroy(tr);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+page_is_trimmed (fp_trimmer_t tr,
+                 size_t pi)
+{
+  return 0 != (tr->trimmed[pi / BITS_PER_WORD] & (1UL << (pi % BITS_PER_WORD)));
+}
+
+/* Forget that a page was trimmed if it has been faulted back in */
+static void
+check_refault (fp_trimmer_t tr,
+               size_t pi,
+               int allocated)
+{
+  int refaulted;
+
+  if (! page_is_trimmed(tr, pi)) {
+    return;
+  }
+  if (MADV_FREE == tr->advice) {
+    refaulted = allocated;
+  } else {
+    refaulted = tr->residency[pi] & 1;
+  }
+  if (refaulted) {
+    tr->trimmed[pi / BITS_PER_WORD] &= ~(1UL << (pi % BITS_PER_WORD));
+    --tr->trimmed_pages;
+    ++tr->pages_refaulted;
+  }
+}
+
+/* Advise a run of untrimmed pages and record them as trimmed */
+static void
+trim_pages (fp_trimmer_t tr,
+            size_t pi,
+            size_t pe)
+{
+  size_t i;
+
+  if ((pi == pe)
+      || (0 != madvise(tr->base + pi * tr->page_size, (pe - pi) * tr->page_size, tr->advice))) {
+    return;
+  }
+  ++tr->advise_calls;
+  for (i = pi; i < pe; ++i) {
+    tr->trimmed[i / BITS_PER_WORD] |= 1UL << (i % BITS_PER_WORD);
+  }
+  tr->trimmed_pages += pe - pi;
+  tr->pages_trimmed += pe - pi;
+}
+
+unsigned long
+fp_trim (fp_trimmer_t tr)
+{
+  fp_pool_t p = tr->pool;
+  const size_t page = tr->page_size;
+  const unsigned long before = tr->pages_trimmed;
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+
+  TRIM_LOCK(p);
+  if ((0 < tr->trimmed_pages)
+      && (0 != mincore(tr->base, trimmer_pages(tr) * page, tr->residency))) {
+    memset(tr->residency, 0, trimmer_pages(tr));
+  }
+  for (; (f < fe) && (0 != f->length); ++f) {
+    const size_t lo = FP_FRAGMENT_START(p, f) - tr->base;
+    const size_t hi = lo + ((0 > f->length) ? -f->length : f->length);
+    size_t pi;
+
+    if (0 > f->length) {
+      for (pi = lo / page; pi < (hi + page - 1) / page; ++pi) {
+        check_refault(tr, pi, 1);
+      }
+    } else if (f->length >= tr->min_length) {
+      const size_t pe = hi / page;
+      size_t ps = (lo + page - 1) / page;
+
+      for (pi = ps; pi < pe; ++pi) {
+        check_refault(tr, pi, 0);
+        if (page_is_trimmed(tr, pi)) {
+          trim_pages(tr, ps, pi);
+          ps = pi + 1;
+        }
+      }
+      trim_pages(tr, ps, pe);
+    }
+  }
+  TRIM_UNLOCK(p);
+  return tr->pages_trimmed - before;
+}
+
+unsigned long
+fp_trimmer_resident (fp_trimmer_t tr)
+{
+  const size_t npages = trimmer_pages(tr);
+  unsigned long resident = 0;
+  size_t i;
+
+  if (0 != mincore(tr->base, npages * tr->page_size, tr->residency)) {
+    return 0;
+  }
+  for (i = 0; i < npages; ++i) {
+    resident += tr->residency[i] & 1;
+  }
+  return resident;
+}
+
+#if FRAGPOOL_WITH_NOTIFY
+
+static void
+trim_available (struct fp_pool_t* pool,
+                fp_size_t length,
+                void* context)
+{
+  fp_trimmer_t tr = context;
+
+  if (NULL != tr->chained) {
+    tr->chained->available(pool, length, tr->chained->context);
+  }
+  if (length >= tr->threshold) {
+    fp_trim(tr);
+  }
+}
+
+void
+fp_trimmer_attach (fp_trimmer_t tr,
+                   fp_size_t threshold)
+{
+  tr->threshold = threshold;
+  tr->notify.available = trim_available;
+  tr->notify.context = tr;
+  tr->chained = tr->pool->notify;
+  tr->pool->notify = &tr->notify;
+}
+
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+void
+fp_trimmer_destroy (fp_trimmer_t tr)
+{
+#if FRAGPOOL_WITH_NOTIFY
+  if (&tr->notify == tr->pool->notify) {
+    tr->pool->notify = tr->chained;
+  }
+#endif /* FRAGPOOL_WITH_NOTIFY */
+  free(tr->trimmed);
+  free(tr->residency);
+  tr->trimmed = NULL;
+  tr->residency = NULL;
+}
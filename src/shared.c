@@ -0,0 +1,251 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/shared.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if (FRAGPOOL_WITH_LOCK) && ! (FRAGPOOL_WITH_SIZE_INDEX)
+
+static size_t
+slots_size (fp_count_t fragment_count)
+{
+  return sizeof(struct fp_shared_header_t)
+    + fragment_count * sizeof(struct fp_shared_fragment_t);
+}
+
+/* Round the end of the slots up so the pool memory is aligned */
+static size_t
+data_offset (fp_count_t fragment_count,
+             fp_alignment_t alignment)
+{
+  return (slots_size(fragment_count) + alignment - 1) & ~(size_t)(alignment - 1);
+}
+
+/* Convert slots changed by another process to addresses in this one */
+static void
+import_slots (fp_shared_t sh)
+{
+  const fp_shared_header_t hp = sh->header;
+  fp_pool_t p = sh->pool;
+  fp_count_t i;
+
+  for (i = 0; i < hp->active; ++i) {
+    FP_FRAGMENT_SET_START(p, p->fragment + i, p->pool_start + hp->fragment[i].offset);
+    p->fragment[i].length = hp->fragment[i].length;
+#if FRAGPOOL_WITH_HANDLES
+    p->fragment[i].generation = hp->fragment[i].generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
+  }
+  if (sh->active > hp->active) {
+    memset(p->fragment + hp->active, 0, (sh->active - hp->active) * sizeof(*p->fragment));
+  }
+#if FRAGPOOL_WITH_HANDLES
+  p->generation = hp->generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
+  sh->active = hp->active;
+  sh->version = hp->version;
+}
+
+/* Store slots changed by this process as offsets */
+static void
+export_slots (fp_shared_t sh)
+{
+  const fp_shared_header_t hp = sh->header;
+  fp_pool_t p = sh->pool;
+  int changed = 0;
+  fp_count_t i;
+
+  for (i = 0; (i < p->fragment_count) && (0 != p->fragment[i].length); ++i) {
+    struct fp_shared_fragment_t sf;
+
+    memset(&sf, 0, sizeof(sf));
+    sf.offset = FP_FRAGMENT_START(p, p->fragment + i) - p->pool_start;
+    sf.length = p->fragment[i].length;
+#if FRAGPOOL_WITH_HANDLES
+    sf.generation = p->fragment[i].generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
+    if ((i >= hp->active) || (0 != memcmp(&sf, hp->fragment + i, sizeof(sf)))) {
+      hp->fragment[i] = sf;
+      changed = 1;
+    }
+  }
+  if (changed || (i != hp->active)) {
+    hp->active = i;
+#if FRAGPOOL_WITH_HANDLES
+    hp->generation = p->generation;
+#endif /* FRAGPOOL_WITH_HANDLES */
+    ++hp->version;
+  }
+  sh->active = i;
+  sh->version = hp->version;
+}
+
+static void
+shared_lock (void* context)
+{
+  fp_shared_t sh = context;
+
+  if (EOWNERDEAD == pthread_mutex_lock(&sh->header->mutex)) {
+    /* The slots may be inconsistent; take them as they are */
+    pthread_mutex_consistent(&sh->header->mutex);
+    sh->version = sh->header->version - 1;
+  }
+  if (sh->version != sh->header->version) {
+    import_slots(sh);
+  }
+}
+
+static void
+shared_unlock (void* context)
+{
+  fp_shared_t sh = context;
+
+  export_slots(sh);
+  pthread_mutex_unlock(&sh->header->mutex);
+}
+
+size_t
+fp_shared_size (fp_size_t pool_size,
+                fp_count_t fragment_count,
+                fp_alignment_t alignment)
+{
+  return data_offset(fragment_count, alignment) + pool_size;
+}
+
+/* Nonzero if a pool of this geometry can be placed in a segment */
+static int
+valid_geometry (fp_size_t pool_size,
+                fp_count_t fragment_count,
+                fp_alignment_t alignment)
+{
+  return (0 != fragment_count)
+    && (0 != alignment)
+    && (0 == (alignment & (alignment - 1)))
+    && ((long)alignment <= sysconf(_SC_PAGESIZE))
+    && (alignment <= pool_size);
+}
+
+int
+fp_shared_format (void* segment,
+                  fp_size_t pool_size,
+                  fp_count_t fragment_count,
+                  fp_alignment_t alignment)
+{
+  fp_shared_header_t hp = segment;
+  pthread_mutexattr_t attr;
+  int rc;
+
+  if (! valid_geometry(pool_size, fragment_count, alignment)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(hp, 0, slots_size(fragment_count));
+  hp->magic = FP_SHARED_MAGIC;
+  hp->slot_size = sizeof(struct fp_shared_fragment_t);
+  hp->alignment = alignment;
+  hp->fragment_count = fragment_count;
+  hp->active = 1;
+  hp->data_offset = data_offset(fragment_count, alignment);
+  hp->data_size = pool_size;
+  hp->fragment[0].length = pool_size & ~(fp_size_t)(alignment - 1);
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  rc = pthread_mutex_init(&hp->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (0 != rc) {
+    errno = rc;
+    return -1;
+  }
+  return 0;
+}
+
+int
+fp_shared_attach (fp_shared_t sh,
+                  void* segment)
+{
+  fp_shared_header_t hp = segment;
+  fp_pool_t p;
+
+  if ((FP_SHARED_MAGIC != hp->magic)
+      || (sizeof(struct fp_shared_fragment_t) != hp->slot_size)
+      || (! valid_geometry(hp->data_size, hp->fragment_count, hp->alignment))
+      || (data_offset(hp->fragment_count, hp->alignment) != hp->data_offset)) {
+    errno = EINVAL;
+    return -1;
+  }
+  p = calloc(1, sizeof(*p) + hp->fragment_count * sizeof(*p->fragment));
+  if (NULL == p) {
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(sh, 0, sizeof(*sh));
+  sh->header = hp;
+  sh->pool = p;
+  sh->lock.lock = shared_lock;
+  sh->lock.unlock = shared_unlock;
+  sh->lock.context = sh;
+  sh->lock.shared = 1;
+  sh->version = hp->version - 1;
+  p->pool_start = (uint8_t*)segment + hp->data_offset;
+  p->pool_end = p->pool_start + hp->data_size;
+  p->pool_alignment = hp->alignment;
+  p->fragment_count = hp->fragment_count;
+  p->lock = &sh->lock;
+  return 0;
+}
+
+fp_size_t
+fp_shared_offset (fp_shared_t sh,
+                  const uint8_t* bp)
+{
+  return bp - sh->pool->pool_start;
+}
+
+uint8_t*
+fp_shared_pointer (fp_shared_t sh,
+                   fp_size_t offset)
+{
+  return sh->pool->pool_start + offset;
+}
+
+void
+fp_shared_detach (fp_shared_t sh)
+{
+  free(sh->pool);
+  sh->pool = NULL;
+}
+
+#endif /* FRAGPOOL_WITH_LOCK && ! FRAGPOOL_WITH_SIZE_INDEX */
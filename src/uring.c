@@ -0,0 +1,189 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <fragpool/uring.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static int
+uring_register (int fd,
+                unsigned int opcode,
+                void* arg,
+                unsigned int nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int
+fp_uring_register_pool (int ring_fd,
+                        fp_pool_t p)
+{
+  struct iovec iov;
+
+  iov.iov_base = p->pool_start;
+  iov.iov_len = p->pool_end - p->pool_start;
+  return uring_register(ring_fd, IORING_REGISTER_BUFFERS, &iov, 1);
+}
+
+int
+fp_uring_setup (fp_uring_bufs_t bufs,
+                fp_pool_t pool,
+                int ring_fd,
+                uint16_t bgid,
+                unsigned int entries,
+                uint8_t** start,
+                fp_size_t min_size,
+                fp_size_t max_size)
+{
+  struct io_uring_buf_reg reg;
+  void* mem;
+
+  if ((0 == entries) || (32768 < entries) || (0 != (entries & (entries - 1)))) {
+    errno = EINVAL;
+    return -1;
+  }
+  mem = mmap(NULL, entries * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+             MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (MAP_FAILED == mem) {
+    return -1;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)mem;
+  reg.ring_entries = entries;
+  reg.bgid = bgid;
+  if (0 != uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+    int err = errno;
+    munmap(mem, entries * sizeof(struct io_uring_buf));
+    errno = err;
+    return -1;
+  }
+  memset(bufs, 0, sizeof(*bufs));
+  bufs->pool = pool;
+  bufs->ring_fd = ring_fd;
+  bufs->bgid = bgid;
+  bufs->entries = entries;
+  bufs->min_size = min_size;
+  bufs->max_size = max_size;
+  bufs->start = start;
+  bufs->br = mem;
+  memset(start, 0, entries * sizeof(*start));
+  fp_uring_refill(bufs);
+  return 0;
+}
+
+unsigned int
+fp_uring_refill (fp_uring_bufs_t bufs)
+{
+  const unsigned int mask = bufs->entries - 1;
+  unsigned int added = 0;
+  unsigned int bid = 0;
+
+  while (bufs->count < bufs->entries) {
+    struct io_uring_buf* bp;
+    uint8_t* fp;
+    uint8_t* fpe;
+
+    fp = fp_request(bufs->pool, bufs->min_size, bufs->max_size, &fpe);
+    if (NULL == fp) {
+      break;
+    }
+    /* There are as many unused IDs as unused entries */
+    while (NULL != bufs->start[bid]) {
+      ++bid;
+    }
+    bufs->start[bid] = fp;
+    bp = bufs->br->bufs + (bufs->tail++ & mask);
+    bp->addr = (uintptr_t)fp;
+    bp->len = fpe - fp;
+    bp->bid = bid;
+    ++bufs->count;
+    ++added;
+  }
+  if (0 < added) {
+    __atomic_store_n(&bufs->br->tail, bufs->tail, __ATOMIC_RELEASE);
+  }
+  return added;
+}
+
+uint8_t*
+fp_uring_take (fp_uring_bufs_t bufs,
+               uint32_t cqe_flags,
+               int32_t res,
+               uint8_t** fragment_endp)
+{
+  unsigned int bid;
+  uint8_t* bp;
+
+  if (! (IORING_CQE_F_BUFFER & cqe_flags)) {
+    return NULL;
+  }
+  bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+  if (bid >= bufs->entries) {
+    return NULL;
+  }
+  bp = bufs->start[bid];
+  if (NULL == bp) {
+    return NULL;
+  }
+  bufs->start[bid] = NULL;
+  --bufs->count;
+  if (0 >= res) {
+    fp_release(bufs->pool, bp);
+    return NULL;
+  }
+  return fp_resize(bufs->pool, bp, res, fragment_endp);
+}
+
+void
+fp_uring_teardown (fp_uring_bufs_t bufs)
+{
+  struct io_uring_buf_reg reg;
+  unsigned int bid;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.bgid = bufs->bgid;
+  uring_register(bufs->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  for (bid = 0; bid < bufs->entries; ++bid) {
+    if (NULL != bufs->start[bid]) {
+      fp_release(bufs->pool, bufs->start[bid]);
+      bufs->start[bid] = NULL;
+    }
+  }
+  bufs->count = 0;
+  munmap(bufs->br, bufs->entries * sizeof(struct io_uring_buf));
+  bufs->br = NULL;
+}
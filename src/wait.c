@@ -0,0 +1,213 @@
+/* Copyright 2012-2017, Peter A. Bigot
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the software nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/wait.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#if FRAGPOOL_WITH_NOTIFY
+
+struct fp_waiter_t {
+  /** The next waiter in arrival order */
+  struct fp_waiter_t* next;
+
+  /** The parameters of the request */
+  fp_size_t min_size;
+  fp_size_t max_size;
+  uint8_t** fragment_endp;
+
+  /** The fragment allocated for the waiter, set when it is removed
+   * from the queue */
+  uint8_t* bp;
+
+  /** Signalled when the waiter has been given a fragment */
+  pthread_cond_t cond;
+};
+
+/** Allocate fragments for waiters in arrival order until one cannot be
+ * satisfied, waking each that is served.  The queue mutex must be
+ * held. */
+static void
+serve_waiters (fp_wait_queue_t wq)
+{
+  struct fp_waiter_t* w;
+
+  while (NULL != (w = wq->head)) {
+    w->bp = fp_request(wq->pool, w->min_size, w->max_size, w->fragment_endp);
+    if (NULL == w->bp) {
+      break;
+    }
+    wq->head = w->next;
+    if (NULL == wq->head) {
+      wq->tail = NULL;
+    }
+    pthread_cond_signal(&w->cond);
+  }
+}
+
+static void
+space_available (struct fp_pool_t* pool,
+                 fp_size_t length,
+                 void* context)
+{
+  fp_wait_queue_t wq = context;
+
+  pthread_mutex_lock(&wq->mutex);
+  /* The longest fragment is normally checked against the head before
+   * attempting an allocation, but another thread may already have
+   * consumed it. */
+  if ((NULL != wq->head) && (wq->head->min_size <= length)) {
+    serve_waiters(wq);
+  }
+  pthread_mutex_unlock(&wq->mutex);
+}
+
+/** Remove a waiter that gave up.  If it was the oldest the next
+ * waiter may be satisfiable, so the queue is served again.  The queue
+ * mutex must be held. */
+static void
+remove_waiter (fp_wait_queue_t wq,
+               struct fp_waiter_t* w)
+{
+  struct fp_waiter_t** wp = &wq->head;
+  struct fp_waiter_t* prev = NULL;
+
+  while (*wp != w) {
+    prev = *wp;
+    wp = &prev->next;
+  }
+  *wp = w->next;
+  if (wq->tail == w) {
+    wq->tail = prev;
+  }
+  if (NULL == prev) {
+    serve_waiters(wq);
+  }
+}
+
+int
+fp_wait_queue_init (fp_wait_queue_t wq,
+                    fp_pool_t p)
+{
+  int rc = pthread_mutex_init(&wq->mutex, NULL);
+
+  if (0 != rc) {
+    return rc;
+  }
+  wq->pool = p;
+  wq->head = wq->tail = NULL;
+  wq->notify.available = space_available;
+  wq->notify.context = wq;
+  p->notify = &wq->notify;
+  return 0;
+}
+
+void
+fp_wait_queue_destroy (fp_wait_queue_t wq)
+{
+  if (&wq->notify == wq->pool->notify) {
+    wq->pool->notify = NULL;
+  }
+  pthread_mutex_destroy(&wq->mutex);
+}
+
+unsigned int
+fp_wait_queue_length (fp_wait_queue_t wq)
+{
+  unsigned int rv = 0;
+  struct fp_waiter_t* w;
+
+  pthread_mutex_lock(&wq->mutex);
+  for (w = wq->head; NULL != w; w = w->next) {
+    ++rv;
+  }
+  pthread_mutex_unlock(&wq->mutex);
+  return rv;
+}
+
+uint8_t*
+fp_request_wait (fp_wait_queue_t wq,
+                 fp_size_t min_size,
+                 fp_size_t max_size,
+                 uint8_t** fragment_endp,
+                 const struct timespec* abstime)
+{
+  struct fp_waiter_t w;
+  pthread_condattr_t attr;
+  int rc = 0;
+
+  /* Validate arguments, since invalid requests would wait forever */
+  if ((0 >= min_size) || (min_size > max_size) || (NULL == fragment_endp)) {
+    return NULL;
+  }
+  pthread_mutex_lock(&wq->mutex);
+  /* Do not overtake requests that are already waiting */
+  if (NULL == wq->head) {
+    w.bp = fp_request(wq->pool, min_size, max_size, fragment_endp);
+    if (NULL != w.bp) {
+      pthread_mutex_unlock(&wq->mutex);
+      return w.bp;
+    }
+  }
+
+  w.next = NULL;
+  w.min_size = min_size;
+  w.max_size = max_size;
+  w.fragment_endp = fragment_endp;
+  w.bp = NULL;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&w.cond, &attr);
+  pthread_condattr_destroy(&attr);
+  if (NULL == wq->tail) {
+    wq->head = &w;
+  } else {
+    wq->tail->next = &w;
+  }
+  wq->tail = &w;
+
+  while ((NULL == w.bp) && (ETIMEDOUT != rc)) {
+    if (NULL == abstime) {
+      rc = pthread_cond_wait(&w.cond, &wq->mutex);
+    } else {
+      rc = pthread_cond_timedwait(&w.cond, &wq->mutex, abstime);
+    }
+  }
+  if (NULL == w.bp) {
+    remove_waiter(wq, &w);
+  }
+  pthread_mutex_unlock(&wq->mutex);
+  pthread_cond_destroy(&w.cond);
+  return w.bp;
+}
+
+#endif /* FRAGPOOL_WITH_NOTIFY */
@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#if FRAGPOOL_WITH_LOCK
+#include <pthread.h>
+#include <limits.h>
+#endif /* FRAGPOOL_WITH_LOCK */
 
 #define FRAGMENT_IS_ALLOCATED(_f) (0 > (_f)->length)
 #define FRAGMENT_IS_AVAILABLE(_f) (0 < (_f)->length)
@@ -21,6 +25,9 @@ int clean_suite (void)
 #define POOL_SIZE 256
 #define POOL_FRAGMENTS 6
 
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+static fp_ssize_t pool_lengths[POOL_FRAGMENTS];
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
 static uint8_t pool_data[POOL_SIZE];
 static union {
   struct {
@@ -33,11 +40,17 @@ static union {
     .pool_start = pool_data,
     .pool_end = pool_data + sizeof(pool_data),
     .pool_alignment = 1,
-    .fragment_count = POOL_FRAGMENTS
+    .fragment_count = POOL_FRAGMENTS,
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+    .available_length = pool_lengths,
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
   }
 };
 fp_pool_t const pool = &pool_union.generic;
 
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+static fp_ssize_t apool_lengths[POOL_FRAGMENTS];
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
 static uint8_t apool_data[2+POOL_SIZE];
 static union {
   struct {
@@ -50,20 +63,24 @@ static union {
     .pool_start = apool_data+1,
     .pool_end = apool_data+1 + POOL_SIZE,
     .pool_alignment = 2,
-    .fragment_count = POOL_FRAGMENTS
+    .fragment_count = POOL_FRAGMENTS,
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+    .available_length = apool_lengths,
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
   }
 };
 fp_pool_t const apool = &apool_union.generic;
 
 static void
-show_fragments (fp_fragment_t f,
+show_fragments (fp_pool_t p,
+                fp_fragment_t f,
                 fp_fragment_t fe)
 {
   do {
     if (FRAGMENT_IS_ALLOCATED(f)) {
-      printf(" %u allocated at %p\n", -f->length, f->start);
+      printf(" %u allocated at %p\n", -f->length, FP_FRAGMENT_START(p, f));
     } else if (FRAGMENT_IS_AVAILABLE(f)) {
-      printf(" %u available at %p\n", f->length, f->start);
+      printf(" %u available at %p\n", f->length, FP_FRAGMENT_START(p, f));
     } else {
       printf(" unused fragment\n");
     }
@@ -78,7 +95,7 @@ show_pool (fp_pool_t p)
   printf("Pool %p with %u fragments and %u bytes from %p to %p:\n",
          (void*)p, p->fragment_count, (fp_size_t)(p->pool_end-p->pool_start),
          p->pool_start, p->pool_end);
-  show_fragments(f, fe);
+  show_fragments(p, f, fe);
 }
 
 static void
@@ -97,7 +114,7 @@ show_short_pool (fp_pool_t p)
   } while (0)
 
 #define CU_ASSERT_POOL_IS_RESET(_p) do {                                \
-    CU_ASSERT_EQUAL(p->fragment[0].start, p->pool_start);               \
+    CU_ASSERT_EQUAL(FP_FRAGMENT_START(p, p->fragment), p->pool_start);  \
     CU_ASSERT_EQUAL(p->fragment[0].length, (p->pool_end - p->pool_start)); \
     CU_ASSERT_EQUAL(0, fp_validate(_p));                                \
   } while (0)
@@ -118,16 +135,17 @@ config_pool (fp_pool_t p, ...)
       break;
     }
     f->length = len;
-    f[1].start = f[0].start + abs(len);
+    FP_FRAGMENT_SET_START(p, f+1, FP_FRAGMENT_START(p, f) + abs(len));
     ++f;
   }
   if (f < fe) {
-    f->length = p->pool_end - f->start;
+    f->length = p->pool_end - FP_FRAGMENT_START(p, f);
     if (0 > len) {
       f->length = - f->length;
     }
   }
   va_end(ap);
+  fp_rebuild_index(p);
 }
 
 #define RF_DONE_WITH_LEFTOVERS -2
@@ -146,7 +164,7 @@ release_fragments (fp_pool_t p, ...)
     if (0 > fi) {
       break;
     }
-    rc = fp_release(p, f[fi].start);
+    rc = fp_release(p, FP_FRAGMENT_START(p, f+fi));
     CU_ASSERT_EQUAL(0, rc);
     CU_ASSERT_EQUAL(0, fp_validate(p));
   }
@@ -208,7 +226,7 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
       }
       case PO_RELEASE: {        /* release: PO_RELEASE fragment_index */
         int fi = va_arg(ap, int);
-        uint8_t* b = p->fragment[fi].start;
+        uint8_t* b = FP_FRAGMENT_START(p, p->fragment+fi);
         int rc;
         printf("\trelease fragment %u at %p ... ", fi, b);
         rc = fp_release(p, b);
@@ -235,8 +253,8 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
         int offset = va_arg(ap, int);
         int len = va_arg(ap, int);
         fp_fragment_t f = p->fragment + fi;
-        uint8_t* b = f->start;
-        uint8_t* be = f->start + abs(f->length);
+        uint8_t* b = FP_FRAGMENT_START(p, f);
+        uint8_t* be = FP_FRAGMENT_START(p, f) + abs(f->length);
         if ((0 > len) || (len > abs(f->length))) {
           len = abs(f->length);
         }
@@ -278,8 +296,8 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
         int offset = va_arg(ap, int);
         int len = va_arg(ap, int);
         fp_fragment_t f = p->fragment + fi;
-        uint8_t* b = f->start + offset;
-        uint8_t* be = f->start + abs(f->length);
+        uint8_t* b = FP_FRAGMENT_START(p, f) + offset;
+        uint8_t* be = FP_FRAGMENT_START(p, f) + abs(f->length);
         b += offset;
         if ((0 > len) || (len > abs(f->length))) {
           len = abs(f->length);
@@ -299,8 +317,8 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
                p->pool_start, p->pool_end);
         for (fi = 0; fi < p->fragment_count; ++fi) {
           fp_fragment_t f = p->fragment + fi;
-          uint8_t* b = f->start;
-          uint8_t* be = f->start + abs(f->length);
+          uint8_t* b = FP_FRAGMENT_START(p, f);
+          uint8_t* be = FP_FRAGMENT_START(p, f) + abs(f->length);
 
           printf("\t\t%u: ", fi);
           if (FRAGMENT_IS_INACTIVE(f)) {
@@ -308,9 +326,9 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
             continue;
           }
           if (FRAGMENT_IS_ALLOCATED(f)) {
-            printf("%u allocated at %p: ", -f->length, f->start);
+            printf("%u allocated at %p: ", -f->length, FP_FRAGMENT_START(p, f));
           } else {
-            printf("%u available at %p: ", f->length, f->start);
+            printf("%u available at %p: ", f->length, FP_FRAGMENT_START(p, f));
           }
           while (b < be) {
             putchar(*b++);
@@ -322,7 +340,7 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
       case PO_DISPLAY_FRAGMENT: { /* display fragment: PO_DISPLAY_FRAGMENT fragment_index */
         int fi = va_arg(ap, int);
         fp_fragment_t f = p->fragment + fi;
-        uint8_t* b = f->start;
+        uint8_t* b = FP_FRAGMENT_START(p, f);
         uint8_t* be = b + abs(f->length);
 
         printf("\tfragment %d@%u:\n\t\t", f->length, fi);
@@ -345,7 +363,7 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
         uint8_t* be;
 
         printf("\tresize fragment %d@%u to %u ... ", f->length, fi, len);
-        b = fp_resize(p, f->start, len, &be);
+        b = fp_resize(p, FP_FRAGMENT_START(p, f), len, &be);
         if (NULL != b) {
           printf("got %u at %p\n", (int)(be-b), b);
         } else {
@@ -357,7 +375,7 @@ execute_pool_ops (fp_pool_t p, const char* file, int lineno, ...)
         int fi = va_arg(ap, int);
         int min_size = va_arg(ap, int);
         int max_size = va_arg(ap, int);
-        uint8_t* b = p->fragment[fi].start;
+        uint8_t* b = FP_FRAGMENT_START(p, p->fragment+fi);
         uint8_t* be;
 
         printf("\treallocate %d@%u %u..%u ... ", p->fragment[fi].length, fi, min_size, max_size);
@@ -392,7 +410,7 @@ void
 test_fp_reset (void)
 {
   fp_reset(pool);
-  CU_ASSERT_EQUAL(pool->fragment[0].start, pool->pool_start);
+  CU_ASSERT_EQUAL(FP_FRAGMENT_START(pool, pool->fragment), pool->pool_start);
   CU_ASSERT_EQUAL(pool->fragment[0].length, pool->pool_end - pool->pool_start);
 }
 
@@ -437,7 +455,7 @@ test_fp_request (void)
   /* -32@0 -32@1 64@2 -64@3 -64@4 0@5 */
   CU_ASSERT_EQUAL(b, p->pool_start);
   CU_ASSERT_EQUAL(bpe, b + 32);
-  CU_ASSERT_EQUAL(p->pool_start+32, f[1].start);
+  CU_ASSERT_EQUAL(p->pool_start+32, FP_FRAGMENT_START(p, f+1));
   CU_ASSERT_EQUAL(-32, f[1].length);
 
   /* Check that allocation finds first appropriately-sized block
@@ -447,8 +465,8 @@ test_fp_request (void)
   CU_ASSERT_EQUAL(0, fp_validate(p));
   b = fp_request(p, 24, 64, &bpe);
   /* 32@0 -32@1 -64@2 -64@3 -64@4 0@5 */
-  CU_ASSERT_EQUAL(b, f[2].start);
-  CU_ASSERT_EQUAL(bpe, f[2].start-f[2].length);
+  CU_ASSERT_EQUAL(b, FP_FRAGMENT_START(p, f+2));
+  CU_ASSERT_EQUAL(bpe, FP_FRAGMENT_START(p, f+2)-f[2].length);
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
   /* Check that allocation finds first appropriately-sized block
@@ -458,8 +476,8 @@ test_fp_request (void)
   CU_ASSERT_EQUAL(0, fp_validate(p));
   b = fp_request(p, 24, 64, &bpe);
   /* -32@0 -32@1 -64@2 -64@3 -64@4 0@5 */
-  CU_ASSERT_EQUAL(b, f[0].start);
-  CU_ASSERT_EQUAL(bpe, f[0].start-f[0].length);
+  CU_ASSERT_EQUAL(b, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL(bpe, FP_FRAGMENT_START(p, f)-f[0].length);
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
   /* Check that allocation reduces first appropriately-sized block, if
@@ -472,7 +490,7 @@ test_fp_request (void)
   /* 32@0 -32@1 -48@2 16@3 -64@4 -64@5 */
   CU_ASSERT_EQUAL(b, p->pool_start+64);
   CU_ASSERT_EQUAL(bpe, b + 48);
-  CU_ASSERT_EQUAL(bpe, f[3].start);
+  CU_ASSERT_EQUAL(bpe, FP_FRAGMENT_START(p, f+3));
   CU_ASSERT_EQUAL(16, f[3].length);
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
@@ -483,13 +501,129 @@ test_fp_request (void)
   /* -32@0 -32@1 -48@2 16@3 -64@4 -64@5 */
   CU_ASSERT_EQUAL(b, p->pool_start);
   CU_ASSERT_EQUAL(bpe, b + 32);
-  CU_ASSERT_EQUAL(bpe, f[1].start);
+  CU_ASSERT_EQUAL(bpe, FP_FRAGMENT_START(p, f+1));
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
   /* -32@1, -64@4, -32@0, -48@2, -64@5 */
   release_fragments(p, 1, 4, 0, 1, 1, RF_DONE);
 }
 
+void
+test_fp_request_many ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  struct fp_fragment_t saved[POOL_FRAGMENTS];
+  struct fp_request_t req[3];
+  int i;
+
+  config_pool(p, 40, -16, 100, -FP_MAX_FRAGMENT_SIZE);
+  memcpy(saved, f, sizeof(saved));
+  CU_ASSERT_EQUAL(0, fp_request_many(p, req, 0));
+
+  req[0].min_size = 32;
+  req[0].max_size = 16;
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_request_many(p, req, 1));
+
+  /* If the last cannot be satisfied the others are undone */
+  req[0].min_size = req[0].max_size = 32;
+  req[1].min_size = req[1].max_size = 64;
+  req[2].min_size = req[2].max_size = 200;
+  CU_ASSERT_EQUAL(FP_ENOMEM, fp_request_many(p, req, 3));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  for (i = 0; i < 4; ++i) {
+    CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, saved+i), FP_FRAGMENT_START(p, f+i));
+    CU_ASSERT_EQUAL(saved[i].length, f[i].length);
+  }
+  CU_ASSERT_EQUAL(0, f[4].length);
+  for (i = 0; i < 3; ++i) {
+    CU_ASSERT_PTR_NULL(req[i].start);
+    CU_ASSERT_PTR_NULL(req[i].end);
+  }
+#if FRAGPOOL_WITH_STATS
+  /* The undone allocations do not raise the high-water marks */
+  CU_ASSERT_EQUAL(1, p->counters.failures);
+  CU_ASSERT_EQUAL(0, p->counters.allocated_bytes);
+  CU_ASSERT_EQUAL(0, p->counters.max_allocated_bytes);
+  CU_ASSERT_EQUAL(1, p->counters.max_active_slots);
+#endif /* FRAGPOOL_WITH_STATS */
+
+  /* Later requests see the remainders of earlier ones */
+  req[2].min_size = req[2].max_size = 8;
+  CU_ASSERT_EQUAL(0, fp_request_many(p, req, 3));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_PTR_EQUAL(req[0].start, p->pool_start);
+  CU_ASSERT_PTR_EQUAL(req[0].end, p->pool_start + 32);
+  CU_ASSERT_PTR_EQUAL(req[1].start, p->pool_start + 56);
+  CU_ASSERT_PTR_EQUAL(req[1].end, p->pool_start + 120);
+  CU_ASSERT_PTR_EQUAL(req[2].start, p->pool_start + 32);
+  CU_ASSERT_PTR_EQUAL(req[2].end, p->pool_start + 40);
+  CU_ASSERT_EQUAL(36, f[4].length);
+#if FRAGPOOL_WITH_STATS
+  CU_ASSERT_EQUAL(104, p->counters.allocated_bytes);
+  CU_ASSERT_EQUAL(104, p->counters.max_allocated_bytes);
+  CU_ASSERT_EQUAL(6, p->counters.max_active_slots);
+#endif /* FRAGPOOL_WITH_STATS */
+}
+
+void
+test_fp_stats ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  struct fp_stats_t st;
+  uint8_t* b;
+  uint8_t* be;
+
+  fp_reset(p);
+  fp_stats(p, &st);
+  CU_ASSERT_EQUAL(POOL_SIZE, st.available_bytes);
+  CU_ASSERT_EQUAL(POOL_SIZE, st.largest_available);
+  CU_ASSERT_EQUAL(0, st.allocated_slots);
+  CU_ASSERT_EQUAL(1, st.available_slots);
+  CU_ASSERT_EQUAL(POOL_FRAGMENTS - 1, st.inactive_slots);
+  CU_ASSERT_EQUAL(0, st.fragmentation);
+  CU_ASSERT_EQUAL(0, st.counters.requests);
+
+  config_pool(p, 40, -16, 120, -FP_MAX_FRAGMENT_SIZE);
+  fp_stats(p, &st);
+  CU_ASSERT_EQUAL(160, st.available_bytes);
+  CU_ASSERT_EQUAL(120, st.largest_available);
+  CU_ASSERT_EQUAL(2, st.allocated_slots);
+  CU_ASSERT_EQUAL(2, st.available_slots);
+  CU_ASSERT_EQUAL(2, st.inactive_slots);
+  CU_ASSERT_EQUAL(250, st.fragmentation);
+
+#if FRAGPOOL_WITH_STATS
+  /* config_pool does not account for what it allocated */
+  b = fp_request(p, 100, 100, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(p, f+2));
+  CU_ASSERT_PTR_NULL(fp_request(p, 100, 100, &be));
+  CU_ASSERT_PTR_EQUAL(b, fp_resize(p, b, 60, &be));
+  b = fp_reallocate(p, b, 10, 40, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL(40, be - b);
+  fp_stats(p, &st);
+  CU_ASSERT_EQUAL(2, st.counters.requests);
+  CU_ASSERT_EQUAL(1, st.counters.failures);
+  CU_ASSERT_EQUAL(1, st.counters.resizes);
+  CU_ASSERT_EQUAL(1, st.counters.reallocations);
+  CU_ASSERT_EQUAL(1, st.counters.moves);
+  CU_ASSERT_EQUAL(10, st.counters.bytes_copied);
+  CU_ASSERT_EQUAL(40, st.counters.allocated_bytes);
+  CU_ASSERT_EQUAL(100, st.counters.max_allocated_bytes);
+  CU_ASSERT_EQUAL(5, st.counters.max_active_slots);
+  CU_ASSERT_EQUAL(0, fp_release(p, b));
+  fp_stats(p, &st);
+  CU_ASSERT_EQUAL(0, st.counters.allocated_bytes);
+  CU_ASSERT_EQUAL(100, st.counters.max_allocated_bytes);
+#else /* FRAGPOOL_WITH_STATS */
+  (void)f;
+  (void)b;
+  (void)be;
+#endif /* FRAGPOOL_WITH_STATS */
+}
+
 void
 test_fp_merge_adjacent_available ()
 {
@@ -498,20 +632,20 @@ test_fp_merge_adjacent_available ()
   fp_fragment_t fe = p->fragment + p->fragment_count;
 
   config_pool(p, 64, 32, 64, FP_MAX_FRAGMENT_SIZE);
-  fp_merge_adjacent_available(f, fe);
-  CU_ASSERT_PTR_EQUAL(f[0].start, p->pool_start);
+  fp_merge_adjacent_available(p, f, fe);
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f), p->pool_start);
   CU_ASSERT_EQUAL(f[0].length, 96);
-  CU_ASSERT_PTR_EQUAL(f[1].start, f[0].start+f[0].length);
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f+1), FP_FRAGMENT_START(p, f)+f[0].length);
   CU_ASSERT_EQUAL(f[1].length, 64);
-  CU_ASSERT_EQUAL(f[2].length, (p->pool_end - f[2].start));
+  CU_ASSERT_EQUAL(f[2].length, (p->pool_end - FP_FRAGMENT_START(p, f+2)));
 
   config_pool(p, 64, 32, 64, FP_MAX_FRAGMENT_SIZE);
-  fp_merge_adjacent_available(f+1, fe);
-  CU_ASSERT_PTR_EQUAL(f[0].start, p->pool_start);
+  fp_merge_adjacent_available(p, f+1, fe);
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f), p->pool_start);
   CU_ASSERT_EQUAL(f[0].length, 64);
-  CU_ASSERT_PTR_EQUAL(f[1].start, f[0].start+f[0].length);
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f+1), FP_FRAGMENT_START(p, f)+f[0].length);
   CU_ASSERT_EQUAL(f[1].length, 96);
-  CU_ASSERT_EQUAL(f[2].length, (p->pool_end - f[2].start));
+  CU_ASSERT_EQUAL(f[2].length, (p->pool_end - FP_FRAGMENT_START(p, f+2)));
 }
 
 void
@@ -519,13 +653,23 @@ test_fp_get_fragment ()
 {
   fp_pool_t p = pool;
   fp_fragment_t f = p->fragment;
+  uint8_t* bpe;
 
   config_pool(p, 64, 32, 64, FP_MAX_FRAGMENT_SIZE);
-  CU_ASSERT_PTR_EQUAL(f, fp_get_fragment(p, f->start));
-  CU_ASSERT_PTR_EQUAL(f+1, fp_get_fragment(p, f[1].start));
-  CU_ASSERT_PTR_EQUAL(f+1, fp_get_fragment(p, f[0].start + f[0].length));
-  CU_ASSERT_PTR_EQUAL(f+2, fp_get_fragment(p, f[2].start));
-  CU_ASSERT_PTR_NULL(fp_get_fragment(p, f->start+32));
+  CU_ASSERT_PTR_EQUAL(f, fp_get_fragment(p, FP_FRAGMENT_START(p, f)));
+  CU_ASSERT_PTR_EQUAL(f+1, fp_get_fragment(p, FP_FRAGMENT_START(p, f+1)));
+  CU_ASSERT_PTR_EQUAL(f+1, fp_get_fragment(p, FP_FRAGMENT_START(p, f) + f[0].length));
+  CU_ASSERT_PTR_EQUAL(f+2, fp_get_fragment(p, FP_FRAGMENT_START(p, f+2)));
+  CU_ASSERT_PTR_NULL(fp_get_fragment(p, FP_FRAGMENT_START(p, f)+32));
+  CU_ASSERT_PTR_NULL(fp_get_fragment(p, p->pool_end));
+  CU_ASSERT_PTR_NULL(fp_get_fragment(p, NULL));
+
+  /* Inactive slots retain stale starts after a merge */
+  fp_reset(p);
+  fp_release(p, fp_request(p, 16, 16, &bpe));
+  CU_ASSERT_EQUAL(0, f[1].length);
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f+1), FP_FRAGMENT_START(p, f) + 16);
+  CU_ASSERT_PTR_NULL(fp_get_fragment(p, FP_FRAGMENT_START(p, f+1)));
 }
 
 void
@@ -536,7 +680,7 @@ test_fp_release_params ()
 
   config_pool(p, FP_MAX_FRAGMENT_SIZE);
   CU_ASSERT_EQUAL(FP_EINVAL, fp_release(p, NULL));
-  CU_ASSERT_EQUAL(FP_EINVAL, fp_release(p, f[0].start));
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release(p, FP_FRAGMENT_START(p, f)));
 }
 
 void
@@ -550,25 +694,25 @@ test_fp_release ()
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
   CU_ASSERT_EQUAL(-11, f[1].length);
-  rv = fp_release(p, f[1].start);
+  rv = fp_release(p, FP_FRAGMENT_START(p, f+1));
   CU_ASSERT_EQUAL(0, rv);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(11, f[1].length);
 
   CU_ASSERT_EQUAL(-10, f[0].length);
-  rv = fp_release(p, f[0].start);
+  rv = fp_release(p, FP_FRAGMENT_START(p, f));
   CU_ASSERT_EQUAL(0, rv);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(21, f[0].length);
 
   CU_ASSERT_EQUAL(-12, f[1].length);
-  rv = fp_release(p, f[1].start);
+  rv = fp_release(p, FP_FRAGMENT_START(p, f+1));
   CU_ASSERT_EQUAL(0, rv);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(33, f[0].length);
 
   CU_ASSERT_EQUAL(-13, f[1].length);
-  rv = fp_release(p, f[1].start);
+  rv = fp_release(p, FP_FRAGMENT_START(p, f+1));
   CU_ASSERT_EQUAL(0, rv);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(POOL_SIZE, f[0].length);
@@ -577,20 +721,223 @@ test_fp_release ()
   config_pool(p, -10, -11, -FP_MAX_FRAGMENT_SIZE);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(-11, f[1].length);
-  rv = fp_release(p, f[1].start);
+  rv = fp_release(p, FP_FRAGMENT_START(p, f+1));
   CU_ASSERT_EQUAL(0, rv);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(-10, f[0].length);
-  CU_ASSERT_EQUAL(f[2].length, -(p->pool_end - f[2].start));
+  CU_ASSERT_EQUAL(f[2].length, -(p->pool_end - FP_FRAGMENT_START(p, f+2)));
 
-  rv = fp_release(p, f[2].start);
+  rv = fp_release(p, FP_FRAGMENT_START(p, f+2));
   CU_ASSERT_EQUAL(0, rv);
   CU_ASSERT_EQUAL(0, fp_validate(p));
   CU_ASSERT_EQUAL(-10, f[0].length);
-  CU_ASSERT_EQUAL(f[1].length, (p->pool_end - f[1].start));
+  CU_ASSERT_EQUAL(f[1].length, (p->pool_end - FP_FRAGMENT_START(p, f+1)));
   CU_ASSERT_EQUAL(0, f[2].length);
 }
 
+void
+test_fp_release_many ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  const uint8_t* bps[5];
+
+  config_pool(p, -10, -11, -12, -13, -14, -FP_MAX_FRAGMENT_SIZE);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(0, fp_release_many(p, bps, 0));
+
+  /* Invalid and duplicate entries are diagnosed but do not prevent
+   * release of the others */
+  bps[0] = FP_FRAGMENT_START(p, f+4);
+  bps[1] = FP_FRAGMENT_START(p, f+2);
+  bps[2] = FP_FRAGMENT_START(p, f+1) + 1;
+  bps[3] = FP_FRAGMENT_START(p, f+1);
+  bps[4] = FP_FRAGMENT_START(p, f+2);
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release_many(p, bps, 5));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(-10, f[0].length);
+  CU_ASSERT_EQUAL(23, f[1].length);
+  CU_ASSERT_EQUAL(-13, f[2].length);
+  CU_ASSERT_EQUAL(14, f[3].length);
+  CU_ASSERT(0 > f[4].length);
+  CU_ASSERT_EQUAL(0, f[5].length);
+
+  /* Releasing the rest merges everything, compacting once */
+  bps[0] = FP_FRAGMENT_START(p, f+4);
+  bps[1] = FP_FRAGMENT_START(p, f);
+  bps[2] = FP_FRAGMENT_START(p, f+2);
+  CU_ASSERT_EQUAL(0, fp_release_many(p, bps, 3));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(POOL_SIZE, f[0].length);
+  CU_ASSERT_EQUAL(0, f[1].length);
+  CU_ASSERT_EQUAL(0, f[4].length);
+}
+
+typedef struct compact_state {
+  const uint8_t* pinned;
+  unsigned int nmoved;
+  uint8_t* old_start[POOL_FRAGMENTS];
+  uint8_t* new_start[POOL_FRAGMENTS];
+} compact_state;
+
+static void
+record_move (fp_pool_t p,
+             uint8_t* old_start,
+             uint8_t* new_start,
+             fp_size_t length,
+             void* context)
+{
+  compact_state* cs = context;
+
+  CU_ASSERT_EQUAL(old_start[0], length);
+  cs->old_start[cs->nmoved] = old_start;
+  cs->new_start[cs->nmoved] = new_start;
+  ++cs->nmoved;
+}
+
+static int
+check_pinned (fp_pool_t p,
+              const uint8_t* start,
+              void* context)
+{
+  compact_state* cs = context;
+  return start == cs->pinned;
+}
+
+/* Allocated fragments of 32, 48, and 80 octets separated by
+ * available space, each filled with its length */
+static void
+config_compact_pool (fp_pool_t p)
+{
+  fp_fragment_t f = p->fragment;
+
+  config_pool(p, 16, -32, 16, -48, 64, -FP_MAX_FRAGMENT_SIZE);
+  memset(FP_FRAGMENT_START(p, f+1), 32, 32);
+  memset(FP_FRAGMENT_START(p, f+3), 48, 48);
+  memset(FP_FRAGMENT_START(p, f+5), 80, 80);
+}
+
+void
+test_fp_compact ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  uint8_t* const ps = p->pool_start;
+  compact_state cs = { NULL };
+  const struct fp_relocate_t hooks = { record_move, check_pinned, &cs };
+
+  /* Everything slides down, leaving one available fragment */
+  config_compact_pool(p);
+  CU_ASSERT_EQUAL(160, fp_compact(p, &hooks));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(3, cs.nmoved);
+  CU_ASSERT_PTR_EQUAL(ps + 16, cs.old_start[0]);
+  CU_ASSERT_PTR_EQUAL(ps, cs.new_start[0]);
+  CU_ASSERT_PTR_EQUAL(ps + 176, cs.old_start[2]);
+  CU_ASSERT_PTR_EQUAL(ps + 80, cs.new_start[2]);
+  CU_ASSERT_PTR_EQUAL(ps, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL(-32, f[0].length);
+  CU_ASSERT_EQUAL(48, FP_FRAGMENT_START(p, f+1)[47]);
+  CU_ASSERT_EQUAL(-48, f[1].length);
+  CU_ASSERT_EQUAL(80, FP_FRAGMENT_START(p, f+2)[79]);
+  CU_ASSERT_EQUAL(-80, f[2].length);
+  CU_ASSERT_PTR_EQUAL(ps + 160, FP_FRAGMENT_START(p, f+3));
+  CU_ASSERT_EQUAL(96, f[3].length);
+  CU_ASSERT_EQUAL(0, f[4].length);
+  CU_ASSERT_EQUAL(0, f[5].length);
+  CU_ASSERT_EQUAL(0, fp_compact(p, &hooks));
+  CU_ASSERT_EQUAL(3, cs.nmoved);
+
+  /* A pinned fragment stays, with the space before it */
+  config_compact_pool(p);
+  cs.nmoved = 0;
+  cs.pinned = FP_FRAGMENT_START(p, f+3);
+  CU_ASSERT_EQUAL(112, fp_compact(p, &hooks));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(2, cs.nmoved);
+  CU_ASSERT_EQUAL(-32, f[0].length);
+  CU_ASSERT_EQUAL(32, f[1].length);
+  CU_ASSERT_PTR_EQUAL(ps + 64, FP_FRAGMENT_START(p, f+2));
+  CU_ASSERT_EQUAL(-48, f[2].length);
+  CU_ASSERT_PTR_EQUAL(ps + 112, FP_FRAGMENT_START(p, f+3));
+  CU_ASSERT_EQUAL(80, FP_FRAGMENT_START(p, f+3)[0]);
+  CU_ASSERT_EQUAL(-80, f[3].length);
+  CU_ASSERT_EQUAL(64, f[4].length);
+  CU_ASSERT_EQUAL(0, f[5].length);
+  cs.pinned = NULL;
+
+  /* Steps stop before exceeding the budget, but always progress */
+  config_compact_pool(p);
+  cs.nmoved = 0;
+  CU_ASSERT_EQUAL(32, fp_compact_step(p, &hooks, 40));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(32, f[1].length);
+  CU_ASSERT_EQUAL(-48, f[2].length);
+  CU_ASSERT_EQUAL(64, f[3].length);
+  CU_ASSERT_EQUAL(48, fp_compact_step(p, &hooks, 40));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(-48, f[1].length);
+  CU_ASSERT_EQUAL(96, f[2].length);
+  CU_ASSERT_EQUAL(80, fp_compact_step(p, &hooks, 40));
+  CU_ASSERT_EQUAL(0, fp_compact_step(p, &hooks, 40));
+  CU_ASSERT_EQUAL(3, cs.nmoved);
+  CU_ASSERT_EQUAL(96, f[3].length);
+  CU_ASSERT_EQUAL(80, FP_FRAGMENT_START(p, f+2)[0]);
+
+  /* Without hooks nothing is pinned */
+  config_compact_pool(p);
+  CU_ASSERT_EQUAL(160, fp_compact(p, NULL));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(96, f[3].length);
+  fp_reset(p);
+}
+
+void
+test_fp_split ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  uint8_t* b;
+  uint8_t* be;
+  uint8_t* sp;
+
+  fp_reset(p);
+  b = fp_request(p, 64, 64, &be);
+  memset(b, 0x5a, 64);
+  CU_ASSERT_PTR_NULL(fp_split(p, b, 0, &be));
+  CU_ASSERT_PTR_NULL(fp_split(p, b, 16, NULL));
+  CU_ASSERT_PTR_NULL(fp_split(p, b, 64, &be));
+  CU_ASSERT_PTR_NULL(fp_split(p, FP_FRAGMENT_START(p, f+1), 16, &be));
+  CU_ASSERT_PTR_NULL(fp_split(p, b+1, 16, &be));
+
+  /* Both parts stay allocated and the data stays in place */
+  sp = fp_split(p, b, 16, &be);
+  CU_ASSERT_PTR_EQUAL(b + 16, sp);
+  CU_ASSERT_PTR_EQUAL(b + 64, be);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(-16, f[0].length);
+  CU_ASSERT_EQUAL(-48, f[1].length);
+  CU_ASSERT_EQUAL(POOL_SIZE - 64, f[2].length);
+  CU_ASSERT_EQUAL(0x5a, sp[47]);
+  CU_ASSERT_EQUAL(0, fp_release(p, b));
+  CU_ASSERT_EQUAL(0, fp_release(p, sp));
+  CU_ASSERT_POOL_IS_RESET(p);
+
+  /* The retained length is aligned */
+  fp_reset(apool);
+  b = fp_request(apool, 16, 16, &be);
+  sp = fp_split(apool, b, 7, &be);
+  CU_ASSERT_PTR_EQUAL(b + 8, sp);
+  CU_ASSERT_EQUAL(8, be - sp);
+  CU_ASSERT_EQUAL(0, fp_validate(apool));
+
+  /* A slot is required */
+  config_pool(p, -16, -16, -16, -16, -16, -FP_MAX_FRAGMENT_SIZE);
+  CU_ASSERT_PTR_NULL(fp_split(p, FP_FRAGMENT_START(p, f), 8, &be));
+  CU_ASSERT_EQUAL(-16, f[0].length);
+  fp_reset(p);
+}
+
 void
 test_fp_resize_params ()
 {
@@ -601,7 +948,7 @@ test_fp_resize_params ()
   fp_reset(p);
   CU_ASSERT_POOL_IS_RESET(p);
   CU_ASSERT_PTR_NULL(fp_resize(p, NULL, FP_MAX_FRAGMENT_SIZE, &bpe));
-  CU_ASSERT_PTR_NULL(fp_resize(p, f->start, FP_MAX_FRAGMENT_SIZE, &bpe));
+  CU_ASSERT_PTR_NULL(fp_resize(p, FP_FRAGMENT_START(p, f), FP_MAX_FRAGMENT_SIZE, &bpe));
 }
 
 void
@@ -615,11 +962,11 @@ test_fp_reallocate_params ()
   CU_ASSERT_POOL_IS_RESET(p);
   CU_ASSERT_PTR_NULL(fp_reallocate(p, NULL, 2, 4, &bpe));
   config_pool(p, 32, -32, 64, -64, -FP_MAX_FRAGMENT_SIZE);
-  CU_ASSERT_PTR_NULL(fp_reallocate(p, f[1].start, 4, 2, &bpe));
-  CU_ASSERT_PTR_NULL(fp_reallocate(p, f[1].start, 2, 4, NULL));
-  CU_ASSERT_PTR_NULL(fp_reallocate(p, f[0].start, 2, 4, &bpe));
-  CU_ASSERT_PTR_NULL(fp_reallocate(p, f[1].start, 200, FP_MAX_FRAGMENT_SIZE, &bpe));
-  CU_ASSERT_PTR_NOT_NULL(fp_reallocate(p, f[1].start, 2, 4, &bpe));
+  CU_ASSERT_PTR_NULL(fp_reallocate(p, FP_FRAGMENT_START(p, f+1), 4, 2, &bpe));
+  CU_ASSERT_PTR_NULL(fp_reallocate(p, FP_FRAGMENT_START(p, f+1), 2, 4, NULL));
+  CU_ASSERT_PTR_NULL(fp_reallocate(p, FP_FRAGMENT_START(p, f), 2, 4, &bpe));
+  CU_ASSERT_PTR_NULL(fp_reallocate(p, FP_FRAGMENT_START(p, f+1), 200, FP_MAX_FRAGMENT_SIZE, &bpe));
+  CU_ASSERT_PTR_NOT_NULL(fp_reallocate(p, FP_FRAGMENT_START(p, f+1), 2, 4, &bpe));
   fp_reset(p);
 }
 
@@ -851,8 +1198,8 @@ test_execute_reallocate ()
                    PO_RELEASE, 1,
                    PO_DISPLAY_POOL,
                    PO_END_COMMANDS);
-  b = fp_reallocate(pool, pool->fragment[0].start, 96, 128, &be);
-  CU_ASSERT_PTR_EQUAL(b, pool->fragment[0].start);
+  b = fp_reallocate(pool, FP_FRAGMENT_START(pool, pool->fragment), 96, 128, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(pool, pool->fragment));
   CU_ASSERT_EQUAL(128, (int)(be-b));
   execute_pool_ops(pool, __FILE__, __LINE__,
                    PO_DISPLAY_POOL,
@@ -870,8 +1217,8 @@ test_execute_reallocate ()
                    PO_ALLOCATE, 64, 64,
                    PO_DISPLAY_POOL,
                    PO_END_COMMANDS);
-  b = fp_reallocate(pool, pool->fragment[0].start, 96, 128, &be);
-  CU_ASSERT_PTR_EQUAL(b, pool->fragment[2].start);
+  b = fp_reallocate(pool, FP_FRAGMENT_START(pool, pool->fragment), 96, 128, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(pool, pool->fragment+2));
   CU_ASSERT_EQUAL(128, (int)(be-b));
   execute_pool_ops(pool, __FILE__, __LINE__,
                    PO_DISPLAY_POOL,
@@ -891,8 +1238,8 @@ test_execute_reallocate ()
                    PO_ALLOCATE, 64, 64,
                    PO_DISPLAY_POOL,
                    PO_END_COMMANDS);
-  b = fp_reallocate(pool, pool->fragment[0].start, 32, 96, &be);
-  CU_ASSERT_PTR_EQUAL(b, pool->fragment[2].start);
+  b = fp_reallocate(pool, FP_FRAGMENT_START(pool, pool->fragment), 32, 96, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(pool, pool->fragment+2));
   CU_ASSERT_EQUAL(96, (int)(be-b));
   execute_pool_ops(pool, __FILE__, __LINE__,
                    PO_DISPLAY_POOL,
@@ -916,8 +1263,8 @@ test_execute_reallocate ()
                    PO_RELEASE, 1,
                    PO_DISPLAY_POOL,
                    PO_END_COMMANDS);
-  b = fp_reallocate(pool, pool->fragment[2].start, 96, 128, &be);
-  CU_ASSERT_PTR_EQUAL(b, pool->fragment[1].start);
+  b = fp_reallocate(pool, FP_FRAGMENT_START(pool, pool->fragment+2), 96, 128, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(pool, pool->fragment+1));
   CU_ASSERT_EQUAL(128, (int)(be-b));
   execute_pool_ops(pool, __FILE__, __LINE__,
                    PO_DISPLAY_POOL,
@@ -944,8 +1291,8 @@ test_execute_reallocate ()
                    PO_RELEASE, 3,
                    PO_DISPLAY_POOL,
                    PO_END_COMMANDS);
-  b = fp_reallocate(pool, pool->fragment[2].start, 32, 160, &be);
-  CU_ASSERT_PTR_EQUAL(b, pool->fragment[1].start);
+  b = fp_reallocate(pool, FP_FRAGMENT_START(pool, pool->fragment+2), 32, 160, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(pool, pool->fragment+1));
   CU_ASSERT_EQUAL(160, (int)(be-b));
   execute_pool_ops(pool, __FILE__, __LINE__,
                    PO_DISPLAY_POOL,
@@ -973,8 +1320,8 @@ test_execute_reallocate ()
                    PO_ALLOCATE, 128, 128,
                    PO_DISPLAY_POOL,
                    PO_END_COMMANDS);
-  b = fp_reallocate(pool, pool->fragment[2].start, 32, 32, &be);
-  CU_ASSERT_PTR_EQUAL(b, pool->fragment[0].start);
+  b = fp_reallocate(pool, FP_FRAGMENT_START(pool, pool->fragment+2), 32, 32, &be);
+  CU_ASSERT_PTR_EQUAL(b, FP_FRAGMENT_START(pool, pool->fragment));
   CU_ASSERT_EQUAL(32, (int)(be-b));
   execute_pool_ops(pool, __FILE__, __LINE__,
                    PO_DISPLAY_POOL,
@@ -1015,25 +1362,25 @@ test_pool_alignment ()
   ps = (uintptr_t)p->pool_start;
   pe = (uintptr_t)p->pool_end;
   CU_ASSERT_EQUAL(1, ps & 1);
-  CU_ASSERT_PTR_NOT_EQUAL(p->pool_start, f->start);
+  CU_ASSERT_PTR_NOT_EQUAL(p->pool_start, FP_FRAGMENT_START(p, f));
   CU_ASSERT_EQUAL(1, pe & 1);
-  CU_ASSERT_PTR_NOT_EQUAL(p->pool_end, f->start + f->length);
+  CU_ASSERT_PTR_NOT_EQUAL(p->pool_end, FP_FRAGMENT_START(p, f) + f->length);
 
   b = fp_request(p, 3, 9, &be);
-  CU_ASSERT_EQUAL(b, f->start);
-  CU_ASSERT_EQUAL(be, f->start - f->length);
+  CU_ASSERT_EQUAL(b, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL(be, FP_FRAGMENT_START(p, f) - f->length);
   CU_ASSERT_EQUAL(-10, f->length);
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
   b = fp_resize(p, b, 15, &be);
-  CU_ASSERT_EQUAL(b, f->start);
-  CU_ASSERT_EQUAL(be, f->start - f->length);
+  CU_ASSERT_EQUAL(b, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL(be, FP_FRAGMENT_START(p, f) - f->length);
   CU_ASSERT_EQUAL(-16, f->length);
   CU_ASSERT_EQUAL(0, fp_validate(p));
 
   b = fp_resize(p, b, FP_MAX_FRAGMENT_SIZE, &be);
-  CU_ASSERT_EQUAL(b, f->start);
-  CU_ASSERT_EQUAL(be, f->start - f->length);
+  CU_ASSERT_EQUAL(b, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL(be, FP_FRAGMENT_START(p, f) - f->length);
   CU_ASSERT_EQUAL(-254, f->length);
   CU_ASSERT_EQUAL(0, f[1].length);
   CU_ASSERT_EQUAL(0, fp_validate(p));
@@ -1113,6 +1460,646 @@ test_pool_alignment ()
                    PO_END_COMMANDS);
 }
 
+#if FRAGPOOL_WITH_LOCK
+typedef struct lock_state {
+  int depth;
+  int max_depth;
+  int acquisitions;
+} lock_state;
+
+static void
+count_lock (void* context)
+{
+  lock_state* ls = context;
+  if (++ls->depth > ls->max_depth) {
+    ls->max_depth = ls->depth;
+  }
+  ++ls->acquisitions;
+}
+
+static void
+count_unlock (void* context)
+{
+  lock_state* ls = context;
+  --ls->depth;
+}
+
+void
+test_lock_hooks ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  lock_state ls = { 0 };
+  const struct fp_lock_t hooks = { count_lock, count_unlock, &ls };
+  uint8_t* b;
+  uint8_t* be;
+
+  fp_reset(p);
+  p->lock = &hooks;
+
+  b = fp_request(p, 16, 16, &be);
+  CU_ASSERT_PTR_NOT_NULL(b);
+  CU_ASSERT_EQUAL(1, ls.acquisitions);
+  CU_ASSERT_PTR_EQUAL(b, fp_resize(p, b, 32, &be));
+  CU_ASSERT_EQUAL(2, ls.acquisitions);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(3, ls.acquisitions);
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release(p, b+1));
+  CU_ASSERT_EQUAL(4, ls.acquisitions);
+
+  /* Reallocation in place does not drop the lock */
+  ls.acquisitions = 0;
+  CU_ASSERT_PTR_EQUAL(b, fp_reallocate(p, b, 48, 48, &be));
+  CU_ASSERT_EQUAL(1, ls.acquisitions);
+
+  /* Reallocation that moves the data copies it without the lock */
+  config_pool(p, 32, -16, -32, 40, -FP_MAX_FRAGMENT_SIZE);
+  memset(FP_FRAGMENT_START(p, f+1), 'x', 16);
+  ls.acquisitions = 0;
+  b = fp_reallocate(p, FP_FRAGMENT_START(p, f+1), 16, 40, &be);
+  CU_ASSERT_PTR_EQUAL(b, p->pool_start + 80);
+  CU_ASSERT_EQUAL(2, ls.acquisitions);
+  CU_ASSERT_EQUAL('x', b[0]);
+  CU_ASSERT_EQUAL('x', b[15]);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  /* Shifting into the preceding fragment also copies without it */
+  config_pool(p, -32, 32, -16, 64, -FP_MAX_FRAGMENT_SIZE);
+  memset(FP_FRAGMENT_START(p, f+2), 'y', 16);
+  ls.acquisitions = 0;
+  b = fp_reallocate(p, FP_FRAGMENT_START(p, f+2), 16, 100, &be);
+  CU_ASSERT_PTR_EQUAL(b, p->pool_start + 32);
+  CU_ASSERT_EQUAL(be - b, 100);
+  CU_ASSERT_EQUAL(2, ls.acquisitions);
+  CU_ASSERT_EQUAL('y', b[0]);
+  CU_ASSERT_EQUAL('y', b[15]);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  CU_ASSERT_EQUAL(1, ls.max_depth);
+  CU_ASSERT_EQUAL(0, ls.depth);
+  p->lock = NULL;
+  fp_reset(p);
+}
+
+/* Lock hooks that, once armed, compact the pool from another thread
+ * as soon as the lock is released. */
+typedef struct compact_race {
+  pthread_mutex_t mutex;
+  fp_pool_t pool;
+  int armed;
+  unsigned long compacted;
+} compact_race;
+
+static void*
+run_compact (void* arg)
+{
+  compact_race* cr = arg;
+
+  cr->compacted = fp_compact_step(cr->pool, NULL, ULONG_MAX);
+  return NULL;
+}
+
+static void
+race_lock (void* context)
+{
+  compact_race* cr = context;
+  pthread_mutex_lock(&cr->mutex);
+}
+
+static void
+race_unlock (void* context)
+{
+  compact_race* cr = context;
+  pthread_t thread;
+
+  pthread_mutex_unlock(&cr->mutex);
+  if (cr->armed) {
+    cr->armed = 0;
+    pthread_create(&thread, NULL, run_compact, cr);
+    pthread_join(thread, NULL);
+  }
+}
+
+void
+test_lock_compact ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  uint8_t* const ps = p->pool_start;
+  compact_race cr = { PTHREAD_MUTEX_INITIALIZER, pool };
+  const struct fp_lock_t hooks = { race_lock, race_unlock, &cr };
+  uint8_t* b;
+  uint8_t* be;
+
+  /* Compaction that runs while fp_reallocate() copies with the pool
+   * unlocked leaves the source and destination in place */
+  config_pool(p, 32, -16, -32, 40, FP_MAX_FRAGMENT_SIZE);
+  memset(FP_FRAGMENT_START(p, f+1), 'x', 16);
+  memset(FP_FRAGMENT_START(p, f+2), 'o', 32);
+  p->lock = &hooks;
+  cr.armed = 1;
+  b = fp_reallocate(p, ps + 32, 16, 40, &be);
+  CU_ASSERT_EQUAL(0, cr.armed);
+  CU_ASSERT_EQUAL(0, cr.compacted);
+  CU_ASSERT_PTR_EQUAL(b, ps + 80);
+  CU_ASSERT_EQUAL(be - b, 40);
+  CU_ASSERT_EQUAL('x', b[0]);
+  CU_ASSERT_EQUAL('x', b[15]);
+  CU_ASSERT_EQUAL('o', ps[48]);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  /* Once the copy is done the pool compacts normally */
+  CU_ASSERT_EQUAL(72, fp_compact(p, NULL));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_PTR_EQUAL(ps, FP_FRAGMENT_START(p, f));
+  CU_ASSERT_EQUAL('o', ps[0]);
+  CU_ASSERT_EQUAL('x', ps[32]);
+  CU_ASSERT_EQUAL('x', ps[47]);
+  p->lock = NULL;
+  fp_reset(p);
+}
+#endif /* FRAGPOOL_WITH_LOCK */
+
+#if FRAGPOOL_WITH_NOTIFY
+typedef struct notify_state {
+  int count;
+  fp_size_t length;
+} notify_state;
+
+static void
+record_notify (fp_pool_t p,
+               fp_size_t length,
+               void* context)
+{
+  notify_state* ns = context;
+  ++ns->count;
+  ns->length = length;
+}
+
+void
+test_notify ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  notify_state ns = { 0 };
+  const struct fp_notify_t hook = { record_notify, &ns };
+  uint8_t* b;
+  uint8_t* be;
+
+  config_pool(p, -32, 16, -32, 48, -FP_MAX_FRAGMENT_SIZE);
+  p->notify = &hook;
+
+  /* Releasing into a fragment no longer than the longest is silent */
+  CU_ASSERT_EQUAL(0, fp_release(p, FP_FRAGMENT_START(p, f)));
+  CU_ASSERT_EQUAL(48, f[0].length);
+  CU_ASSERT_EQUAL(0, ns.count);
+
+  /* Shrinking into the longest fragment grows it */
+  b = FP_FRAGMENT_START(p, f+1);
+  CU_ASSERT_PTR_EQUAL(b, fp_resize(p, b, 16, &be));
+  CU_ASSERT_EQUAL(1, ns.count);
+  CU_ASSERT_EQUAL(64, ns.length);
+
+  /* Allocation and failed operations never notify */
+  CU_ASSERT_PTR_NOT_NULL(fp_request(p, 16, 16, &be));
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release(p, b+1));
+  CU_ASSERT_EQUAL(1, ns.count);
+
+  CU_ASSERT_EQUAL(0, fp_release(p, FP_FRAGMENT_START(p, f+4)));
+  CU_ASSERT_EQUAL(2, ns.count);
+  CU_ASSERT_EQUAL(192, ns.length);
+
+  fp_reset(p);
+  CU_ASSERT_EQUAL(3, ns.count);
+  CU_ASSERT_EQUAL(POOL_SIZE, ns.length);
+
+  /* Reallocation in place returns the excess */
+  p->notify = NULL;
+  config_pool(p, -64, 32, -FP_MAX_FRAGMENT_SIZE);
+  p->notify = &hook;
+  ns.count = 0;
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f), fp_reallocate(p, FP_FRAGMENT_START(p, f), 16, 16, &be));
+  CU_ASSERT_EQUAL(1, ns.count);
+  CU_ASSERT_EQUAL(80, ns.length);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  p->notify = NULL;
+  fp_reset(p);
+}
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+#if FRAGPOOL_WITH_TRACE
+void
+test_trace ()
+{
+  fp_pool_t p = pool;
+  struct fp_trace_record_t records[4];
+  struct fp_trace_t trace = { records, sizeof(records) / sizeof(*records), 0 };
+  struct fp_trace_header_t h;
+  fp_trace_record_t r;
+  uint8_t* b;
+  uint8_t* be;
+
+  p->trace = &trace;
+  fp_reset(p);
+  b = fp_request(p, 16, 32, &be);
+  CU_ASSERT_PTR_EQUAL(b, p->pool_start);
+  CU_ASSERT_EQUAL(2, trace.count);
+  CU_ASSERT_EQUAL(0, fp_trace_header(p, &h));
+  CU_ASSERT_EQUAL(FP_TRACE_MAGIC, h.magic);
+  CU_ASSERT_EQUAL(FRAGPOOL_SIZE_BITS, h.size_bits);
+  CU_ASSERT_EQUAL(p->pool_alignment, h.alignment);
+  CU_ASSERT_EQUAL(0, h.start_phase);
+  CU_ASSERT_EQUAL(POOL_SIZE, h.pool_size);
+  CU_ASSERT_EQUAL(POOL_FRAGMENTS, h.fragment_count);
+  CU_ASSERT_EQUAL(2, h.count);
+  CU_ASSERT_FALSE(h.wrapped);
+
+  r = records;
+  CU_ASSERT_EQUAL(FP_TRACE_RESET, r->op);
+  ++r;
+  CU_ASSERT_EQUAL(FP_TRACE_REQUEST, r->op);
+  CU_ASSERT_EQUAL(FP_TRACE_NO_OFFSET, r->offset);
+  CU_ASSERT_EQUAL(16, r->min_size);
+  CU_ASSERT_EQUAL(32, r->max_size);
+  CU_ASSERT_EQUAL(0, r->result);
+  CU_ASSERT_EQUAL(32, r->length);
+
+  /* Failures are recorded too */
+  CU_ASSERT_PTR_NULL(fp_request(p, POOL_SIZE, POOL_SIZE, &be));
+  ++r;
+  CU_ASSERT_EQUAL(FP_TRACE_REQUEST, r->op);
+  CU_ASSERT_EQUAL(FP_TRACE_NO_OFFSET, r->result);
+  CU_ASSERT_EQUAL(0, r->length);
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release(p, b+1));
+  ++r;
+  CU_ASSERT_EQUAL(FP_TRACE_RELEASE, r->op);
+  CU_ASSERT_EQUAL(FP_EINVAL, r->status);
+  CU_ASSERT_EQUAL(1, r->offset);
+
+  /* The ring wraps, overwriting the oldest records */
+  CU_ASSERT_PTR_EQUAL(b, fp_resize(p, b, 8, &be));
+  CU_ASSERT_EQUAL(0, fp_release(p, b));
+  CU_ASSERT_EQUAL(6, trace.count);
+  CU_ASSERT_EQUAL(2, fp_trace_header(p, &h));
+  CU_ASSERT_EQUAL(4, h.count);
+  CU_ASSERT_TRUE(h.wrapped);
+  r = records;
+  CU_ASSERT_EQUAL(FP_TRACE_RESIZE, r->op);
+  CU_ASSERT_EQUAL(0, r->offset);
+  CU_ASSERT_EQUAL(8, r->min_size);
+  CU_ASSERT_EQUAL(8, r->length);
+  ++r;
+  CU_ASSERT_EQUAL(FP_TRACE_RELEASE, r->op);
+  CU_ASSERT_EQUAL(0, r->status);
+  CU_ASSERT_EQUAL(8, r->length);
+
+  p->trace = NULL;
+  fp_reset(p);
+}
+#endif /* FRAGPOOL_WITH_TRACE */
+
+#if FRAGPOOL_WITH_HANDLES
+void
+test_handles ()
+{
+  fp_pool_t p = pool;
+  uint8_t* const ps = p->pool_start;
+  struct fp_handle_t h0;
+  struct fp_handle_t h1;
+  struct fp_handle_t h2;
+  struct fp_handle_t stale;
+  uint8_t* b;
+  uint8_t* be;
+
+  fp_reset(p);
+  b = fp_request_handle(p, 16, 16, &be, &h0);
+  CU_ASSERT_PTR_EQUAL(ps, b);
+  CU_ASSERT_PTR_EQUAL(b, h0.start);
+  CU_ASSERT_EQUAL(0, h0.slot);
+  b = fp_request_handle(p, 32, 32, &be, &h1);
+  CU_ASSERT_PTR_EQUAL(ps + 16, h1.start);
+  CU_ASSERT_EQUAL(1, h1.slot);
+  CU_ASSERT_NOT_EQUAL(h0.generation, h1.generation);
+  CU_ASSERT_PTR_EQUAL(h1.start, fp_resize_handle(p, &h1, 16, &be));
+  CU_ASSERT_EQUAL(16, be - h1.start);
+
+  /* A released handle is rejected, even once the space is reused */
+  stale = h0;
+  CU_ASSERT_EQUAL(0, fp_release_handle(p, &h0));
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release_handle(p, &stale));
+  b = fp_request_handle(p, 16, 16, &be, &h2);
+  CU_ASSERT_PTR_EQUAL(stale.start, b);
+  CU_ASSERT_EQUAL(stale.slot, h2.slot);
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release_handle(p, &stale));
+  CU_ASSERT_PTR_NULL(fp_resize_handle(p, &stale, 8, &be));
+  CU_ASSERT_PTR_NULL(fp_reallocate_handle(p, &stale, 8, 8, &be));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  /* A handle whose slot has shifted is still resolved, and updated */
+  CU_ASSERT_EQUAL(0, fp_release_handle(p, &h2));
+  CU_ASSERT_PTR_EQUAL(ps, fp_request(p, 8, 8, &be));
+  CU_ASSERT_EQUAL(1, h1.slot);
+  CU_ASSERT_PTR_EQUAL(ps + 16, fp_resize_handle(p, &h1, 16, &be));
+  CU_ASSERT_EQUAL(2, h1.slot);
+
+  /* Moving the fragment makes a new allocation */
+  stale = h1;
+  b = fp_reallocate_handle(p, &h1, 24, 24, &be);
+  CU_ASSERT_PTR_EQUAL(ps + 8, b);
+  CU_ASSERT_PTR_EQUAL(b, h1.start);
+  CU_ASSERT_EQUAL(1, h1.slot);
+  CU_ASSERT_NOT_EQUAL(stale.generation, h1.generation);
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_release_handle(p, &stale));
+  CU_ASSERT_EQUAL(0, fp_release_handle(p, &h1));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  fp_reset(p);
+}
+#endif /* FRAGPOOL_WITH_HANDLES */
+
+#if 16 < FRAGPOOL_SIZE_BITS
+#define WIDE_POOL_SIZE (1024L * 1024L)
+#if 8 < FRAGPOOL_COUNT_BITS
+#define WIDE_POOL_FRAGMENTS 1000
+#else /* FRAGPOOL_COUNT_BITS */
+#define WIDE_POOL_FRAGMENTS 250
+#endif /* FRAGPOOL_COUNT_BITS */
+#define WIDE_FRAGMENT_SIZE 1000
+
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+static fp_ssize_t wpool_lengths[WIDE_POOL_FRAGMENTS];
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+static uint8_t wpool_data[WIDE_POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[WIDE_POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} wpool_union = {
+  .generic = {
+    .pool_start = wpool_data,
+    .pool_end = wpool_data + sizeof(wpool_data),
+    .pool_alignment = 8,
+    .fragment_count = WIDE_POOL_FRAGMENTS,
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+    .available_length = wpool_lengths,
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+  }
+};
+fp_pool_t const wpool = &wpool_union.generic;
+
+void
+test_wide_pool ()
+{
+  fp_pool_t p = wpool;
+  fp_fragment_t f = p->fragment;
+  uint8_t* b;
+  uint8_t* be;
+  int i;
+
+  fp_reset(p);
+  CU_ASSERT_POOL_IS_RESET(p);
+
+  /* Fragments larger than a 16-bit size can represent */
+  b = fp_request(p, 40000, 100000, &be);
+  CU_ASSERT_PTR_EQUAL(b, p->pool_start);
+  CU_ASSERT_EQUAL(be - b, 100000);
+  CU_ASSERT_EQUAL(f[1].length, WIDE_POOL_SIZE - 100000);
+  b = fp_resize(p, b, 500000, &be);
+  CU_ASSERT_EQUAL(be - b, 500000);
+  b = fp_reallocate(p, b, 500000, 520000, &be);
+  CU_ASSERT_PTR_EQUAL(b, p->pool_start);
+  CU_ASSERT_EQUAL(be - b, 520000);
+  CU_ASSERT_EQUAL(0, fp_release(p, b));
+  CU_ASSERT_POOL_IS_RESET(p);
+
+  /* Use every slot */
+  for (i = 0; i < WIDE_POOL_FRAGMENTS; ++i) {
+    b = fp_request(p, WIDE_FRAGMENT_SIZE, WIDE_FRAGMENT_SIZE, &be);
+    CU_ASSERT_PTR_EQUAL(b, p->pool_start + i * WIDE_FRAGMENT_SIZE);
+  }
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  CU_ASSERT_EQUAL(f[WIDE_POOL_FRAGMENTS-1].length,
+                  -(WIDE_POOL_SIZE - (WIDE_POOL_FRAGMENTS-1) * WIDE_FRAGMENT_SIZE));
+  for (i = 0; i < WIDE_POOL_FRAGMENTS; i += 2) {
+    CU_ASSERT_EQUAL(0, fp_release(p, p->pool_start + i * WIDE_FRAGMENT_SIZE));
+  }
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  for (i = 1; i < WIDE_POOL_FRAGMENTS; i += 2) {
+    CU_ASSERT_EQUAL(0, fp_release(p, p->pool_start + i * WIDE_FRAGMENT_SIZE));
+  }
+  CU_ASSERT_POOL_IS_RESET(p);
+}
+#endif /* FRAGPOOL_SIZE_BITS */
+
+#if (FRAGPOOL_WITH_SIZE_INDEX) || (FRAGPOOL_WITH_LENGTH_ARRAY)
+/* The selection documented for find_best_fragment(), made one slot at
+ * a time. */
+static fp_fragment_t
+reference_best_fragment (fp_pool_t p,
+                         fp_ssize_t min_size,
+                         fp_ssize_t max_size)
+{
+  fp_fragment_t f = p->fragment;
+  const fp_fragment_t fe = f + p->fragment_count;
+  fp_fragment_t bf = NULL;
+
+  do {
+    if (min_size <= f->length) {
+      if ((NULL == bf)
+          || ((f->length > bf->length) && (bf->length < max_size))
+          || ((f->length < bf->length) && (f->length >= max_size))) {
+        bf = f;
+      }
+    }
+  } while (++f < fe);
+  return bf;
+}
+#endif /* FRAGPOOL_WITH_SIZE_INDEX || FRAGPOOL_WITH_LENGTH_ARRAY */
+
+#if FRAGPOOL_WITH_SIZE_INDEX
+void
+test_size_index ()
+{
+  /* Layouts with several available fragments in one class, ties
+   * within a class, and candidates on both sides of a class
+   * boundary */
+  static const int layouts[][POOL_FRAGMENTS] = {
+    { 16, -16, 16, -16, 16, -FP_MAX_FRAGMENT_SIZE },
+    { 24, -8, 20, -8, 28, -FP_MAX_FRAGMENT_SIZE },
+    { 64, -8, 32, -8, 64, -FP_MAX_FRAGMENT_SIZE },
+    { 8, -8, 12, -12, 10, -FP_MAX_FRAGMENT_SIZE },
+    { 100, -4, 40, -4, 100, -FP_MAX_FRAGMENT_SIZE },
+    { 31, -1, 33, -32, 63, -FP_MAX_FRAGMENT_SIZE },
+    { -48, 17, -48, 17, -48, FP_MAX_FRAGMENT_SIZE },
+  };
+  const unsigned int nlayouts = sizeof(layouts) / sizeof(*layouts);
+  fp_pool_t p = pool;
+  unsigned int li;
+
+  for (li = 0; li < nlayouts; ++li) {
+    const int* l = layouts[li];
+    fp_ssize_t min_size;
+    fp_ssize_t max_size;
+
+    config_pool(p, l[0], l[1], l[2], l[3], l[4], l[5]);
+    CU_ASSERT_EQUAL(0, fp_validate(p));
+    for (min_size = 1; min_size <= 160; min_size += 3) {
+      for (max_size = min_size; max_size <= 260; max_size += 5) {
+        CU_ASSERT_PTR_EQUAL(fp_find_best_fragment(p, min_size, max_size),
+                            reference_best_fragment(p, min_size, max_size));
+      }
+      CU_ASSERT_PTR_EQUAL(fp_find_best_fragment(p, min_size, FP_MAX_FRAGMENT_SIZE),
+                          reference_best_fragment(p, min_size, FP_MAX_FRAGMENT_SIZE));
+    }
+  }
+  fp_reset(p);
+}
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+#define LPOOL_SIZE 4096
+#define LPOOL_FRAGMENTS 67
+
+static fp_pool_t
+create_lpool (fp_ssize_t* lengths)
+{
+  fp_pool_t p = calloc(1, sizeof(*p) + LPOOL_FRAGMENTS * sizeof(*p->fragment));
+
+  if (NULL != p) {
+    p->pool_start = malloc(LPOOL_SIZE);
+    p->pool_end = p->pool_start + LPOOL_SIZE;
+    p->pool_alignment = 4;
+    p->fragment_count = LPOOL_FRAGMENTS;
+    p->available_length = lengths;
+    fp_reset(p);
+  }
+  return p;
+}
+
+void
+test_length_array ()
+{
+  static const fp_ssize_t lengths[] = { -24, 0, 8, 16, 24, 40, 64, 200 };
+  const unsigned int nlengths = sizeof(lengths) / sizeof(*lengths);
+  fp_ssize_t available_length[LPOOL_FRAGMENTS];
+  uint8_t* held[2][LPOOL_FRAGMENTS] = { { NULL } };
+  fp_pool_t p[2];
+  unsigned int n;
+  unsigned int i;
+
+  /* p[0] uses the array, p[1] scans the slots */
+  p[0] = create_lpool(available_length);
+  p[1] = create_lpool(NULL);
+  CU_ASSERT_PTR_NOT_NULL(p[0]);
+  CU_ASSERT_PTR_NOT_NULL(p[1]);
+  if ((NULL == p[0]) || (NULL == p[1])) {
+    return;
+  }
+  CU_ASSERT_EQUAL(0, fp_validate(p[0]));
+  CU_ASSERT_EQUAL(available_length[0], p[0]->fragment[0].length);
+  CU_ASSERT_EQUAL(available_length[1], 0);
+
+  /* Every slot count, so each vector remainder is seen, with lengths
+   * chosen so that ties are common. */
+  srand(1);
+  for (n = 1; n <= LPOOL_FRAGMENTS; ++n) {
+    unsigned int round;
+
+    p[0]->fragment_count = n;
+    for (round = 0; round < 20; ++round) {
+      fp_ssize_t min_size;
+      fp_ssize_t max_size;
+
+      for (i = 0; i < n; ++i) {
+        p[0]->fragment[i].length = lengths[rand() % nlengths];
+      }
+      fp_rebuild_index(p[0]);
+      for (min_size = 8; min_size <= 256; min_size *= 2) {
+        for (max_size = min_size; max_size <= 256; max_size *= 2) {
+          CU_ASSERT_PTR_EQUAL(fp_find_best_fragment(p[0], min_size, max_size),
+                              reference_best_fragment(p[0], min_size, max_size));
+        }
+        CU_ASSERT_PTR_EQUAL(fp_find_best_fragment(p[0], min_size, FP_MAX_FRAGMENT_SIZE),
+                            reference_best_fragment(p[0], min_size, FP_MAX_FRAGMENT_SIZE));
+      }
+    }
+  }
+  p[0]->fragment_count = LPOOL_FRAGMENTS;
+
+  /* The same operations on both pools must have the same results,
+   * and the array must track every change. */
+  fp_reset(p[0]);
+  for (n = 0; n < 20000; ++n) {
+    fp_size_t min_size = 1 + rand() % 160;
+    fp_size_t max_size = min_size + rand() % 160;
+    uint8_t* b[2];
+    uint8_t* be[2];
+    int op = rand() % 3;
+    unsigned int k;
+
+    i = rand() % LPOOL_FRAGMENTS;
+    for (k = 0; k < 2; ++k) {
+      b[k] = be[k] = NULL;
+      if (NULL == held[k][i]) {
+        b[k] = held[k][i] = fp_request(p[k], min_size, max_size, &be[k]);
+      } else if (0 == op) {
+        CU_ASSERT_EQUAL(0, fp_release(p[k], held[k][i]));
+        held[k][i] = NULL;
+      } else {
+        b[k] = fp_reallocate(p[k], held[k][i], min_size, max_size, &be[k]);
+        if (NULL != b[k]) {
+          held[k][i] = b[k];
+        }
+      }
+    }
+    CU_ASSERT_EQUAL(NULL == b[0], NULL == b[1]);
+    if ((NULL != b[0]) && (NULL != b[1])) {
+      CU_ASSERT_EQUAL(b[0] - p[0]->pool_start, b[1] - p[1]->pool_start);
+      CU_ASSERT_EQUAL(be[0] - b[0], be[1] - b[1]);
+    }
+    if (0 != fp_validate(p[0])) {
+      CU_FAIL("pool with length array invalid");
+      break;
+    }
+  }
+  CU_ASSERT_EQUAL(0, fp_validate(p[1]));
+  free(p[0]->pool_start);
+  free(p[0]);
+  free(p[1]->pool_start);
+  free(p[1]);
+}
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+
+#if FRAGPOOL_WITH_COMPACT_SLOTS
+void
+test_compact_slots ()
+{
+  fp_pool_t p = pool;
+  fp_fragment_t f = p->fragment;
+  uint8_t* b;
+  uint8_t* be;
+
+#if ! ((FRAGPOOL_WITH_SIZE_INDEX) || (FRAGPOOL_WITH_HANDLES))
+  CU_ASSERT_EQUAL(sizeof(*f), 2 * sizeof(fp_size_t));
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+  fp_reset(p);
+  CU_ASSERT_EQUAL(f[0].offset, 0);
+  b = fp_request(p, 20, 20, &be);
+  CU_ASSERT_PTR_EQUAL(b, p->pool_start);
+  CU_ASSERT_EQUAL(f[1].offset, 20);
+  CU_ASSERT_PTR_EQUAL(FP_FRAGMENT_START(p, f+1), be);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  /* A misplaced start is still detected */
+  f[1].offset += 2;
+  CU_ASSERT_NOT_EQUAL(0, fp_validate(p));
+  f[1].offset -= 2;
+  CU_ASSERT_EQUAL(0, fp_release(p, b));
+  CU_ASSERT_POOL_IS_RESET(p);
+}
+#endif /* FRAGPOOL_WITH_COMPACT_SLOTS */
+
 int
 main (int argc,
       char* argv[])
@@ -1129,10 +2116,15 @@ main (int argc,
     { "fp_validate", test_fp_validate },
     { "fp_request_params", test_fp_request_params },
     { "fp_request", test_fp_request },
+    { "fp_request_many", test_fp_request_many },
+    { "fp_stats", test_fp_stats },
     { "fp_merge_adjacent_available", test_fp_merge_adjacent_available },
     { "fp_get_fragment", test_fp_get_fragment },
     { "fp_release_params", test_fp_release_params },
     { "fp_release", test_fp_release },
+    { "fp_release_many", test_fp_release_many },
+    { "fp_compact", test_fp_compact },
+    { "fp_split", test_fp_split },
     { "fp_resize_params", test_fp_resize_params },
     { "fp_reallocate_params", test_fp_reallocate_params },
     { "execute_alloc", test_execute_alloc },
@@ -1141,6 +2133,31 @@ main (int argc,
     { "execute_display", test_execute_display },
     { "execute_reallocate", test_execute_reallocate },
     { "pool_alignment", test_pool_alignment },
+#if FRAGPOOL_WITH_LOCK
+    { "lock_hooks", test_lock_hooks },
+    { "lock_compact", test_lock_compact },
+#endif /* FRAGPOOL_WITH_LOCK */
+#if FRAGPOOL_WITH_NOTIFY
+    { "notify", test_notify },
+#endif /* FRAGPOOL_WITH_NOTIFY */
+#if FRAGPOOL_WITH_TRACE
+    { "trace", test_trace },
+#endif /* FRAGPOOL_WITH_TRACE */
+#if FRAGPOOL_WITH_HANDLES
+    { "handles", test_handles },
+#endif /* FRAGPOOL_WITH_HANDLES */
+#if 16 < FRAGPOOL_SIZE_BITS
+    { "wide_pool", test_wide_pool },
+#endif /* FRAGPOOL_SIZE_BITS */
+#if FRAGPOOL_WITH_SIZE_INDEX
+    { "size_index", test_size_index },
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+#if FRAGPOOL_WITH_LENGTH_ARRAY
+    { "length_array", test_length_array },
+#endif /* FRAGPOOL_WITH_LENGTH_ARRAY */
+#if FRAGPOOL_WITH_COMPACT_SLOTS
+    { "compact_slots", test_compact_slots },
+#endif /* FRAGPOOL_WITH_COMPACT_SLOTS */
   };
   const int ntests = sizeof(tests) / sizeof(*tests);
   int i;
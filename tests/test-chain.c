@@ -0,0 +1,247 @@
+#include <fragpool/fragpool.h>
+#include <fragpool/chain.h>
+#include <CUnit/Basic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int init_suite (void)
+{
+  return 0;
+}
+int clean_suite (void)
+{
+  return 0;
+}
+
+#define POOL_SIZE 256
+#define POOL_FRAGMENTS 8
+#define CHAIN_LINKS 4
+
+static uint8_t pool_data[POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} pool_union = {
+  .generic = {
+    .pool_start = pool_data,
+    .pool_end = pool_data + sizeof(pool_data),
+    .pool_alignment = 1,
+    .fragment_count = POOL_FRAGMENTS
+  }
+};
+static fp_pool_t const pool = &pool_union.generic;
+
+/* Leave available fragments of 64 octets at offsets 0 and 128,
+ * returning the allocated fragments at 64 and 192. */
+static void
+fragment_pool (uint8_t** bps)
+{
+  uint8_t* b[4];
+  uint8_t* be;
+  int i;
+
+  fp_reset(pool);
+  for (i = 0; i < 4; ++i) {
+    b[i] = fp_request(pool, 64, 64, &be);
+  }
+  fp_release(pool, b[0]);
+  fp_release(pool, b[2]);
+  bps[0] = b[1];
+  bps[1] = b[3];
+}
+
+void
+test_chain_request ()
+{
+  struct fp_link_t links[CHAIN_LINKS];
+  struct fp_chain_t chain;
+  struct fp_link_t links2[CHAIN_LINKS];
+  struct fp_chain_t chain2;
+  uint8_t* held[2];
+  uint8_t* be;
+
+  fragment_pool(held);
+  fp_chain_init(&chain, links, CHAIN_LINKS);
+  fp_chain_init(&chain2, links2, CHAIN_LINKS);
+  CU_ASSERT_EQUAL(0, fp_chain_space(&chain));
+  CU_ASSERT_PTR_NULL(fp_request(pool, 100, 100, &be));
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_chain_request(pool, &chain, 100, 0));
+
+  /* The longest fragment, then the best fit for the rest */
+  CU_ASSERT_EQUAL(0, fp_chain_request(pool, &chain, 100, 16));
+  CU_ASSERT_EQUAL(2, chain.count);
+  CU_ASSERT_EQUAL(100, fp_chain_space(&chain));
+  CU_ASSERT_PTR_EQUAL(pool_data, links[0].start);
+  CU_ASSERT_EQUAL(64, links[0].end - links[0].start);
+  CU_ASSERT_PTR_EQUAL(pool_data + 128, links[1].start);
+  CU_ASSERT_EQUAL(36, links[1].end - links[1].start);
+  CU_ASSERT_EQUAL(0, fp_chain_request(pool, &chain, 100, 16));
+  CU_ASSERT_EQUAL(2, chain.count);
+
+  /* Failure leaves the chain and pool unchanged */
+  CU_ASSERT_EQUAL(FP_ENOMEM, fp_chain_request(pool, &chain2, 40, 29));
+  CU_ASSERT_EQUAL(FP_ENOMEM, fp_chain_request(pool, &chain, 200, 1));
+  CU_ASSERT_EQUAL(2, chain.count);
+  CU_ASSERT_EQUAL(0, chain2.count);
+  CU_ASSERT_EQUAL(28, fp_largest_available(pool));
+  CU_ASSERT_EQUAL(0, fp_validate(pool));
+
+  /* Less than the link minimum is used when that is all that is
+   * lacking */
+  CU_ASSERT_EQUAL(0, fp_chain_request(pool, &chain2, 20, 28));
+  CU_ASSERT_EQUAL(20, fp_chain_space(&chain2));
+
+  CU_ASSERT_EQUAL(0, fp_chain_release(pool, &chain));
+  CU_ASSERT_EQUAL(0, chain.count);
+  CU_ASSERT_EQUAL(0, fp_chain_release(pool, &chain2));
+  fp_release(pool, held[0]);
+  fp_release(pool, held[1]);
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(pool));
+}
+
+void
+test_chain_append ()
+{
+  struct fp_link_t links[2];
+  struct fp_chain_t chain;
+  fp_link_t lp;
+
+  fp_reset(pool);
+  fp_chain_init(&chain, links, 2);
+  lp = fp_chain_append(pool, &chain, 1, 100);
+  CU_ASSERT_PTR_EQUAL(links, lp);
+  CU_ASSERT_EQUAL(100, lp->end - lp->start);
+  lp = fp_chain_append(pool, &chain, 1, FP_MAX_FRAGMENT_SIZE);
+  CU_ASSERT_PTR_EQUAL(links + 1, lp);
+  CU_ASSERT_EQUAL(POOL_SIZE - 100, lp->end - lp->start);
+  CU_ASSERT_PTR_NULL(fp_chain_append(pool, &chain, 1, 1));
+  CU_ASSERT_EQUAL(2, chain.count);
+  CU_ASSERT_EQUAL(0, fp_chain_release(pool, &chain));
+  CU_ASSERT_PTR_NULL(fp_chain_append(pool, &chain, POOL_SIZE + 1, POOL_SIZE + 1));
+  CU_ASSERT_EQUAL(0, chain.count);
+}
+
+void
+test_chain_segment ()
+{
+  struct fp_link_t links[CHAIN_LINKS];
+  struct fp_chain_t chain;
+  uint8_t* held[2];
+  unsigned long off;
+  fp_size_t n;
+  uint8_t* sp;
+
+  fragment_pool(held);
+  fp_chain_init(&chain, links, CHAIN_LINKS);
+  CU_ASSERT_PTR_NULL(fp_chain_segment(&chain, 0, &n));
+  CU_ASSERT_EQUAL(0, fp_chain_request(pool, &chain, 100, 16));
+  chain.length = 100;
+
+  sp = fp_chain_segment(&chain, 0, &n);
+  CU_ASSERT_PTR_EQUAL(links[0].start, sp);
+  CU_ASSERT_EQUAL(64, n);
+  sp = fp_chain_segment(&chain, 70, &n);
+  CU_ASSERT_PTR_EQUAL(links[1].start + 6, sp);
+  CU_ASSERT_EQUAL(30, n);
+  CU_ASSERT_PTR_NULL(fp_chain_segment(&chain, 100, &n));
+
+  /* Store and read back data across the link boundary */
+  for (off = 0; off < chain.length; off += n) {
+    fp_size_t i;
+    sp = fp_chain_segment(&chain, off, &n);
+    for (i = 0; i < n; ++i) {
+      sp[i] = off + i;
+    }
+  }
+  CU_ASSERT_EQUAL(63, links[0].start[63]);
+  CU_ASSERT_EQUAL(64, links[1].start[0]);
+  CU_ASSERT_EQUAL(99, links[1].start[35]);
+
+  fp_chain_release(pool, &chain);
+  fp_release(pool, held[0]);
+  fp_release(pool, held[1]);
+}
+
+void
+test_chain_trim ()
+{
+  struct fp_link_t links[CHAIN_LINKS];
+  struct fp_chain_t chain;
+  uint8_t* held[2];
+
+  fragment_pool(held);
+  fp_chain_init(&chain, links, CHAIN_LINKS);
+  CU_ASSERT_EQUAL(0, fp_chain_request(pool, &chain, 100, 16));
+
+  /* The partly used link shrinks */
+  chain.length = 70;
+  CU_ASSERT_EQUAL(0, fp_chain_trim(pool, &chain));
+  CU_ASSERT_EQUAL(2, chain.count);
+  CU_ASSERT_EQUAL(6, links[1].end - links[1].start);
+  CU_ASSERT_EQUAL(70, fp_chain_space(&chain));
+
+  /* Unused links are released */
+  chain.length = 50;
+  CU_ASSERT_EQUAL(0, fp_chain_trim(pool, &chain));
+  CU_ASSERT_EQUAL(1, chain.count);
+  CU_ASSERT_EQUAL(50, fp_chain_space(&chain));
+  CU_ASSERT_EQUAL(0, fp_validate(pool));
+  CU_ASSERT_EQUAL(64, fp_largest_available(pool));
+
+  /* An invalid link is diagnosed */
+  links[0].start += 1;
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_chain_release(pool, &chain));
+  CU_ASSERT_EQUAL(0, chain.count);
+  fp_reset(pool);
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  CU_ErrorCode rc;
+  CU_pSuite suite = NULL;
+  typedef struct test_def {
+    const char* name;
+    void (*fn) (void);
+  } test_def;
+  const test_def tests[] = {
+    { "chain_request", test_chain_request },
+    { "chain_append", test_chain_append },
+    { "chain_segment", test_chain_segment },
+    { "chain_trim", test_chain_trim },
+  };
+  const int ntests = sizeof(tests) / sizeof(*tests);
+  int i;
+
+  rc = CU_initialize_registry();
+  if (CUE_SUCCESS != rc) {
+    fprintf(stderr, "CU_initialize_registry %d: %s\n", rc, CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  suite = CU_add_suite("chain", init_suite, clean_suite);
+  if (! suite) {
+    fprintf(stderr, "CU_add_suite: %s\n", CU_get_error_msg());
+    goto done_registry;
+  }
+
+  for (i = 0; i < ntests; ++i) {
+    const test_def* td = tests + i;
+    if (! (CU_add_test(suite, td->name, td->fn))) {
+      fprintf(stderr, "CU_add_test(%s): %s\n", td->name, CU_get_error_msg());
+      goto done_registry;
+    }
+  }
+  printf("Running tests\n");
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+
+done_registry:
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
@@ -0,0 +1,174 @@
+#include <fragpool/fragpool.h>
+#include <fragpool/group.h>
+#include <CUnit/Basic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int init_suite (void)
+{
+  return 0;
+}
+int clean_suite (void)
+{
+  return 0;
+}
+
+#define POOL_SIZE 256
+#define POOL_FRAGMENTS 6
+#define GROUP_POOLS 3
+
+static uint8_t pool_data[GROUP_POOLS][POOL_SIZE];
+
+#define DEFINE_POOL(_i)                                 \
+  static union {                                        \
+    struct {                                            \
+      FP_POOL_STRUCT_COMMON;                            \
+      struct fp_fragment_t fragment[POOL_FRAGMENTS];    \
+    } fixed;                                            \
+    struct fp_pool_t generic;                           \
+  } pool_union##_i = {                                  \
+    .generic = {                                        \
+      .pool_start = pool_data[_i],                      \
+      .pool_end = pool_data[_i] + POOL_SIZE,            \
+      .pool_alignment = 1,                              \
+      .fragment_count = POOL_FRAGMENTS                  \
+    }                                                   \
+  }
+
+DEFINE_POOL(0);
+DEFINE_POOL(1);
+DEFINE_POOL(2);
+
+static fp_pool_t const pools[GROUP_POOLS] = {
+  &pool_union0.generic,
+  &pool_union1.generic,
+  &pool_union2.generic,
+};
+static struct fp_group_t group_struct = {
+  .pool_count = GROUP_POOLS,
+  .pool = pools,
+};
+static fp_group_t const group = &group_struct;
+
+static void
+reset_group (void)
+{
+  int i;
+  for (i = 0; i < GROUP_POOLS; ++i) {
+    fp_reset(pools[i]);
+  }
+}
+
+void
+test_group_pool ()
+{
+  CU_ASSERT_PTR_EQUAL(pools[0], fp_group_pool(group, pool_data[0]));
+  CU_ASSERT_PTR_EQUAL(pools[1], fp_group_pool(group, pool_data[1] + POOL_SIZE - 1));
+  CU_ASSERT_PTR_EQUAL(pools[2], fp_group_pool(group, pool_data[2] + 10));
+  CU_ASSERT_PTR_NULL(fp_group_pool(group, NULL));
+}
+
+void
+test_group_request_local ()
+{
+  uint8_t* b;
+  uint8_t* be;
+
+  reset_group();
+  CU_ASSERT_PTR_NULL(fp_group_request(group, GROUP_POOLS, 16, 16, &be));
+  b = fp_group_request(group, 1, 16, 16, &be);
+  CU_ASSERT_PTR_EQUAL(b, pool_data[1]);
+  CU_ASSERT_EQUAL(be - b, 16);
+  CU_ASSERT_EQUAL(POOL_SIZE - 16, fp_largest_available(pools[1]));
+  CU_ASSERT_EQUAL(0, fp_group_release(group, b));
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(pools[1]));
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_group_release(group, b));
+  CU_ASSERT_EQUAL(FP_EINVAL, fp_group_release(group, NULL));
+}
+
+void
+test_group_steal ()
+{
+  uint8_t* b0;
+  uint8_t* b1;
+  uint8_t* b2;
+  uint8_t* b;
+  uint8_t* be;
+
+  reset_group();
+  /* Leave 56 octets in shard 0, 128 in shard 1, 200 in shard 2 */
+  b0 = fp_group_request(group, 0, 200, 200, &be);
+  CU_ASSERT_PTR_EQUAL(b0, pool_data[0]);
+  b1 = fp_group_request(group, 1, 128, 128, &be);
+  CU_ASSERT_PTR_EQUAL(b1, pool_data[1]);
+  b2 = fp_group_request(group, 2, 56, 56, &be);
+  CU_ASSERT_PTR_EQUAL(b2, pool_data[2]);
+
+  /* Shard 0 can't provide 100, so it is taken from shard 2 */
+  b = fp_group_request(group, 0, 100, 100, &be);
+  CU_ASSERT_PTR_EQUAL(b, pool_data[2] + 56);
+  CU_ASSERT_PTR_EQUAL(pools[2], fp_group_pool(group, b));
+
+  /* Now shard 1 has the longest */
+  b = fp_group_request(group, 0, 100, 100, &be);
+  CU_ASSERT_PTR_EQUAL(b, pool_data[1] + 128);
+
+  /* Nobody has 120 */
+  CU_ASSERT_PTR_NULL(fp_group_request(group, 0, 120, 120, &be));
+
+  /* Releases return memory to the owning shard */
+  CU_ASSERT_EQUAL(0, fp_group_release(group, b));
+  CU_ASSERT_EQUAL(128, fp_largest_available(pools[1]));
+  CU_ASSERT_EQUAL(0, fp_group_release(group, b0));
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(pools[0]));
+  CU_ASSERT_EQUAL(0, fp_validate(pools[0]));
+  CU_ASSERT_EQUAL(0, fp_validate(pools[1]));
+  CU_ASSERT_EQUAL(0, fp_validate(pools[2]));
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  CU_ErrorCode rc;
+  CU_pSuite suite = NULL;
+  typedef struct test_def {
+    const char* name;
+    void (*fn) (void);
+  } test_def;
+  const test_def tests[] = {
+    { "group_pool", test_group_pool },
+    { "group_request_local", test_group_request_local },
+    { "group_steal", test_group_steal },
+  };
+  const int ntests = sizeof(tests) / sizeof(*tests);
+  int i;
+
+  rc = CU_initialize_registry();
+  if (CUE_SUCCESS != rc) {
+    fprintf(stderr, "CU_initialize_registry %d: %s\n", rc, CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  suite = CU_add_suite("group", init_suite, clean_suite);
+  if (! suite) {
+    fprintf(stderr, "CU_add_suite: %s\n", CU_get_error_msg());
+    goto done_registry;
+  }
+
+  for (i = 0; i < ntests; ++i) {
+    const test_def* td = tests + i;
+    if (! (CU_add_test(suite, td->name, td->fn))) {
+      fprintf(stderr, "CU_add_test(%s): %s\n", td->name, CU_get_error_msg());
+      goto done_registry;
+    }
+  }
+  printf("Running tests\n");
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+
+done_registry:
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+#include <fragpool/fragpool.h>
+#include <fragpool/linux.h>
+#include <CUnit/Basic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+int init_suite (void)
+{
+  return 0;
+}
+int clean_suite (void)
+{
+  return 0;
+}
+
+#define POOL_SIZE 256
+#define POOL_FRAGMENTS 6
+
+static uint8_t pool_data[POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} pool_union = {
+  .generic = {
+    .pool_start = pool_data,
+    .pool_end = pool_data + sizeof(pool_data),
+    .pool_alignment = 1,
+    .fragment_count = POOL_FRAGMENTS
+  }
+};
+fp_pool_t const pool = &pool_union.generic;
+
+#if FRAGPOOL_WITH_NOTIFY
+static int
+is_readable (int fd)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  return (1 == poll(&pfd, 1, 0)) && (POLLIN & pfd.revents);
+}
+
+void
+test_eventfd ()
+{
+  fp_pool_t p = pool;
+  struct fp_eventfd_t efd;
+  uint8_t* b0;
+  uint8_t* b1;
+  uint8_t* be;
+
+  fp_reset(p);
+  CU_ASSERT_EQUAL(0, fp_eventfd_attach(p, &efd));
+  CU_ASSERT_PTR_EQUAL(p->notify, &efd.notify);
+  CU_ASSERT(0 <= efd.fd);
+  CU_ASSERT_FALSE(is_readable(efd.fd));
+
+  b0 = fp_request(p, 128, 128, &be);
+  b1 = fp_request(p, 128, 128, &be);
+  CU_ASSERT_PTR_NOT_NULL(b1);
+  CU_ASSERT_PTR_NULL(fp_request(p, 1, 1, &be));
+  CU_ASSERT_FALSE(is_readable(efd.fd));
+
+  CU_ASSERT_EQUAL(0, fp_release(p, b1));
+  CU_ASSERT_TRUE(is_readable(efd.fd));
+  CU_ASSERT_EQUAL(0, fp_release(p, b0));
+  CU_ASSERT_EQUAL(2, fp_eventfd_clear(&efd));
+  CU_ASSERT_FALSE(is_readable(efd.fd));
+  CU_ASSERT_EQUAL(0, fp_eventfd_clear(&efd));
+
+  fp_eventfd_detach(p, &efd);
+  CU_ASSERT_PTR_NULL(p->notify);
+  CU_ASSERT_EQUAL(-1, efd.fd);
+}
+#endif /* FRAGPOOL_WITH_NOTIFY */
+
+void
+test_chain_iovec ()
+{
+  fp_pool_t p = pool;
+  struct fp_link_t links[3];
+  struct fp_chain_t chain;
+  struct iovec iov[3];
+  uint8_t buf[POOL_SIZE];
+  int pfd[2];
+  int i;
+
+  fp_reset(p);
+  fp_chain_init(&chain, links, 3);
+  CU_ASSERT_EQUAL(0, fp_chain_iovec(&chain, iov, 3));
+  fp_chain_append(p, &chain, 100, 100);
+  fp_chain_append(p, &chain, 100, 100);
+  fp_chain_append(p, &chain, 10, 10);
+  chain.length = 120;
+  for (i = 0; i < 120; ++i) {
+    fp_size_t n;
+    *fp_chain_segment(&chain, i, &n) = i;
+  }
+
+  /* Only links holding data are described */
+  CU_ASSERT_EQUAL(2, fp_chain_iovec(&chain, iov, 1));
+  CU_ASSERT_PTR_EQUAL(links[0].start, iov[0].iov_base);
+  CU_ASSERT_EQUAL(100, iov[0].iov_len);
+  CU_ASSERT_EQUAL(2, fp_chain_iovec(&chain, iov, 3));
+  CU_ASSERT_PTR_EQUAL(links[1].start, iov[1].iov_base);
+  CU_ASSERT_EQUAL(20, iov[1].iov_len);
+
+  CU_ASSERT_EQUAL(0, pipe(pfd));
+  CU_ASSERT_EQUAL(120, writev(pfd[1], iov, 2));
+  CU_ASSERT_EQUAL(120, read(pfd[0], buf, sizeof(buf)));
+  CU_ASSERT_EQUAL(99, buf[99]);
+  CU_ASSERT_EQUAL(119, buf[119]);
+  close(pfd[0]);
+  close(pfd[1]);
+  CU_ASSERT_EQUAL(0, fp_chain_release(p, &chain));
+}
+
+static fp_size_t
+newline_frame_end (const uint8_t* data,
+                   fp_size_t length,
+                   void* context)
+{
+  const uint8_t* nl = memchr(data, '\n', length);
+  return (NULL != nl) ? (nl - data + 1) : 0;
+}
+
+void
+test_receive ()
+{
+  fp_pool_t p = pool;
+  struct fp_receiver_t rx;
+  uint8_t* frame[3];
+  int pfd[2];
+
+  fp_reset(p);
+  CU_ASSERT_EQUAL(0, pipe2(pfd, O_NONBLOCK));
+  fp_receiver_init(&rx, p, pfd[0], 16, newline_frame_end, NULL);
+  CU_ASSERT_EQUAL(-1, fp_receive(&rx, frame));
+  CU_ASSERT_EQUAL(EAGAIN, errno);
+
+  /* The partial frame following a complete one is split off */
+  CU_ASSERT_EQUAL(6, write(pfd[1], "abc\nde", 6));
+  CU_ASSERT_EQUAL(4, fp_receive(&rx, frame+0));
+  CU_ASSERT_EQUAL(0, memcmp(frame[0], "abc\n", 4));
+  CU_ASSERT_PTR_EQUAL(frame[0] + 4, rx.start);
+  CU_ASSERT_EQUAL(2, rx.fill);
+  CU_ASSERT_EQUAL(-4, p->fragment[0].length);
+  CU_ASSERT_EQUAL(-1, fp_receive(&rx, frame+1));
+  CU_ASSERT_EQUAL(EAGAIN, errno);
+
+  /* A frame already received is delivered without reading */
+  CU_ASSERT_EQUAL(4, write(pfd[1], "f\ng\n", 4));
+  CU_ASSERT_EQUAL(4, fp_receive(&rx, frame+1));
+  CU_ASSERT_EQUAL(0, memcmp(frame[1], "def\n", 4));
+  close(pfd[1]);
+  CU_ASSERT_EQUAL(2, fp_receive(&rx, frame+2));
+  CU_ASSERT_EQUAL(0, memcmp(frame[2], "g\n", 2));
+  CU_ASSERT_PTR_NULL(rx.start);
+  CU_ASSERT_EQUAL(-2, p->fragment[2].length);
+  CU_ASSERT_EQUAL(0, rx.copied);
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  CU_ASSERT_EQUAL(0, fp_receive(&rx, frame));
+  CU_ASSERT_EQUAL(0, rx.fill);
+  fp_receiver_close(&rx);
+  close(pfd[0]);
+  CU_ASSERT_EQUAL(0, fp_release(p, frame[0]));
+  CU_ASSERT_EQUAL(0, fp_release(p, frame[1]));
+  CU_ASSERT_EQUAL(0, fp_release(p, frame[2]));
+  CU_ASSERT_EQUAL(POOL_SIZE, p->fragment[0].length);
+}
+
+void
+test_send ()
+{
+  fp_pool_t p = pool;
+  struct fp_send_entry_t entries[4];
+  struct fp_sender_t tx;
+  uint8_t buf[POOL_SIZE];
+  uint8_t* b[5];
+  uint8_t* be;
+  int pfd[2];
+  int i;
+
+  fp_reset(p);
+  CU_ASSERT_EQUAL(0, pipe2(pfd, O_NONBLOCK));
+
+  /* Written fragments are released immediately */
+  CU_ASSERT_EQUAL(0, fp_sender_init(&tx, p, pfd[1], entries, 4, 0));
+  CU_ASSERT_EQUAL(0, fp_send(&tx));
+  b[0] = fp_request(p, 10, 10, &be);
+  memset(b[0], 'a', 10);
+  b[1] = fp_request(p, 20, 20, &be);
+  memset(b[1], 'b', 20);
+  CU_ASSERT_EQUAL(0, fp_send_queue(&tx, b[0], 10));
+  CU_ASSERT_EQUAL(0, fp_send_queue(&tx, b[1], 15));
+  CU_ASSERT_EQUAL(25, fp_send(&tx));
+  CU_ASSERT_EQUAL(0, tx.count);
+  CU_ASSERT_EQUAL(POOL_SIZE, p->fragment[0].length);
+  CU_ASSERT_EQUAL(25, read(pfd[0], buf, sizeof(buf)));
+  CU_ASSERT_EQUAL('a', buf[9]);
+  CU_ASSERT_EQUAL('b', buf[10]);
+
+  /* The queue is bounded, and unsent fragments can be discarded */
+  for (i = 0; i < 5; ++i) {
+    b[i] = fp_request(p, 10, 10, &be);
+  }
+  for (i = 0; i < 4; ++i) {
+    CU_ASSERT_EQUAL(0, fp_send_queue(&tx, b[i], 10));
+  }
+  CU_ASSERT_EQUAL(-1, fp_send_queue(&tx, b[4], 10));
+  CU_ASSERT_EQUAL(ENOBUFS, errno);
+  CU_ASSERT_EQUAL(0, fp_release(p, b[4]));
+  CU_ASSERT_EQUAL(0, fp_sender_discard(&tx));
+  CU_ASSERT_EQUAL(POOL_SIZE, p->fragment[0].length);
+
+  /* Spliced fragments are held until the pipe has been read */
+  CU_ASSERT_EQUAL(0, fp_sender_init(&tx, p, pfd[1], entries, 4, FP_SEND_VMSPLICE));
+  b[0] = fp_request(p, 100, 100, &be);
+  memset(b[0], 'c', 100);
+  CU_ASSERT_EQUAL(0, fp_send_queue(&tx, b[0], 100));
+  CU_ASSERT_EQUAL(100, fp_send(&tx));
+  CU_ASSERT_EQUAL(1, tx.count);
+  CU_ASSERT_EQUAL(40, read(pfd[0], buf, 40));
+  CU_ASSERT_EQUAL(0, fp_send_reclaim(&tx));
+  CU_ASSERT_EQUAL(60, read(pfd[0], buf, sizeof(buf)));
+  CU_ASSERT_EQUAL('c', buf[59]);
+  CU_ASSERT_EQUAL(1, fp_send_reclaim(&tx));
+  CU_ASSERT_EQUAL(0, tx.count);
+  CU_ASSERT_EQUAL(POOL_SIZE, p->fragment[0].length);
+  close(pfd[0]);
+  close(pfd[1]);
+}
+
+void
+test_send_zerocopy ()
+{
+  fp_pool_t p = pool;
+  struct fp_send_entry_t entries[2];
+  struct fp_sender_t tx;
+  struct sockaddr_in sin;
+  socklen_t slen = sizeof(sin);
+  uint8_t buf[POOL_SIZE];
+  uint8_t* bp;
+  uint8_t* be;
+  int ls;
+  int cs;
+  int ss;
+  int i;
+
+  /* Zero-copy requires a kernel and network that support it */
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ls = socket(AF_INET, SOCK_STREAM, 0);
+  if ((0 > ls)
+      || (0 != bind(ls, (struct sockaddr*)&sin, sizeof(sin)))
+      || (0 != listen(ls, 1))
+      || (0 != getsockname(ls, (struct sockaddr*)&sin, &slen))) {
+    return;
+  }
+  cs = socket(AF_INET, SOCK_STREAM, 0);
+  CU_ASSERT_EQUAL(0, connect(cs, (struct sockaddr*)&sin, sizeof(sin)));
+  ss = accept(ls, NULL, NULL);
+  CU_ASSERT_TRUE(0 <= ss);
+  fp_reset(p);
+  if (0 == fp_sender_init(&tx, p, cs, entries, 2, FP_SEND_ZEROCOPY)) {
+    bp = fp_request(p, 100, 100, &be);
+    memset(bp, 'z', 100);
+    CU_ASSERT_EQUAL(0, fp_send_queue(&tx, bp, 100));
+    CU_ASSERT_EQUAL(100, fp_send(&tx));
+    CU_ASSERT_EQUAL(100, recv(ss, buf, 100, MSG_WAITALL));
+    CU_ASSERT_EQUAL('z', buf[99]);
+    for (i = 0; (i < 100) && (0 < tx.count); ++i) {
+      struct pollfd pfd = { .fd = cs, .events = 0 };
+      poll(&pfd, 1, 10);
+      fp_send_reclaim(&tx);
+    }
+    CU_ASSERT_EQUAL(0, tx.count);
+    CU_ASSERT_EQUAL(POOL_SIZE, p->fragment[0].length);
+  }
+  close(ss);
+  close(cs);
+  close(ls);
+}
+
+void
+test_pool_map ()
+{
+  const size_t page = sysconf(_SC_PAGESIZE);
+  fp_pool_t p;
+  uint8_t* bp;
+  uint8_t* be;
+  uint8_t c;
+  int fd;
+
+  /* The size is rounded up to whole pages */
+  p = fp_pool_map(1000, 4, 8, FP_MAP_PREFAULT, NULL);
+  CU_ASSERT_PTR_NOT_NULL(p);
+  if (NULL == p) {
+    return;
+  }
+  CU_ASSERT_EQUAL(page, p->pool_end - p->pool_start);
+  CU_ASSERT_EQUAL(0, (uintptr_t)p->pool_start % page);
+  CU_ASSERT_EQUAL(4, p->fragment_count);
+  CU_ASSERT_EQUAL(8, p->pool_alignment);
+  CU_ASSERT_EQUAL(page, p->fragment[0].length);
+  bp = fp_request(p, 100, 100, &be);
+  CU_ASSERT_EQUAL(104, be - bp);
+  CU_ASSERT_EQUAL(0, fp_release(p, bp));
+  fp_pool_unmap(p);
+
+  /* Pool memory is the memfd content */
+  p = fp_pool_map(page, 4, 8, FP_MAP_MEMFD, &fd);
+  CU_ASSERT_PTR_NOT_NULL(p);
+  if (NULL == p) {
+    return;
+  }
+  bp = fp_request(p, 16, 16, &be);
+  bp[10] = 'm';
+  CU_ASSERT_EQUAL(1, pread(fd, &c, 1, bp + 10 - p->pool_start));
+  CU_ASSERT_EQUAL('m', c);
+  fp_pool_unmap(p);
+  close(fd);
+
+  CU_ASSERT_PTR_NULL(fp_pool_map(0, 4, 8, 0, NULL));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  CU_ASSERT_PTR_NULL(fp_pool_map((size_t)FP_MAX_FRAGMENT_SIZE + 1, 4, 8, 0, NULL));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  CU_ASSERT_PTR_NULL(fp_pool_map(page, 4, 3, 0, NULL));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+#if FRAGPOOL_WITH_SIZE_INDEX
+  CU_ASSERT_PTR_NULL(fp_pool_map(page, FP_MAX_COUNT, 8, 0, NULL));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+#endif /* FRAGPOOL_WITH_SIZE_INDEX */
+
+#if 32 <= FRAGPOOL_SIZE_BITS
+  /* Transparent huge pages are advisory, but the pool is aligned */
+  p = fp_pool_map(page, 4, 8, FP_MAP_THP | FP_MAP_PREFAULT, NULL);
+  CU_ASSERT_PTR_NOT_NULL(p);
+  if (NULL == p) {
+    return;
+  }
+  CU_ASSERT_EQUAL(0, (uintptr_t)p->pool_start % (p->pool_end - p->pool_start));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+  fp_pool_unmap(p);
+#endif /* FRAGPOOL_SIZE_BITS */
+}
+
+void
+test_trim ()
+{
+  const size_t page = sysconf(_SC_PAGESIZE);
+  struct fp_trimmer_t trimmer;
+  fp_trimmer_t tr = &trimmer;
+  fp_pool_t p;
+  uint8_t* bp[2];
+  uint8_t* be;
+
+  if ((7 * page) > FP_MAX_FRAGMENT_SIZE) {
+    return;
+  }
+  p = fp_pool_map(7 * page, 8, 8, FP_MAP_PREFAULT, NULL);
+  CU_ASSERT_PTR_NOT_NULL(p);
+  if (NULL == p) {
+    return;
+  }
+  CU_ASSERT_EQUAL(0, fp_trimmer_init(tr, p, MADV_DONTNEED, 2 * page));
+  CU_ASSERT_EQUAL(7, fp_trimmer_resident(tr));
+
+  /* Only whole pages of the available fragment are trimmed, once */
+  bp[0] = fp_request(p, 100, 100, &be);
+  CU_ASSERT_EQUAL(6, fp_trim(tr));
+  CU_ASSERT_EQUAL(1, fp_trimmer_resident(tr));
+  CU_ASSERT_EQUAL(6, tr->trimmed_pages);
+  CU_ASSERT_EQUAL(1, tr->advise_calls);
+  CU_ASSERT_EQUAL(0, fp_trim(tr));
+  CU_ASSERT_EQUAL(1, tr->advise_calls);
+
+  /* Reused pages are counted, and trimmed again once released */
+  bp[1] = fp_request(p, 2 * page, 2 * page, &be);
+  memset(bp[1], 1, be - bp[1]);
+  CU_ASSERT_EQUAL(0, fp_trim(tr));
+  CU_ASSERT_EQUAL(2, tr->pages_refaulted);
+  CU_ASSERT_EQUAL(4, tr->trimmed_pages);
+  CU_ASSERT_EQUAL(0, fp_release(p, bp[1]));
+  CU_ASSERT_EQUAL(2, fp_trim(tr));
+  CU_ASSERT_EQUAL(6, tr->trimmed_pages);
+  CU_ASSERT_EQUAL(1, fp_trimmer_resident(tr));
+
+#if FRAGPOOL_WITH_NOTIFY
+  /* A release that forms a long fragment trims it */
+  fp_trimmer_attach(tr, 3 * page);
+  bp[1] = fp_request(p, 2 * page, 2 * page, &be);
+  memset(bp[1], 1, be - bp[1]);
+  CU_ASSERT_EQUAL(3, fp_trimmer_resident(tr));
+  CU_ASSERT_EQUAL(0, fp_release(p, bp[1]));
+  CU_ASSERT_EQUAL(1, fp_trimmer_resident(tr));
+  CU_ASSERT_EQUAL(4, tr->pages_refaulted);
+  fp_trimmer_destroy(tr);
+  CU_ASSERT_PTR_NULL(p->notify);
+#else /* FRAGPOOL_WITH_NOTIFY */
+  fp_trimmer_destroy(tr);
+#endif /* FRAGPOOL_WITH_NOTIFY */
+  fp_pool_unmap(p);
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  CU_ErrorCode rc;
+  CU_pSuite suite = NULL;
+  typedef struct test_def {
+    const char* name;
+    void (*fn) (void);
+  } test_def;
+  const test_def tests[] = {
+#if FRAGPOOL_WITH_NOTIFY
+    { "eventfd", test_eventfd },
+#endif /* FRAGPOOL_WITH_NOTIFY */
+    { "chain_iovec", test_chain_iovec },
+    { "receive", test_receive },
+    { "send", test_send },
+    { "send_zerocopy", test_send_zerocopy },
+    { "pool_map", test_pool_map },
+    { "trim", test_trim },
+    { NULL, NULL }
+  };
+  int i;
+
+  rc = CU_initialize_registry();
+  if (CUE_SUCCESS != rc) {
+    fprintf(stderr, "CU_initialize_registry %d: %s\n", rc, CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  suite = CU_add_suite("linux", init_suite, clean_suite);
+  if (! suite) {
+    fprintf(stderr, "CU_add_suite: %s\n", CU_get_error_msg());
+    goto done_registry;
+  }
+
+  for (i = 0; NULL != tests[i].name; ++i) {
+    const test_def* td = tests + i;
+    if (! (CU_add_test(suite, td->name, td->fn))) {
+      fprintf(stderr, "CU_add_test(%s): %s\n", td->name, CU_get_error_msg());
+      goto done_registry;
+    }
+  }
+  printf("Running tests\n");
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+
+done_registry:
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
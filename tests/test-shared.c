@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <fragpool/shared.h>
+#include <CUnit/Basic.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+int init_suite (void)
+{
+  return 0;
+}
+int clean_suite (void)
+{
+  return 0;
+}
+
+#if (FRAGPOOL_WITH_LOCK) && ! (FRAGPOOL_WITH_SIZE_INDEX)
+
+#define POOL_SIZE 1024
+#define POOL_FRAGMENTS 8
+#define POOL_ALIGNMENT 8
+
+/* Map a temporary file twice, as two processes would map a segment */
+static int
+map_segment (size_t length,
+             uint8_t** segp)
+{
+  char path[] = "/tmp/test-shared-XXXXXX";
+  int fd = mkstemp(path);
+
+  if (0 > fd) {
+    return -1;
+  }
+  unlink(path);
+  if (0 != ftruncate(fd, length)) {
+    close(fd);
+    return -1;
+  }
+  segp[0] = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  segp[1] = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return ((MAP_FAILED == segp[0]) || (MAP_FAILED == segp[1])) ? -1 : 0;
+}
+
+void
+test_shared_format ()
+{
+  const size_t length = fp_shared_size(POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT);
+  uint8_t* seg[2];
+  struct fp_shared_t sh;
+
+  CU_ASSERT_EQUAL(0, map_segment(length, seg));
+  CU_ASSERT_EQUAL(-1, fp_shared_attach(&sh, seg[0]));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  CU_ASSERT_EQUAL(-1, fp_shared_format(seg[0], POOL_SIZE, POOL_FRAGMENTS, 3));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  CU_ASSERT_EQUAL(-1, fp_shared_format(seg[0], POOL_SIZE, 0, POOL_ALIGNMENT));
+  CU_ASSERT_EQUAL(0, fp_shared_format(seg[0], POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT));
+  CU_ASSERT_EQUAL(0, fp_shared_attach(&sh, seg[0]));
+  CU_ASSERT_PTR_EQUAL(seg[0] + length - POOL_SIZE, sh.pool->pool_start);
+  CU_ASSERT_EQUAL(0, fp_validate(sh.pool));
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(sh.pool));
+  fp_shared_detach(&sh);
+
+  /* A header whose geometry does not describe the segment is rejected */
+  ((fp_shared_header_t)seg[0])->fragment_count = 0;
+  CU_ASSERT_EQUAL(-1, fp_shared_attach(&sh, seg[0]));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  ((fp_shared_header_t)seg[0])->fragment_count = POOL_FRAGMENTS + 1;
+  CU_ASSERT_EQUAL(-1, fp_shared_attach(&sh, seg[0]));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  ((fp_shared_header_t)seg[0])->fragment_count = POOL_FRAGMENTS;
+  ((fp_shared_header_t)seg[0])->alignment = 3;
+  CU_ASSERT_EQUAL(-1, fp_shared_attach(&sh, seg[0]));
+  CU_ASSERT_EQUAL(EINVAL, errno);
+  munmap(seg[0], length);
+  munmap(seg[1], length);
+}
+
+void
+test_shared_mappings ()
+{
+  const size_t length = fp_shared_size(POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT);
+  uint8_t* seg[2];
+  struct fp_shared_t sh[2];
+  uint8_t* bp[3];
+  uint8_t* be;
+  fp_size_t offset;
+
+  CU_ASSERT_EQUAL(0, map_segment(length, seg));
+  CU_ASSERT_PTR_NOT_EQUAL(seg[0], seg[1]);
+  CU_ASSERT_EQUAL(0, fp_shared_format(seg[0], POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT));
+  CU_ASSERT_EQUAL(0, fp_shared_attach(sh+0, seg[0]));
+  CU_ASSERT_EQUAL(0, fp_shared_attach(sh+1, seg[1]));
+
+  /* A fragment allocated through one mapping is seen by the other */
+  bp[0] = fp_request(sh[0].pool, 100, 100, &be);
+  CU_ASSERT_PTR_EQUAL(sh[0].pool->pool_start, bp[0]);
+  memcpy(bp[0], "hello", 6);
+  offset = fp_shared_offset(sh+0, bp[0]);
+  bp[1] = fp_request(sh[1].pool, 50, 50, &be);
+  CU_ASSERT_PTR_EQUAL(sh[1].pool->pool_start + 104, bp[1]);
+  CU_ASSERT_EQUAL(0, strcmp("hello", (char*)fp_shared_pointer(sh+1, offset)));
+
+  /* Either may release it, and the other sees it released */
+  CU_ASSERT_EQUAL(0, fp_release(sh[1].pool, fp_shared_pointer(sh+1, offset)));
+  bp[2] = fp_request(sh[0].pool, 104, 104, &be);
+  CU_ASSERT_PTR_EQUAL(bp[0], bp[2]);
+  CU_ASSERT_EQUAL(0, fp_release(sh[0].pool, bp[2]));
+  CU_ASSERT_EQUAL(0, fp_release(sh[0].pool, fp_shared_pointer(sh+0, fp_shared_offset(sh+1, bp[1]))));
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(sh[1].pool));
+  CU_ASSERT_EQUAL(0, fp_validate(sh[0].pool));
+  CU_ASSERT_EQUAL(0, fp_validate(sh[1].pool));
+  CU_ASSERT_EQUAL(1, sh[0].header->active);
+
+  fp_shared_detach(sh+0);
+  fp_shared_detach(sh+1);
+  munmap(seg[0], length);
+  munmap(seg[1], length);
+}
+
+void
+test_shared_compact ()
+{
+  const size_t length = fp_shared_size(POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT);
+  uint8_t* seg[2];
+  struct fp_shared_t sh[2];
+  uint8_t* bp[3];
+  uint8_t* be;
+  int i;
+
+  CU_ASSERT_EQUAL(0, map_segment(length, seg));
+  CU_ASSERT_EQUAL(0, fp_shared_format(seg[0], POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT));
+  CU_ASSERT_EQUAL(0, fp_shared_attach(sh+0, seg[0]));
+  CU_ASSERT_EQUAL(0, fp_shared_attach(sh+1, seg[1]));
+  CU_ASSERT_TRUE(sh[0].lock.shared);
+
+  /* Leave space before fragments another process holds */
+  for (i = 0; i < 3; ++i) {
+    bp[i] = fp_request(sh[0].pool, 32, 32, &be);
+    CU_ASSERT_PTR_EQUAL(sh[0].pool->pool_start + 32 * i, bp[i]);
+    memset(bp[i], 'a' + i, 32);
+  }
+  CU_ASSERT_EQUAL(0, fp_release(sh[0].pool, bp[0]));
+
+  /* Neither process moves them */
+  CU_ASSERT_EQUAL(0, fp_compact(sh[1].pool, NULL));
+  CU_ASSERT_EQUAL(0, fp_compact_step(sh[0].pool, NULL, POOL_SIZE));
+  CU_ASSERT_EQUAL(0, fp_validate(sh[1].pool));
+  CU_ASSERT_EQUAL('b', bp[1][0]);
+  CU_ASSERT_EQUAL('c', bp[2][31]);
+  CU_ASSERT_EQUAL(0, fp_release(sh[1].pool, fp_shared_pointer(sh+1, fp_shared_offset(sh+0, bp[1]))));
+  CU_ASSERT_EQUAL(0, fp_release(sh[0].pool, bp[2]));
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(sh[0].pool));
+  CU_ASSERT_EQUAL(0, fp_validate(sh[0].pool));
+
+  fp_shared_detach(sh+0);
+  fp_shared_detach(sh+1);
+  munmap(seg[0], length);
+  munmap(seg[1], length);
+}
+
+void
+test_shared_process ()
+{
+  const size_t length = fp_shared_size(POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT);
+  uint8_t* seg[2];
+  struct fp_shared_t sh;
+  fp_size_t offset = 0;
+  int pfd[2];
+  int status;
+  pid_t pid;
+
+  CU_ASSERT_EQUAL(0, map_segment(length, seg));
+  CU_ASSERT_EQUAL(0, fp_shared_format(seg[0], POOL_SIZE, POOL_FRAGMENTS, POOL_ALIGNMENT));
+  CU_ASSERT_EQUAL(0, pipe(pfd));
+  pid = fork();
+  if (0 == pid) {
+    /* The producer fills a fragment and passes its offset */
+    uint8_t* bp;
+    uint8_t* be;
+
+    if (0 != fp_shared_attach(&sh, seg[1])) {
+      _exit(1);
+    }
+    bp = fp_request(sh.pool, 64, 64, &be);
+    if (NULL == bp) {
+      _exit(1);
+    }
+    memcpy(bp, "from child", 11);
+    offset = fp_shared_offset(&sh, bp);
+    _exit(sizeof(offset) == write(pfd[1], &offset, sizeof(offset)) ? 0 : 1);
+  }
+  CU_ASSERT_TRUE(0 < pid);
+  CU_ASSERT_EQUAL(sizeof(offset), read(pfd[0], &offset, sizeof(offset)));
+  CU_ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+  CU_ASSERT_EQUAL(0, status);
+
+  /* The consumer reads it in place and releases it */
+  CU_ASSERT_EQUAL(0, fp_shared_attach(&sh, seg[0]));
+  CU_ASSERT_EQUAL(POOL_SIZE - 64, fp_largest_available(sh.pool));
+  CU_ASSERT_EQUAL(0, strcmp("from child", (char*)fp_shared_pointer(&sh, offset)));
+  CU_ASSERT_EQUAL(0, fp_release(sh.pool, fp_shared_pointer(&sh, offset)));
+  CU_ASSERT_EQUAL(POOL_SIZE, fp_largest_available(sh.pool));
+  fp_shared_detach(&sh);
+  close(pfd[0]);
+  close(pfd[1]);
+  munmap(seg[0], length);
+  munmap(seg[1], length);
+}
+
+#endif /* FRAGPOOL_WITH_LOCK && ! FRAGPOOL_WITH_SIZE_INDEX */
+
+int
+main (int argc,
+      char* argv[])
+{
+  CU_ErrorCode rc;
+  CU_pSuite suite = NULL;
+  typedef struct test_def {
+    const char* name;
+    void (*fn) (void);
+  } test_def;
+  const test_def tests[] = {
+#if (FRAGPOOL_WITH_LOCK) && ! (FRAGPOOL_WITH_SIZE_INDEX)
+    { "shared_format", test_shared_format },
+    { "shared_mappings", test_shared_mappings },
+    { "shared_compact", test_shared_compact },
+    { "shared_process", test_shared_process },
+#endif /* FRAGPOOL_WITH_LOCK && ! FRAGPOOL_WITH_SIZE_INDEX */
+    { NULL, NULL }
+  };
+  int i;
+
+  rc = CU_initialize_registry();
+  if (CUE_SUCCESS != rc) {
+    fprintf(stderr, "CU_initialize_registry %d: %s\n", rc, CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  suite = CU_add_suite("shared", init_suite, clean_suite);
+  if (! suite) {
+    fprintf(stderr, "CU_add_suite: %s\n", CU_get_error_msg());
+    goto done_registry;
+  }
+
+  for (i = 0; NULL != tests[i].name; ++i) {
+    const test_def* td = tests + i;
+    if (! (CU_add_test(suite, td->name, td->fn))) {
+      fprintf(stderr, "CU_add_test(%s): %s\n", td->name, CU_get_error_msg());
+      goto done_registry;
+    }
+  }
+  printf("Running tests\n");
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+
+done_registry:
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <fragpool/fragpool.h>
+#include <fragpool/uring.h>
+#include <CUnit/Basic.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int init_suite (void)
+{
+  return 0;
+}
+int clean_suite (void)
+{
+  return 0;
+}
+
+#define POOL_SIZE 512
+#define POOL_FRAGMENTS 8
+#define RING_ENTRIES 4
+#define BGID 7
+
+static uint8_t pool_data[POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} pool_union = {
+  .generic = {
+    .pool_start = pool_data,
+    .pool_end = pool_data + sizeof(pool_data),
+    .pool_alignment = 1,
+    .fragment_count = POOL_FRAGMENTS
+  }
+};
+fp_pool_t const pool = &pool_union.generic;
+
+/* A minimal io_uring, so the tests do not depend on liburing */
+static struct {
+  int fd;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+} ring = { .fd = -1 };
+
+static int
+ring_setup (void)
+{
+  struct io_uring_params params;
+  uint8_t* sq;
+  uint8_t* cq;
+  size_t sq_len;
+  size_t cq_len;
+
+  memset(&params, 0, sizeof(params));
+  ring.fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (0 > ring.fd) {
+    return -1;
+  }
+  sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring.fd, IORING_OFF_SQ_RING);
+  cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring.fd, IORING_OFF_CQ_RING);
+  ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring.fd, IORING_OFF_SQES);
+  if ((MAP_FAILED == sq) || (MAP_FAILED == cq) || (MAP_FAILED == ring.sqes)) {
+    close(ring.fd);
+    ring.fd = -1;
+    return -1;
+  }
+  ring.sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+  ring.sq_mask = (unsigned int*)(sq + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned int*)(sq + params.sq_off.array);
+  ring.cq_head = (unsigned int*)(cq + params.cq_off.head);
+  ring.cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+  ring.cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return 0;
+}
+
+/* Submit a read that selects a buffer, and wait for its completion */
+static int
+ring_read (int fd,
+           unsigned int len,
+           struct io_uring_cqe* cqep)
+{
+  unsigned int tail = *ring.sq_tail;
+  unsigned int idx = tail & *ring.sq_mask;
+  struct io_uring_sqe* sqe = ring.sqes + idx;
+  unsigned int head;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->len = len;
+  sqe->off = -1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BGID;
+  ring.sq_array[idx] = idx;
+  __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  if (1 != syscall(__NR_io_uring_enter, ring.fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0)) {
+    return -1;
+  }
+  head = *ring.cq_head;
+  if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+    return -1;
+  }
+  *cqep = ring.cqes[head & *ring.cq_mask];
+  __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void
+test_register_pool ()
+{
+  if (0 > ring.fd) {
+    return;
+  }
+  CU_ASSERT_EQUAL(0, fp_uring_register_pool(ring.fd, pool));
+}
+
+void
+test_provided_buffers ()
+{
+  fp_pool_t p = pool;
+  struct fp_uring_bufs_t bufs;
+  uint8_t* start[RING_ENTRIES];
+  struct io_uring_cqe cqe;
+  uint8_t* bp[2];
+  uint8_t* bpe;
+  int pfd[2];
+
+  if (0 > ring.fd) {
+    return;
+  }
+  fp_reset(p);
+  CU_ASSERT_EQUAL(-1, fp_uring_setup(&bufs, p, ring.fd, BGID, 3, start, 16, 64));
+  if (0 != fp_uring_setup(&bufs, p, ring.fd, BGID, RING_ENTRIES, start, 16, 64)) {
+    /* Provided-buffer rings need Linux 5.19 */
+    return;
+  }
+  CU_ASSERT_EQUAL(RING_ENTRIES, bufs.count);
+  CU_ASSERT_EQUAL(POOL_SIZE - RING_ENTRIES * 64, fp_largest_available(p));
+  CU_ASSERT_EQUAL(0, fp_uring_refill(&bufs));
+
+  /* A completion selects a fragment, which is trimmed to the data */
+  CU_ASSERT_EQUAL(0, pipe(pfd));
+  CU_ASSERT_EQUAL(5, write(pfd[1], "hello", 5));
+  CU_ASSERT_EQUAL(0, ring_read(pfd[0], 64, &cqe));
+  CU_ASSERT_EQUAL(5, cqe.res);
+  bp[0] = fp_uring_take(&bufs, cqe.flags, cqe.res, &bpe);
+  CU_ASSERT_PTR_NOT_NULL(bp[0]);
+  CU_ASSERT_EQUAL(5, bpe - bp[0]);
+  CU_ASSERT_EQUAL(0, memcmp(bp[0], "hello", 5));
+  CU_ASSERT_EQUAL(RING_ENTRIES - 1, bufs.count);
+  CU_ASSERT_PTR_NULL(fp_uring_take(&bufs, cqe.flags, cqe.res, &bpe));
+  CU_ASSERT_PTR_NULL(fp_uring_take(&bufs, 0, 5, &bpe));
+
+  /* The ring is refilled while the application holds the fragment */
+  CU_ASSERT_EQUAL(1, fp_uring_refill(&bufs));
+  CU_ASSERT_EQUAL(RING_ENTRIES, bufs.count);
+  CU_ASSERT_EQUAL(3, write(pfd[1], "abc", 3));
+  CU_ASSERT_EQUAL(0, ring_read(pfd[0], 64, &cqe));
+  bp[1] = fp_uring_take(&bufs, cqe.flags, cqe.res, &bpe);
+  CU_ASSERT_EQUAL(3, bpe - bp[1]);
+  CU_ASSERT_EQUAL(0, memcmp(bp[1], "abc", 3));
+  CU_ASSERT_EQUAL(0, fp_validate(p));
+
+  CU_ASSERT_EQUAL(0, fp_release(p, bp[0]));
+  CU_ASSERT_EQUAL(0, fp_release(p, bp[1]));
+  fp_uring_teardown(&bufs);
+  CU_ASSERT_EQUAL(POOL_SIZE, p->fragment[0].length);
+  close(pfd[0]);
+  close(pfd[1]);
+}
+
+int
+main (int argc,
+      char* argv[])
+{
+  CU_ErrorCode rc;
+  CU_pSuite suite = NULL;
+  typedef struct test_def {
+    const char* name;
+    void (*fn) (void);
+  } test_def;
+  const test_def tests[] = {
+    { "register_pool", test_register_pool },
+    { "provided_buffers", test_provided_buffers },
+    { NULL, NULL }
+  };
+  int i;
+
+  /* io_uring may be unavailable or disabled, in which case there is
+   * nothing to test. */
+  if (0 != ring_setup()) {
+    fprintf(stderr, "io_uring unavailable, tests skipped\n");
+  }
+
+  rc = CU_initialize_registry();
+  if (CUE_SUCCESS != rc) {
+    fprintf(stderr, "CU_initialize_registry %d: %s\n", rc, CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  suite = CU_add_suite("uring", init_suite, clean_suite);
+  if (! suite) {
+    fprintf(stderr, "CU_add_suite: %s\n", CU_get_error_msg());
+    goto done_registry;
+  }
+
+  for (i = 0; NULL != tests[i].name; ++i) {
+    const test_def* td = tests + i;
+    if (! (CU_add_test(suite, td->name, td->fn))) {
+      fprintf(stderr, "CU_add_test(%s): %s\n", td->name, CU_get_error_msg());
+      goto done_registry;
+    }
+  }
+  printf("Running tests\n");
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+
+done_registry:
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}
@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fragpool/fragpool.h>
+#include <fragpool/wait.h>
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int init_suite (void)
+{
+  return 0;
+}
+int clean_suite (void)
+{
+  return 0;
+}
+
+#define POOL_SIZE 256
+#define POOL_FRAGMENTS 6
+
+static uint8_t pool_data[POOL_SIZE];
+static union {
+  struct {
+    FP_POOL_STRUCT_COMMON;
+    struct fp_fragment_t fragment[POOL_FRAGMENTS];
+  } fixed;
+  struct fp_pool_t generic;
+} pool_union = {
+  .generic = {
+    .pool_start = pool_data,
+    .pool_end = pool_data + sizeof(pool_data),
+    .pool_alignment = 1,
+    .fragment_count = POOL_FRAGMENTS
+  }
+};
+fp_pool_t const pool = &pool_union.generic;
+
+#if (FRAGPOOL_WITH_NOTIFY) && (FRAGPOOL_WITH_LOCK)
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+mutex_lock (void* context)
+{
+  pthread_mutex_lock(context);
+}
+
+static void
+mutex_unlock (void* context)
+{
+  pthread_mutex_unlock(context);
+}
+
+static const struct fp_lock_t hooks = { mutex_lock, mutex_unlock, &pool_mutex };
+static struct fp_wait_queue_t wait_queue;
+
+typedef struct request {
+  pthread_t thread;
+  fp_size_t min_size;
+  const struct timespec* abstime;
+  uint8_t* bp;
+  uint8_t* bpe;
+  volatile int done;
+} request;
+
+static void*
+run_request (void* arg)
+{
+  request* rp = arg;
+
+  rp->bp = fp_request_wait(&wait_queue, rp->min_size, rp->min_size, &rp->bpe, rp->abstime);
+  rp->done = 1;
+  return NULL;
+}
+
+static void
+sleep_ms (long ms)
+{
+  struct timespec ts = { 0, ms * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+static void
+deadline_ms (struct timespec* ts,
+             long ms)
+{
+  clock_gettime(CLOCK_MONOTONIC, ts);
+  ts->tv_nsec += ms * 1000000L;
+  ts->tv_sec += ts->tv_nsec / 1000000000L;
+  ts->tv_nsec %= 1000000000L;
+}
+
+/* Start a request and wait until it is queued */
+static void
+start_request (request* rp,
+               fp_size_t min_size,
+               const struct timespec* abstime)
+{
+  unsigned int length = fp_wait_queue_length(&wait_queue);
+
+  rp->min_size = min_size;
+  rp->abstime = abstime;
+  rp->bp = NULL;
+  rp->done = 0;
+  pthread_create(&rp->thread, NULL, run_request, rp);
+  while (fp_wait_queue_length(&wait_queue) == length) {
+    sleep_ms(1);
+  }
+}
+
+static void
+setup (void)
+{
+  pool->lock = &hooks;
+  fp_reset(pool);
+  CU_ASSERT_EQUAL(0, fp_wait_queue_init(&wait_queue, pool));
+}
+
+static void
+teardown (void)
+{
+  CU_ASSERT_EQUAL(0, fp_wait_queue_length(&wait_queue));
+  fp_wait_queue_destroy(&wait_queue);
+  CU_ASSERT_PTR_NULL(pool->notify);
+  CU_ASSERT_EQUAL(0, fp_validate(pool));
+  pool->lock = NULL;
+}
+
+void
+test_wait_immediate ()
+{
+  uint8_t* b;
+  uint8_t* be;
+  struct timespec abstime;
+
+  setup();
+  CU_ASSERT_PTR_NULL(fp_request_wait(&wait_queue, 0, 16, &be, NULL));
+  CU_ASSERT_PTR_NULL(fp_request_wait(&wait_queue, 32, 16, &be, NULL));
+  b = fp_request_wait(&wait_queue, 200, 200, &be, NULL);
+  CU_ASSERT_PTR_EQUAL(b, pool_data);
+  CU_ASSERT_EQUAL(be - b, 200);
+
+  /* A request that cannot be met gives up at the deadline */
+  deadline_ms(&abstime, 20);
+  CU_ASSERT_PTR_NULL(fp_request_wait(&wait_queue, 64, 64, &be, &abstime));
+  CU_ASSERT_EQUAL(0, fp_release(pool, b));
+  teardown();
+}
+
+void
+test_wait_fifo ()
+{
+  request big;
+  request small;
+  uint8_t* b0;
+  uint8_t* b1;
+  uint8_t* be;
+
+  setup();
+  b0 = fp_request(pool, 64, 64, &be);
+  b1 = fp_request(pool, 192, 192, &be);
+  CU_ASSERT_PTR_NOT_NULL(b1);
+
+  start_request(&big, 200, NULL);
+  start_request(&small, 16, NULL);
+
+  /* The small request fits but must not overtake the big one */
+  CU_ASSERT_EQUAL(0, fp_release(pool, b0));
+  sleep_ms(20);
+  CU_ASSERT_FALSE(small.done);
+  CU_ASSERT_EQUAL(2, fp_wait_queue_length(&wait_queue));
+
+  /* Both are served, in order, once there is room */
+  CU_ASSERT_EQUAL(0, fp_release(pool, b1));
+  pthread_join(big.thread, NULL);
+  pthread_join(small.thread, NULL);
+  CU_ASSERT_PTR_EQUAL(big.bp, pool_data);
+  CU_ASSERT_EQUAL(big.bpe - big.bp, 200);
+  CU_ASSERT_PTR_EQUAL(small.bp, pool_data + 200);
+  CU_ASSERT_EQUAL(small.bpe - small.bp, 16);
+
+  CU_ASSERT_EQUAL(0, fp_release(pool, big.bp));
+  CU_ASSERT_EQUAL(0, fp_release(pool, small.bp));
+  teardown();
+}
+
+void
+test_wait_timeout_head ()
+{
+  request big;
+  request small;
+  struct timespec abstime;
+  uint8_t* b0;
+  uint8_t* b1;
+  uint8_t* be;
+
+  setup();
+  b0 = fp_request(pool, 64, 64, &be);
+  b1 = fp_request(pool, 192, 192, &be);
+  CU_ASSERT_PTR_NOT_NULL(b1);
+
+  deadline_ms(&abstime, 50);
+  start_request(&big, 200, &abstime);
+  start_request(&small, 16, NULL);
+  CU_ASSERT_EQUAL(0, fp_release(pool, b0));
+
+  /* When the head gives up the next waiter is served */
+  pthread_join(big.thread, NULL);
+  CU_ASSERT_PTR_NULL(big.bp);
+  pthread_join(small.thread, NULL);
+  CU_ASSERT_PTR_EQUAL(small.bp, pool_data);
+
+  CU_ASSERT_EQUAL(0, fp_release(pool, small.bp));
+  CU_ASSERT_EQUAL(0, fp_release(pool, b1));
+  teardown();
+}
+#endif /* FRAGPOOL_WITH_NOTIFY && FRAGPOOL_WITH_LOCK */
+
+int
+main (int argc,
+      char* argv[])
+{
+  CU_ErrorCode rc;
+  CU_pSuite suite = NULL;
+  typedef struct test_def {
+    const char* name;
+    void (*fn) (void);
+  } test_def;
+  const test_def tests[] = {
+#if (FRAGPOOL_WITH_NOTIFY) && (FRAGPOOL_WITH_LOCK)
+    { "wait_immediate", test_wait_immediate },
+    { "wait_fifo", test_wait_fifo },
+    { "wait_timeout_head", test_wait_timeout_head },
+#endif /* FRAGPOOL_WITH_NOTIFY && FRAGPOOL_WITH_LOCK */
+    { NULL, NULL }
+  };
+  int i;
+
+  rc = CU_initialize_registry();
+  if (CUE_SUCCESS != rc) {
+    fprintf(stderr, "CU_initialize_registry %d: %s\n", rc, CU_get_error_msg());
+    return CU_get_error();
+  }
+
+  suite = CU_add_suite("wait", init_suite, clean_suite);
+  if (! suite) {
+    fprintf(stderr, "CU_add_suite: %s\n", CU_get_error_msg());
+    goto done_registry;
+  }
+
+  for (i = 0; NULL != tests[i].name; ++i) {
+    const test_def* td = tests + i;
+    if (! (CU_add_test(suite, td->name, td->fn))) {
+      fprintf(stderr, "CU_add_test(%s): %s\n", td->name, CU_get_error_msg());
+      goto done_registry;
+    }
+  }
+  printf("Running tests\n");
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+
+done_registry:
+  CU_cleanup_registry();
+
+  return CU_get_error();
+}